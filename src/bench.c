@@ -0,0 +1,172 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Replays key event traces through the remapping core and reports the
+ * throughput. It does not need Windows, so performance regressions of the
+ * core can be measured on any machine:
+ *
+ *   make bench [TRACE=file.trace] [LAYOUT=bone] [LAYOUT_FILE=file.nlay]
+ *
+ * Without a trace file, a synthetic trace (random taps with and without
+ * Shift, Mod3 and Mod4) is replayed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+#include "latency.h"
+#include "hostplatform.h"
+#include "trace.h"
+#include "layoutfile.h"
+
+#define SYNTHETIC_TRACE_TAPS 100000
+#define MIN_REPLAYED_EVENTS 2000000
+
+uint64_t outputEvents = 0;
+
+void flushOutput() {
+	outputEvents += outputLength;
+	outputLength = 0;
+}
+
+/**
+ * Synthetic trace
+ **/
+static const BYTE mainBlockScanCodes[] = {
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27,
+	30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 57
+};
+
+DWORD vkCodeForScanCode(DWORD scanCode) {
+	switch (scanCode) {
+		case 42: return VK_LSHIFT;
+		case SCANCODE_CAPSLOCK_KEY: return VK_CAPITAL;
+		case SCANCODE_LOWER_THAN_KEY: return VK_OEM_102;
+		case 57: return VK_SPACE;
+		default: return 'A' + scanCode % 26;
+	}
+}
+
+void addTraceEvent(TraceRecord *records, size_t *count, DWORD scanCode, bool isKeyUp) {
+	TraceRecord *record = &records[(*count)++];
+	record->time = (uint32_t)*count;
+	record->scanCode = scanCode;
+	record->vkCode = vkCodeForScanCode(scanCode);
+	record->flags = isKeyUp ? LLKHF_UP : 0;
+	record->message = isKeyUp ? WM_KEYUP : WM_KEYDOWN;
+	record->swallowed = TRACE_UNKNOWN;
+	record->reserved = 0;
+}
+
+TraceRecord *generateTrace(size_t *count) {
+	TraceRecord *records = malloc(SYNTHETIC_TRACE_TAPS * 4 * sizeof(TraceRecord));
+	if (!records)
+		return NULL;
+
+	unsigned random = 12345;
+	*count = 0;
+	for (int i = 0; i < SYNTHETIC_TRACE_TAPS; i++) {
+		random = random * 1103515245 + 12345;
+		DWORD key = mainBlockScanCodes[(random >> 16) % sizeof mainBlockScanCodes];
+		unsigned kind = (random >> 8) % 10;
+		// 70 % level 1, 10 % each Shift, Mod3 and Mod4
+		DWORD modifier = kind == 7 ? 42 : kind == 8 ? SCANCODE_CAPSLOCK_KEY : kind == 9 ? SCANCODE_LOWER_THAN_KEY : 0;
+		if (modifier)
+			addTraceEvent(records, count, modifier, false);
+		addTraceEvent(records, count, key, false);
+		addTraceEvent(records, count, key, true);
+		if (modifier)
+			addTraceEvent(records, count, modifier, true);
+	}
+	return records;
+}
+
+int main(int argc, char *argv[]) {
+	char *traceFile = NULL;
+	strcpy(layout, "neo");
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "layout=", 7) == 0)
+			strncpy(layout, argv[i] + 7, sizeof layout - 1);
+		else if (strncmp(argv[i], "layoutFile=", 11) == 0) {
+			layoutImage = mapLayoutImage(argv[i] + 11);
+			if (!layoutImage) {
+				printf("%s is not a compiled layout file\n", argv[i] + 11);
+				return 1;
+			}
+		} else
+			traceFile = argv[i];
+	}
+
+	size_t count;
+	TraceRecord *records = traceFile ? traceLoad(traceFile, &count) : generateTrace(&count);
+	if (!records)
+		return 1;
+	if (count == 0) {
+		printf("%s contains no events\n", traceFile);
+		return 1;
+	}
+
+	initCharacterToScanCodeMap();
+	initLayout();
+	updateKeyScanCache(currentKeyboardLayout());
+	resetKeyQueue();
+	latencySetFrequency(latencyFrequency());
+
+	size_t iterations = (MIN_REPLAYED_EVENTS + count - 1) / count;
+	uint64_t swallowedEvents = 0;
+	uint64_t mismatches = 0;
+
+	uint64_t start = latencyNow();
+	for (size_t iteration = 0; iteration < iterations; iteration++) {
+		for (size_t i = 0; i < count; i++) {
+			KBDLLHOOKSTRUCT keyInfo = {0};
+			keyInfo.vkCode = records[i].vkCode;
+			keyInfo.scanCode = records[i].scanCode;
+			keyInfo.flags = records[i].flags;
+			keyInfo.time = records[i].time;
+			uint64_t eventStart = latencyNow();
+			bool callNext = handleKeyEvent(keyInfo, records[i].message);
+			flushOutput();
+			latencyRecord(PHASE_TOTAL, latencyNow() - eventStart);
+			if (!callNext)
+				swallowedEvents++;
+			if (iteration == 0 && records[i].swallowed != TRACE_UNKNOWN && records[i].swallowed == callNext)
+				mismatches++;
+		}
+	}
+	uint64_t elapsed = latencyNow() - start;
+
+	double seconds = (double)elapsed / latencyFrequency();
+	uint64_t events = (uint64_t)count * iterations;
+	printf("Trace: %s (%lu events, replayed %lu times), layout: %s\n",
+		traceFile ? traceFile : "synthetic", (unsigned long)count, (unsigned long)iterations, layout);
+	printf("Events:      %lu (%lu swallowed, %lu emitted)\n",
+		(unsigned long)events, (unsigned long)swallowedEvents, (unsigned long)outputEvents);
+	printf("Throughput:  %.0f events/s\n", events / seconds);
+	printf("Cost:        %.1f ns/event\n", seconds * 1e9 / events);
+	if (mismatches)
+		printf("Mismatches:  %lu events were handled differently than when they were recorded\n",
+			(unsigned long)mismatches);
+
+	char summary[1024];
+	latencyFormatSummary(summary, sizeof summary);
+	printf("\n%s", summary);
+
+	free(records);
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compose.h"
+
+/**
+ * Compose sequences: dead keys (in the order they are pressed), the characters
+ * following them and the composed characters at the same positions.
+ * Generated from the Unicode decompositions of the precomposed letters with
+ * the accents of the Neo dead keys (both orders for two accents), the stroke
+ * letters of the short solidus overlay added by hand. Space gives the accent.
+ * The sequences of the compose key start with COMPOSE_KEY followed by the
+ * characters typed before the last one (the common ones of Neo's XCompose).
+ * None of them is the beginning of a longer one, it is sent at once.
+ */
+typedef struct ComposeSequences {
+	const TCHAR *deadKeys;
+	const TCHAR *chars;
+	const TCHAR *results;
+} ComposeSequences;
+
+static const ComposeSequences composeSequences[] = {
+	{L"^", L" ACEGHIJOSUWYZaceghijosuwyzẠạẸẹỌ", L"^ÂĈÊĜĤÎĴÔŜÛŴŶẐâĉêĝĥîĵôŝûŵŷẑẬậỆệỘ"}, // circumflex
+	{L"^", L"ọ", L"ộ"},
+	{L"^`", L"AEOaeo", L"ẦỀỒầềồ"}, // circumflex + grave
+	{L"^\u00B4", L"AEOaeo", L"ẤẾỐấếố"}, // circumflex + acute
+	{L"^\u0303", L"AEOaeo", L"ẪỄỖẫễỗ"}, // circumflex + tilde
+	{L"^\u0309", L"AEOaeo", L"ẨỂỔẩểổ"}, // circumflex + hook above
+	{L"^\u0323", L"AEOaeo", L"ẬỆỘậệộ"}, // circumflex + dot below
+	{L"`", L" AEINOUWYaeinouwyÂÊÔÜâêôüĂăĒēŌōΑ", L"`ÀÈÌǸÒÙẀỲàèìǹòùẁỳẦỀỒǛầềồǜẰằḔḕṐṑᾺ"}, // grave
+	{L"`", L"ΕΗΙΟΥΩαεηιουωϊϋЕИеиἀἁἈἉἐἑἘἙἠἡἨἩἰ", L"ῈῊῚῸῪῺὰὲὴὶὸὺὼῒῢЀЍѐѝἂἃἊἋἒἓἚἛἢἣἪἫἲ"},
+	{L"`", L"ἱἸἹὀὁὈὉὐὑὙὠὡὨὩ", L"ἳἺἻὂὃὊὋὒὓὛὢὣὪὫ"},
+	{L"`^", L"AEOaeo", L"ẦỀỒầềồ"}, // grave + circumflex
+	{L"`\u00A8", L"Uuιυ", L"Ǜǜῒῢ"}, // grave + diaeresis
+	{L"`\u0304", L"EOeo", L"ḔṐḕṑ"}, // grave + macron
+	{L"`\u02D8", L"Aa", L"Ằằ"}, // grave + breve
+	{L"`\u1FFE", L"ΑΕΗΙΟΥΩαεηιουω", L"ἋἛἫἻὋὛὫἃἓἣἳὃὓὣ"}, // grave + dasia
+	{L"`\u1FBF", L"ΑΕΗΙΟΩαεηιουω", L"ἊἚἪἺὊὪἂἒἢἲὂὒὢ"}, // grave + psili
+	{L"\u00B4", L" ACEGIKLMNOPRSUWYZacegiklmnoprsu", L"´ÁĆÉǴÍḰĹḾŃÓṔŔŚÚẂÝŹáćéǵíḱĺḿńóṕŕśú"}, // acute
+	{L"\u00B4", L"wyzÂÅÆÇÊÏÔÕØÜâåæçêïôõøüĂăĒēŌōŨũΑ", L"ẃýźẤǺǼḈẾḮỐṌǾǗấǻǽḉếḯốṍǿǘẮắḖḗṒṓṸṹΆ"},
+	{L"\u00B4", L"ΕΗΙΟΥΩαεηιουωϊϋϒГКгкἀἁἈἉἐἑἘἙἠἡἨἩ", L"ΈΉΊΌΎΏάέήίόύώΐΰϓЃЌѓќἄἅἌἍἔἕἜἝἤἥἬἭ"},
+	{L"\u00B4", L"ἰἱἸἹὀὁὈὉὐὑὙὠὡὨὩ", L"ἴἵἼἽὄὅὌὍὔὕὝὤὥὬὭ"},
+	{L"\u00B4^", L"AEOaeo", L"ẤẾỐấếố"}, // acute + circumflex
+	{L"\u00B4\u0327", L"Cc", L"Ḉḉ"}, // acute + cedilla
+	{L"\u00B4\u030A", L"Aa", L"Ǻǻ"}, // acute + ring above
+	{L"\u00B4\u00A8", L"IUiuιυ", L"ḮǗḯǘΐΰ"}, // acute + diaeresis
+	{L"\u00B4\u0307", L"Ss", L"Ṥṥ"}, // acute + dot above
+	{L"\u00B4\u0303", L"OUou", L"ṌṸṍṹ"}, // acute + tilde
+	{L"\u00B4\u0304", L"EOeo", L"ḖṒḗṓ"}, // acute + macron
+	{L"\u00B4\u02D8", L"Aa", L"Ắắ"}, // acute + breve
+	{L"\u00B4\u1FFE", L"ΑΕΗΙΟΥΩαεηιουω", L"ἍἝἭἽὍὝὭἅἕἥἵὅὕὥ"}, // acute + dasia
+	{L"\u00B4\u1FBF", L"ΑΕΗΙΟΩαεηιουω", L"ἌἜἬἼὌὬἄἔἤἴὄὔὤ"}, // acute + psili
+	{L"\u030C", L" ACDEGHIKLNORSTUZacdeghijklnorst", L"ˇǍČĎĚǦȞǏǨĽŇǑŘŠŤǓŽǎčďěǧȟǐǰǩľňǒřšť"}, // caron
+	{L"\u030C", L"uzÜüƷʒ", L"ǔžǙǚǮǯ"},
+	{L"\u030C\u00A8", L"Uu", L"Ǚǚ"}, // caron + diaeresis
+	{L"\u030C\u0307", L"Ss", L"Ṧṧ"}, // caron + dot above
+	{L"\u0327", L" CDEGHKLNRSTcdeghklnrst", L"¸ÇḐȨĢḨĶĻŅŖŞŢçḑȩģḩķļņŗşţ"}, // cedilla
+	{L"\u0327\u00B4", L"Cc", L"Ḉḉ"}, // cedilla + acute
+	{L"\u0327\u02D8", L"Ee", L"Ḝḝ"}, // cedilla + breve
+	{L"\u030A", L" AUauwy", L"˚ÅŮåůẘẙ"}, // ring above
+	{L"\u030A\u00B4", L"Aa", L"Ǻǻ"}, // ring above + acute
+	{L"\u00A8", L" AEHIOUWXYaehiotuwxyÕõŪūΙΥιυϒІАЕ", L"¨ÄËḦÏÖÜẄẌŸäëḧïöẗüẅẍÿṎṏṺṻΪΫϊϋϔЇӒЁ"}, // diaeresis
+	{L"\u00A8", L"ЖЗИОУЧЫЭаежзиоучыэіӘәӨө", L"ӜӞӤӦӰӴӸӬӓёӝӟӥӧӱӵӹӭїӚӛӪӫ"},
+	{L"\u00A8`", L"Uuιυ", L"Ǜǜῒῢ"}, // diaeresis + grave
+	{L"\u00A8\u00B4", L"IUiuιυ", L"ḮǗḯǘΐΰ"}, // diaeresis + acute
+	{L"\u00A8\u030C", L"Uu", L"Ǚǚ"}, // diaeresis + caron
+	{L"\u00A8\u0303", L"Oo", L"Ṏṏ"}, // diaeresis + tilde
+	{L"\u00A8\u0304", L"AOUaou", L"ǞȪǕǟȫǖ"}, // diaeresis + macron
+	{L"\u02DD", L" OUouУу", L"˝ŐŰőűӲӳ"}, // double acute
+	{L"\u0307", L" ABCDEFGHIMNOPRSTWXYZabcdefghmno", L"˙ȦḂĊḊĖḞĠḢİṀṄȮṖṘṠṪẆẊẎŻȧḃċḋėḟġḣṁṅȯ"}, // dot above
+	{L"\u0307", L"prstwxyzŚśŠšſṢṣ", L"ṗṙṡṫẇẋẏżṤṥṦṧẛṨṩ"},
+	{L"\u0307\u00B4", L"Ss", L"Ṥṥ"}, // dot above + acute
+	{L"\u0307\u030C", L"Ss", L"Ṧṧ"}, // dot above + caron
+	{L"\u0307\u0323", L"Ss", L"Ṩṩ"}, // dot above + dot below
+	{L"\u0307\u0304", L"AOao", L"ǠȰǡȱ"}, // dot above + macron
+	{L"\u0303", L" AEINOUVYaeinouvyÂÊÔâêôĂă", L"~ÃẼĨÑÕŨṼỸãẽĩñõũṽỹẪỄỖẫễỗẴẵ"}, // tilde
+	{L"\u0303^", L"AEOaeo", L"ẪỄỖẫễỗ"}, // tilde + circumflex
+	{L"\u0303\u00B4", L"OUou", L"ṌṸṍṹ"}, // tilde + acute
+	{L"\u0303\u00A8", L"Oo", L"Ṏṏ"}, // tilde + diaeresis
+	{L"\u0303\u0304", L"Oo", L"Ȭȭ"}, // tilde + macron
+	{L"\u0303\u02D8", L"Aa", L"Ẵẵ"}, // tilde + breve
+	{L"\u0337", L" DGHILOTZbdghilotz", L"/ĐǤĦƗŁØŦƵƀđǥħɨłøŧƶ"}, // short solidus overlay
+	{L"\u0309", L"AEIOUYaeiouyÂÊÔâêôĂă", L"ẢẺỈỎỦỶảẻỉỏủỷẨỂỔẩểổẲẳ"}, // hook above
+	{L"\u0309^", L"AEOaeo", L"ẨỂỔẩểổ"}, // hook above + circumflex
+	{L"\u0309\u02D8", L"Aa", L"Ẳẳ"}, // hook above + breve
+	{L"\u0323", L"ABDEHIKLMNORSTUVWYZabdehiklmnors", L"ẠḄḌẸḤỊḲḶṂṆỌṚṢṬỤṾẈỴẒạḅḍẹḥịḳḷṃṇọṛṣ"}, // dot below
+	{L"\u0323", L"tuvwyz", L"ṭụṿẉỵẓ"},
+	{L"\u0323^", L"AEOaeo", L"ẬỆỘậệộ"}, // dot below + circumflex
+	{L"\u0323\u0307", L"Ss", L"Ṩṩ"}, // dot below + dot above
+	{L"\u0323\u0304", L"LRlr", L"ḸṜḹṝ"}, // dot below + macron
+	{L"\u0323\u02D8", L"Aa", L"Ặặ"}, // dot below + breve
+	{L"\u0304", L" AEGIOUYaegiouyÄÆÕÖÜäæõöüȦȧȮȯΑΙΥ", L"¯ĀĒḠĪŌŪȲāēḡīōūȳǞǢȬȪǕǟǣȭȫǖǠǡȰȱᾹῙῩ"}, // macron
+	{L"\u0304", L"αιυИУиуḶḷṚṛ", L"ᾱῑῡӢӮӣӯḸḹṜṝ"},
+	{L"\u0304`", L"EOeo", L"ḔṐḕṑ"}, // macron + grave
+	{L"\u0304\u00B4", L"EOeo", L"ḖṒḗṓ"}, // macron + acute
+	{L"\u0304\u00A8", L"AOUaou", L"ǞȪǕǟȫǖ"}, // macron + diaeresis
+	{L"\u0304\u0307", L"AOao", L"ǠȰǡȱ"}, // macron + dot above
+	{L"\u0304\u0303", L"Oo", L"Ȭȭ"}, // macron + tilde
+	{L"\u0304\u0323", L"LRlr", L"ḸṜḹṝ"}, // macron + dot below
+	{L"\u02D8", L" AEGIOUaegiouȨȩΑΙΥαιυАЕЖИУаежиуẠ", L"˘ĂĔĞĬŎŬăĕğĭŏŭḜḝᾸῘῨᾰῐῠӐӖӁЙЎӑӗӂйўẶ"}, // breve
+	{L"\u02D8", L"ạ", L"ặ"},
+	{L"\u02D8`", L"Aa", L"Ằằ"}, // breve + grave
+	{L"\u02D8\u00B4", L"Aa", L"Ắắ"}, // breve + acute
+	{L"\u02D8\u0327", L"Ee", L"Ḝḝ"}, // breve + cedilla
+	{L"\u02D8\u0303", L"Aa", L"Ẵẵ"}, // breve + tilde
+	{L"\u02D8\u0309", L"Aa", L"Ẳẳ"}, // breve + hook above
+	{L"\u02D8\u0323", L"Aa", L"Ặặ"}, // breve + dot below
+	{L"\u1FFE", L" ΑΕΗΙΟΡΥΩαεηιορυω", L"῾ἉἙἩἹὉῬὙὩἁἑἡἱὁῥὑὡ"}, // dasia
+	{L"\u1FFE`", L"ΑΕΗΙΟΥΩαεηιουω", L"ἋἛἫἻὋὛὫἃἓἣἳὃὓὣ"}, // dasia + grave
+	{L"\u1FFE\u00B4", L"ΑΕΗΙΟΥΩαεηιουω", L"ἍἝἭἽὍὝὭἅἕἥἵὅὕὥ"}, // dasia + acute
+	{L"\u1FBF", L" ΑΕΗΙΟΩαεηιορυω", L"᾿ἈἘἨἸὈὨἀἐἠἰὀῤὐὠ"}, // psili
+	{L"\u1FBF`", L"ΑΕΗΙΟΩαεηιουω", L"ἊἚἪἺὊὪἂἒἢἲὂὒὢ"}, // psili + grave
+	{L"\u1FBF\u00B4", L"ΑΕΗΙΟΩαεηιουω", L"ἌἜἬἼὌὬἄἔἤἴὄὔὤ"}, // psili + acute
+	{L"\u266B" L"o", L"ceor", L"©œ°®"}, // compose key
+	{L"\u266B" L"O", L"CER", L"©Œ®"},
+	{L"\u266B" L"a", L"e", L"æ"},
+	{L"\u266B" L"A", L"E", L"Æ"},
+	{L"\u266B" L"s", L"s", L"ß"},
+	{L"\u266B" L"S", L"S", L"ẞ"},
+	{L"\u266B" L"t", L"m", L"™"},
+	{L"\u266B" L"T", L"M", L"™"},
+	{L"\u266B" L"x", L"x", L"×"},
+	{L"\u266B" L"e", L"=", L"€"},
+	{L"\u266B" L"c", L"/", L"¢"},
+	{L"\u266B" L"L", L"-", L"£"},
+	{L"\u266B" L"Y", L"=", L"¥"},
+	{L"\u266B" L"1", L"2348", L"½⅓¼⅛"},
+	{L"\u266B" L"2", L"3", L"⅔"},
+	{L"\u266B" L"3", L"48", L"¾⅜"},
+	{L"\u266B" L"^", L"123+-", L"¹²³⁺⁻"},
+	{L"\u266B" L"_", L"123+-", L"₁₂₃₊₋"},
+	{L"\u266B" L"-", L">:", L"→÷"},
+	{L"\u266B" L"--", L"-.", L"—–"},
+	{L"\u266B" L"<", L"-=<", L"←≤«"},
+	{L"\u266B" L">", L"=>", L"≥»"},
+	{L"\u266B" L"=", L">", L"⇒"},
+	{L"\u266B" L"/", L"=", L"≠"},
+	{L"\u266B" L"+", L"-", L"±"},
+	{L"\u266B" L".", L".", L"…"},
+	{L"\u266B" L"?", L"?", L"¿"},
+	{L"\u266B" L"!", L"!", L"¡"},
+	{0}
+};
+
+bool isComposeDeadKey(TCHAR deadKey) {
+	for (const ComposeSequences *s = composeSequences; s->deadKeys; s++) {
+		if (s->deadKeys[0] == deadKey)
+			return true;
+	}
+	return false;
+}
+
+typedef struct ComposeEntry {
+	TCHAR keys[COMPOSE_MAX_LENGTH + 1]; // zero terminated
+	TCHAR result;
+} ComposeEntry;
+
+static int compareComposeEntries(const void *a, const void *b) {
+	const TCHAR *keysA = ((const ComposeEntry *)a)->keys;
+	const TCHAR *keysB = ((const ComposeEntry *)b)->keys;
+	for (int i = 0; i <= COMPOSE_MAX_LENGTH; i++) {
+		if (keysA[i] != keysB[i])
+			return keysA[i] < keysB[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+/**
+ * Adds `node` for the sorted entries [first, last), which share their first `depth` keys.
+ * returns `false` if the trie is full or a sequence is longer than COMPOSE_MAX_LENGTH
+ **/
+static bool addComposeNode(ComposeTrie *trie, unsigned node, const ComposeEntry *first, const ComposeEntry *last, int depth) {
+	// composeSequence in the core holds the dead keys of one path
+	if (depth >= COMPOSE_MAX_LENGTH)
+		return false;
+	// one edge for each distinct key at this depth, allocated in one piece
+	unsigned edgeCount = 0;
+	for (const ComposeEntry *e = first; e < last; e++) {
+		if (e == first || e->keys[depth] != e[-1].keys[depth])
+			edgeCount++;
+	}
+	if (trie->edgeCount + edgeCount > COMPOSE_MAX_EDGES)
+		return false;
+	trie->nodes[node].firstEdge = trie->edgeCount;
+	trie->nodes[node].edgeCount = edgeCount;
+	unsigned edge = trie->edgeCount;
+	trie->edgeCount += edgeCount;
+
+	for (const ComposeEntry *e = first; e < last; edge++) {
+		const ComposeEntry *end = e;
+		while (end < last && end->keys[depth] == e->keys[depth])
+			end++;
+		trie->edgeChar[edge] = e->keys[depth];
+		trie->edgeResult[edge] = 0;
+		trie->edgeNode[edge] = 0;
+		// the sequence ending here sorts before the longer ones (terminating zero)
+		if (e->keys[depth + 1] == 0) {
+			trie->edgeResult[edge] = e->result;
+			e++;
+		}
+		if (e < end) {
+			if (trie->nodeCount >= COMPOSE_MAX_NODES)
+				return false;
+			unsigned child = trie->nodeCount++;
+			trie->edgeNode[edge] = child;
+			if (!addComposeNode(trie, child, e, end, depth + 1))
+				return false;
+		}
+		e = end;
+	}
+	return true;
+}
+
+void buildComposeTrie(ComposeTrie *trie, const TCHAR *deadKeys) {
+	static ComposeEntry entries[COMPOSE_MAX_EDGES]; // reloadConfig() is not called by two threads at the same time
+	int entryCount = 0;
+
+	for (const ComposeSequences *s = composeSequences; s->deadKeys; s++) {
+		int length = wcslen(s->deadKeys);
+		bool available = length < COMPOSE_MAX_LENGTH;
+		// after the compose key, the keys are characters
+		int deadKeyCount = s->deadKeys[0] == COMPOSE_KEY ? 1 : length;
+		for (int i = 0; i < deadKeyCount; i++) {
+			if (!wcschr(deadKeys, s->deadKeys[i]))
+				available = false;
+		}
+		for (int i = 0; available && s->chars[i] && entryCount < COMPOSE_MAX_EDGES; i++) {
+			ComposeEntry *entry = &entries[entryCount++];
+			memset(entry->keys, 0, sizeof entry->keys);
+			memcpy(entry->keys, s->deadKeys, length * sizeof(TCHAR));
+			entry->keys[length] = s->chars[i];
+			entry->result = s->results[i];
+		}
+	}
+	qsort(entries, entryCount, sizeof entries[0], compareComposeEntries);
+
+	// a sequence defined twice is added once
+	int unique = 0;
+	for (int i = 0; i < entryCount; i++) {
+		if (unique == 0 || compareComposeEntries(&entries[i], &entries[unique - 1]) != 0)
+			entries[unique++] = entries[i];
+	}
+
+	memset(trie, 0, sizeof *trie);
+	trie->nodeCount = 1;
+	if (!addComposeNode(trie, 0, entries, entries + unique, 0)) {
+		printf("\nToo many compose sequences, dead keys are disabled.\n");
+		memset(trie, 0, sizeof *trie);
+		trie->nodeCount = 1;
+	}
+}
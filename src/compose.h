@@ -0,0 +1,83 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COMPOSE_H
+#define _COMPOSE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "keydefs.h"
+
+/**
+ * Dead keys: a dead key pressed before a character composes the precomposed
+ * character (´ e → é), up to two dead keys may be combined (^ ´ e → ế) and
+ * a dead key followed by space gives the accent itself. The compose key
+ * (♫, Mod3+Tab of Neo) is a dead key whose sequences go on with ordinary
+ * characters (♫ o c → ©, ♫ - - - → —), up to COMPOSE_MAX_LENGTH keys.
+ *
+ * The sequences of the built-in table are stored in a trie which is built by
+ * buildComposeTrie() when the layout is loaded. The edges of a node are
+ * consecutive and sorted by character, so a step is a binary search in a few
+ * adjacent bytes. Node 0 is the root.
+ */
+#define COMPOSE_MAX_NODES 192
+#define COMPOSE_MAX_EDGES 1408
+#define COMPOSE_MAX_LENGTH 8 // keys of the longest sequence, the trie is not deeper
+#define COMPOSE_KEY L'\u266B' // ♫
+
+typedef struct ComposeNode {
+	uint16_t firstEdge;
+	uint16_t edgeCount;
+} ComposeNode;
+
+typedef struct ComposeTrie {
+	ComposeNode nodes[COMPOSE_MAX_NODES];
+	TCHAR edgeChar[COMPOSE_MAX_EDGES];     // sorted within a node
+	TCHAR edgeResult[COMPOSE_MAX_EDGES];   // composed character, 0 if the sequence is not complete
+	uint16_t edgeNode[COMPOSE_MAX_EDGES];  // node of the longer sequences, 0 if there are none
+	unsigned nodeCount;
+	unsigned edgeCount;
+} ComposeTrie;
+
+/**
+ * returns `true` if the table has sequences starting with this dead key
+ **/
+bool isComposeDeadKey(TCHAR deadKey);
+
+/**
+ * Builds the trie of all sequences whose dead keys are contained in `deadKeys`
+ * (zero terminated, the dead keys of the layout)
+ **/
+void buildComposeTrie(ComposeTrie *trie, const TCHAR *deadKeys);
+
+/**
+ * returns the edge for `c` from `node` or -1
+ **/
+static inline int composeStep(const ComposeTrie *trie, unsigned node, TCHAR c) {
+	int low = trie->nodes[node].firstEdge;
+	int high = low + trie->nodes[node].edgeCount - 1;
+	while (low <= high) {
+		int middle = (low + high) / 2;
+		if (trie->edgeChar[middle] < c)
+			low = middle + 1;
+		else if (trie->edgeChar[middle] > c)
+			high = middle - 1;
+		else
+			return middle;
+	}
+	return -1;
+}
+
+#endif
@@ -0,0 +1,2354 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include "core.h"
+#include "log.h"
+#include "latency.h"
+#include "keystats.h"
+#include "layouts.h"
+#include "layoutfile.h"
+#include "compose.h"
+
+/**
+ * Some global settings.
+ * These values can be set in a configuration file (settings.ini)
+ */
+char layout[100];                    // keyboard layout by name (default: neo)
+TCHAR customLayoutWcs[33];           // custom keyboard layout in UTF-16 (32 symbols)
+const LayoutImage *layoutImage = NULL; // compiled layout file (see layoutFile), applied on top of the layout
+bool quoteAsMod3R = false;           // use quote/ä as right level 3 modifier
+bool returnAsMod3R = false;          // use return as right level 3 modifier
+bool tabAsMod4L = false;             // use tab as left level 4 modifier
+DWORD scanCodeMod3L = SCANCODE_CAPSLOCK_KEY;
+DWORD scanCodeMod3R = SCANCODE_HASH_KEY;       // replaced in buildConfig() if quoteAsMod3R or returnAsMod3R
+DWORD scanCodeMod4L = SCANCODE_LOWER_THAN_KEY; // replaced in buildConfig() if tabAsMod4L
+// DWORD scanCodeMod4R = SCANCODE_ANY_ALT_KEY;
+bool capsLockEnabled = false;        // enable (allow) caps lock
+bool shiftLockEnabled = false;       // enable (allow) shift lock (disabled if capsLockEnabled is true)
+bool level4LockEnabled = false;      // enable (allow) level 4 lock (toggle by pressing both Mod4 keys at the same time)
+bool qwertzForShortcuts = false;     // use QWERTZ when Ctrl, Alt or Win is involved
+bool swapLeftCtrlAndLeftAlt = false; // swap left Ctrl and left Alt key
+bool swapLeftCtrlLeftAltAndLeftWin = false;  // swap left Ctrl, left Alt key and left Win key. Resulting order: Win, Alt, Ctrl (on a standard Windows keyboard)
+bool supportLevels5and6 = false;     // support levels five and six (greek letters and mathematical symbols)
+bool capsLockAsEscape = false;       // if true, hitting CapsLock alone sends Esc
+bool mod3RAsReturn = false;          // if true, hitting Mod3R alone sends Return
+bool mod4LAsTab = false;             // if true, hitting Mod4L alone sends Tab
+bool remapInjected = false;          // remap key events injected by other programs (e.g. AutoHotkey, remote desktop) instead of passing them on
+
+/**
+ * True if no mapping should be done
+ */
+bool bypassMode = false;
+
+/**
+ * States of the modifier keys and locks (STATE_*, see core.h).
+ */
+unsigned modState = 0;
+
+int mapCharacterToScanCode[256] = {0};
+
+/**
+ * Mapping table: one row for each of the six levels and two rows with
+ * levels one and two for active caps lock (upper and lower case letters
+ * swapped). The rows (except the caps lock rows) will be defined in buildConfig().
+ */
+#define MAPPING_ROWS 8
+#define ROW_CAPS_LEVEL1 6
+#define ROW_CAPS_LEVEL2 7
+
+/**
+ * Keys which are not sent as a plain character of the mapping table (dead keys
+ * and the navigation keys of level 4), built from the layout descriptor and the
+ * layout file in initSpecialKeys(). Type SPECIAL_NONE means "no special key".
+ */
+typedef struct SpecialKey {
+	uint8_t type;      // enum specialKeyType
+	uint8_t scanCode;  // scan code to send with a virtual key
+	uint32_t value;    // character (code point, SPECIAL_UNICODE beyond the BMP), virtual key code or macro
+} SpecialKey;
+
+/**
+ * Cache for the VkKeyScanEx results of all characters the mapping tables
+ * can emit. It is filled for the active keyboard layout and rebuilt when
+ * the input language (and thus the keyboard layout) changes.
+ * Open addressing with linear probing, character 0 marks an empty slot.
+ */
+#define KEY_SCAN_CACHE_SIZE 1024 // power of two, several times the number of mapped characters
+typedef struct KeyScanCacheEntry {
+	TCHAR character;
+	SHORT keyScanResult;
+} KeyScanCacheEntry;
+
+/**
+ * Combo index: the keys of all combos are numbered (comboKeyId, 1-based) so
+ * a set of keys is a bitmask. All key sets of combos and their subsets are in
+ * a hash table, one lookup tells if held keys are a combo or part of a longer
+ * one, no matter how many combos are defined.
+ */
+#define COMBO_MAX_KEY_IDS 64
+#define COMBO_HASH_BITS 12
+#define COMBO_HASH_SIZE (1 << COMBO_HASH_BITS) // power of two, more than (2^COMBO_MAX_KEYS - 1) * COMBO_LEN
+#define COMBO_ARENA_LEN (PROFILE_COUNT * COMBO_LEN)         // combos of all profiles, each may use COMBO_LEN
+#define COMBO_ARENA_SIZE (PROFILE_COUNT * COMBO_HASH_SIZE)  // hash table entries of all profiles
+typedef struct ComboEntry {
+	uint64_t keys;     // 0 marks an empty slot
+	uint16_t term;     // longest term of the combos with these keys
+	int16_t combo;     // index of the combo with exactly these keys, -1 if none
+	bool partial;      // the keys are part of a longer combo
+} ComboEntry;
+
+/**
+ * Macros: strings of the layout file (SPECIAL_MACRO) sent as a whole. Their
+ * key events are built once by buildConfig() into macroOutputs, the value of
+ * the special key is the index in macros. A macro key only copies its events
+ * to the output buffer, they fit into it, so they are sent with one SendInput.
+ */
+#define MACRO_LEN 256
+#define MACRO_OUTPUTS_SIZE 8192 // of one profile
+#define MACRO_ARENA_SIZE (PROFILE_COUNT * MACRO_OUTPUTS_SIZE) // of all profiles, each may use MACRO_OUTPUTS_SIZE
+#define MACRO_MAX_OUTPUTS OUTPUT_BUFFER_SIZE
+typedef struct Macro {
+	uint16_t firstOutput;  // index in macroOutputs
+	uint16_t outputCount;
+} Macro;
+
+/**
+ * Configuration snapshot: the settings needed while handling key events and
+ * all lookup tables, built from the settings by buildConfig().
+ * The hook thread only uses the active snapshot `config`. reloadConfig()
+ * builds the other one of the two buffers on the calling thread and the hook
+ * thread switches to it with a pointer swap between two key events.
+ */
+typedef struct Config {
+	TCHAR mappingTable[MAPPING_ROWS][LEN] __attribute__((aligned(64)));
+	// level and row of mappingTable for the lowest LEVEL_BITS bits of modState,
+	// so getting the level or the character of a key needs no branches
+	uint8_t levelTable[1 << LEVEL_BITS];
+	uint8_t mappingRowTable[1 << LEVEL_BITS];
+	SpecialKey specialKeys[6][LEN];
+	TCHAR deadKeys[6][LEN];            // dead key character for compose, 0 for other keys
+	ComposeTrie compose;
+	TCHAR mappingTapNextRelease[LEN];
+	uint16_t mappingTapTerm[LEN];      // ms, 0 if not decided by time
+	uint8_t mappingTapStrategy[LEN];   // MT_TAP_NEXT_RELEASE etc.
+	TCHAR numpadSlashKey[7];
+	uint8_t comboKeyId[LEN];
+	// combos and macro events are in the arenas of the ConfigSet, as many as the profile uses
+	ComboEntry *comboEntries;          // hash table of 2^comboHashBits entries
+	unsigned comboHashBits;
+	Combo *combos;
+	unsigned comboCount;
+	Macro macros[MACRO_LEN];
+	KeyOutput *macroOutputs;
+	unsigned macroOutputCount;
+
+	DWORD scanCodeMod3L;
+	DWORD scanCodeMod3R;
+	DWORD scanCodeMod4L;
+	bool capsLockEnabled;
+	bool shiftLockEnabled;
+	bool level4LockEnabled;
+	bool qwertzForShortcuts;
+	bool swapLeftCtrlAndLeftAlt;
+	bool swapLeftCtrlLeftAltAndLeftWin;
+	bool capsLockAsEscape;
+	bool mod3RAsReturn;
+	bool mod4LAsTab;
+	bool remapInjected;
+
+	// filled by buildConfig() and by the hook thread for characters not in the tables
+	KeyScanCacheEntry keyScanCache[KEY_SCAN_CACHE_SIZE];
+	void *keyScanCacheLayout;
+	// shortcut layer (see buildShortcutLayer()), rebuilt with the cache, per extended flag and scan code
+	uint8_t shortcutVk[2][LEN];
+} Config;
+
+/**
+ * The configurations of all profiles, built together by reloadConfig(). Only
+ * the pages of the profiles in use are ever touched. The profiles take their
+ * combos and macro events one after the other from the arenas of the set,
+ * which have room for every profile at its limit, so only the used part of
+ * them is touched as well.
+ */
+typedef struct ConfigSet {
+	Config profiles[PROFILE_COUNT];
+	int profileCount;
+	Combo combos[COMBO_ARENA_LEN];
+	ComboEntry comboEntries[COMBO_ARENA_SIZE];
+	KeyOutput macroOutputs[MACRO_ARENA_SIZE];
+	unsigned combosUsed, comboEntriesUsed, macroOutputsUsed; // while building
+} ConfigSet;
+
+ConfigSet configSets[2];
+ConfigSet *configSet = &configSets[0];          // active set (hook thread only)
+Config *config = &configSets[0].profiles[0];    // active configuration (hook thread only)
+ConfigSet *newConfigSet = NULL;                 // built by reloadConfig() and not taken by the hook thread yet (atomic)
+ConfigSet *lastBuiltConfigSet = &configSets[0]; // reloadConfig() only
+int selectedProfile = 0;                        // selectProfile() (hook thread only)
+int configProfile = 0;                          // selected profile when `config` was taken (hook thread only)
+unsigned configChanges = 0;                     // counts the switches of `config` (hook thread only)
+void *hookKeyboardLayout = NULL;        // keyboard layout of the key scan cache of the hook thread (atomic)
+
+/**
+ * When a key with TapNextRelease function is pressed, the key to emit depends
+ * on the order this and succesive keys are being released. Thus all keys
+ * are stored in the keyQueue in the first place.
+ * keyQueue is a ring buffer: positions count up forever, the slot of a
+ * position is QUEUE_SLOT(position). Released keys leave holes (status 0)
+ * until the beginning or the end of the queue passes them.
+ */
+#define QUEUE_SIZE 64 // must be a power of two
+#define QUEUE_SLOT(position) ((position) & (QUEUE_SIZE - 1))
+KBDLLHOOKSTRUCT keyQueue[QUEUE_SIZE];
+int keyQueueLength;        // number of entries with status > 0
+unsigned keyQueueFirst;    // position of the first entry
+unsigned keyQueueEnd;      // position after the last entry
+uint8_t keyQueueStatus[QUEUE_SIZE]; // 0=empty/handled, 1=regular key pressed, 2=TapNextRelease key not activated, 3=TapNextRelease key activated,
+                                    // 4=released, but a key pressed earlier is not decided yet (tapped later)
+
+/**
+ * Index of a physical key: keys such as left Alt and AltGr or left and right
+ * Ctrl have the same scan code and differ in the extended flag only.
+ */
+#define KEY_INDEX_EXTENDED 1024 // all scan codes including the Ctrl part of AltGr (541)
+#define KEY_INDEX_SIZE (2 * KEY_INDEX_EXTENDED)
+static inline unsigned keyIndex(KBDLLHOOKSTRUCT keyInfo) {
+	if (keyInfo.scanCode >= KEY_INDEX_EXTENDED)
+		return KEY_INDEX_SIZE;
+	return keyInfo.scanCode + (keyInfo.flags & LLKHF_EXTENDED ? KEY_INDEX_EXTENDED : 0);
+}
+
+/**
+ * Queue position of each key (see keyIndex()), so a released key is found
+ * without searching the queue. Only valid if that position is still in the
+ * queue, not handled and holds the same key.
+ */
+unsigned keyQueueIndex[KEY_INDEX_SIZE];
+
+/**
+ * Positions of the TapNextRelease keys that are not activated yet (status 2)
+ * in queue order. They are activated or tapped oldest first, so this is a
+ * FIFO, too (never longer than the queue).
+ */
+unsigned pendingTapNextRelease[QUEUE_SIZE];
+unsigned pendingTapNextReleaseFirst;
+unsigned pendingTapNextReleaseEnd;
+/**
+ * A held key sends the same key down again and again (autorepeat). The output
+ * of the last key down is kept, so a repeat with the same modifier state and
+ * configuration only copies it to the output buffer. Any key up, queued key or
+ * change of the configuration or keyboard layout drops it.
+ */
+#define REPEAT_OUTPUT_SIZE 16
+typedef struct RepeatCache {
+	bool valid;
+	DWORD scanCode;
+	DWORD vkCode;
+	DWORD flags;
+	unsigned modState;
+	unsigned injectedModifiers;
+	bool callNext;
+	int outputCount;
+	KeyOutput outputs[REPEAT_OUTPUT_SIZE];
+} RepeatCache;
+RepeatCache repeatCache;
+
+/**
+ * Level and system key bits of `modState` at the last key down of each key (see keyIndex()),
+ * its key up is mapped with them, so a modifier released or pressed in between
+ * cannot send another key up than the key down (a stuck key in the system).
+ * This includes the Ctrl part of AltGr, which is swallowed only together with its key down.
+ */
+#define KEY_DOWN_STATE_BITS (LEVEL_MASK | STATE_SYSTEM_KEYS)
+#define KEY_DOWN_RECORDED (1u << 31)
+unsigned keyDownState[KEY_INDEX_SIZE];
+
+/**
+ * Dead keys pressed and not composed yet (see compose.h), composeNode is their
+ * node in the compose trie of `config`. The composed character is sent on key
+ * down, so the key up of the key and of the dead keys is swallowed.
+ */
+TCHAR composeSequence[COMPOSE_MAX_LENGTH];
+int composeLength = 0;
+unsigned composeNode = 0;
+DWORD composedScanCode = 0;  // key which gave the last composed character, 0 if none
+DWORD deadKeyScanCode = 0;   // last dead key, until its key up (autorepeat is ignored)
+DWORD macroScanCode = 0;     // last macro key, until its key up (autorepeat is ignored)
+
+static inline void resetCompose() {
+	composeLength = 0;
+	composeNode = 0;
+}
+
+char *MT_MODIFIER_STRING[7] = {"", "CTRL", "SHIFT", "MOD3", "MOD4", "ALT", "WIN"};
+
+ModTap modTap[MOD_TAP_LEN];
+int modTapKeyCount = 0;  // how many ModTap keys are defined
+Combo combos[COMBO_LEN];
+
+/**
+ * Combo keys pressed and held back until it is clear whether they are a combo
+ * (in order, comboKeyMask has their bits), the keys of the last combo sent and
+ * the keys sent as themselves, as long as they are held.
+ */
+KBDLLHOOKSTRUCT comboKeys[COMBO_MAX_KEYS];
+int comboKeyCount = 0;
+uint64_t comboKeyMask = 0;
+uint64_t activeComboMask = 0;
+uint64_t passedComboKeys = 0;
+int activeComboModifier = MT_NONE;
+bool comboSent = false; // output for held back keys was written while handling the current event
+
+void fillKeyScanCache(Config *c, void *keyboardLayout);
+bool handleSystemKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
+void handleShiftKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
+void handleMod3Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
+void handleMod4Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
+bool updateStatesAndWriteKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
+bool writeKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
+bool writeKeyUpWithState(KBDLLHOOKSTRUCT keyInfo, unsigned recorded);
+bool writeMappedKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp, unsigned level);
+bool handleMappedKeyEvent(KBDLLHOOKSTRUCT keyInfo, WPARAM wparam);
+int handleShortcutKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
+void handleComboTimeout(DWORD now);
+bool nextComboDeadline(DWORD *time);
+
+
+/**
+ * Debug logging: these functions only write binary records into the log
+ * buffer (see log.h). Formatting and console output happen in the logger thread.
+ */
+uint8_t lockStatesForLog() {
+	return (modState & STATE_SHIFT_LOCK ? LOG_SHIFT_LOCK : 0)
+	     | (modState & STATE_CAPS_LOCK ? LOG_CAPS_LOCK : 0)
+	     | (modState & STATE_LEVEL4_LOCK ? LOG_LEVEL4_LOCK : 0);
+}
+
+static inline void logMessage(const char *format, const char *arg) {
+	if (!logEnabled) return;
+	LogRecord *record = logReserve();
+	if (!record) return;
+	record->type = LOG_MESSAGE;
+	record->color = FG_WHITE;
+	record->text = format;
+	record->arg = arg;
+	logCommit();
+}
+
+static inline void logKeyRecord(enum logRecordType type, const char *desc, KBDLLHOOKSTRUCT keyInfo, int color,
+		int value0, int value1, int value2) {
+	if (!logEnabled) return;
+	LogRecord *record = logReserve();
+	if (!record) return;
+	record->type = type;
+	record->color = color < 0 ? FG_WHITE : color;
+	record->locks = lockStatesForLog();
+	record->text = desc;
+	record->key.scanCode = keyInfo.scanCode;
+	record->key.vkCode = keyInfo.vkCode;
+	record->key.flags = keyInfo.flags;
+	record->key.extraInfo = keyInfo.dwExtraInfo;
+	record->values[0] = value0;
+	record->values[1] = value1;
+	record->values[2] = value2;
+	logCommit();
+}
+
+static inline void logKeyEvent(char *desc, KBDLLHOOKSTRUCT keyInfo, int color) {
+	logKeyRecord(LOG_KEY_EVENT, desc, keyInfo, color, 0, 0, 0);
+}
+
+static inline void logLevel(unsigned level) {
+	if (!logEnabled) return;
+	LogRecord *record = logReserve();
+	if (!record) return;
+	record->type = LOG_LEVEL;
+	record->color = FG_WHITE;
+	record->values[0] = level;
+	logCommit();
+}
+
+static inline void logQueueStatus() {
+	if (!logEnabled) return;
+	LogRecord *record = logReserve();
+	if (!record) return;
+	record->type = LOG_QUEUE_STATUS;
+	record->color = FG_WHITE;
+	record->itemCount = 0;
+	for (unsigned i = keyQueueFirst; i != keyQueueEnd && record->itemCount < LOG_ITEMS_LEN; i++)
+		record->items[record->itemCount++] = keyQueueStatus[QUEUE_SLOT(i)];
+	logCommit();
+}
+
+static inline void logQueueCleanup(const char *format, int value0, int value1) {
+	if (!logEnabled) return;
+	LogRecord *record = logReserve();
+	if (!record) return;
+	record->type = LOG_QUEUE_CLEANUP;
+	record->color = FG_GRAY;
+	record->text = format;
+	record->values[0] = value0;
+	record->values[1] = value1;
+	logCommit();
+}
+
+void resetKeyQueue() {
+	keyQueueLength = 0;
+	keyQueueFirst = keyQueueEnd;
+	pendingTapNextReleaseFirst = pendingTapNextReleaseEnd;
+	memset(keyQueueStatus, 0, sizeof keyQueueStatus);
+}
+
+/**
+ * Removes all holes from the queue. Only needed if the queue is full.
+ **/
+void cleanupKeyQueue() {
+	logQueueStatus();
+
+	unsigned target = keyQueueFirst;
+	pendingTapNextReleaseFirst = pendingTapNextReleaseEnd; // rebuilt in the same order
+	for (unsigned i = keyQueueFirst; i != keyQueueEnd; i++) {
+		uint8_t status = keyQueueStatus[QUEUE_SLOT(i)];
+		if (!status)
+			continue;
+		if (i != target) {
+			keyQueue[QUEUE_SLOT(target)] = keyQueue[QUEUE_SLOT(i)];
+			keyQueueStatus[QUEUE_SLOT(target)] = status;
+			keyQueueStatus[QUEUE_SLOT(i)] = 0;
+		}
+		if (keyIndex(keyQueue[QUEUE_SLOT(target)]) < KEY_INDEX_SIZE)
+			keyQueueIndex[keyIndex(keyQueue[QUEUE_SLOT(target)])] = target;
+		if (status == 2)
+			pendingTapNextRelease[QUEUE_SLOT(pendingTapNextReleaseEnd++)] = target;
+		target++;
+	}
+	logQueueCleanup("cleanupKeyQueue: Removed %i handled entries, %i entries left\n", keyQueueEnd - target, target - keyQueueFirst);
+	keyQueueEnd = target;
+}
+
+/**
+ * Finds the (not handled) entry of a key in the queue.
+ * returns `false` if the key is not in the queue
+ **/
+bool findInQueue(KBDLLHOOKSTRUCT keyInfo, unsigned *position) {
+	unsigned index = keyIndex(keyInfo);
+	if (index >= KEY_INDEX_SIZE) {
+		// not indexed, search the queue
+		for (unsigned i = keyQueueFirst; i != keyQueueEnd; i++) {
+			if (keyQueueStatus[QUEUE_SLOT(i)] > 0 && keyQueueStatus[QUEUE_SLOT(i)] != 4
+					&& keyQueue[QUEUE_SLOT(i)].scanCode == keyInfo.scanCode
+					&& ((keyQueue[QUEUE_SLOT(i)].flags ^ keyInfo.flags) & LLKHF_EXTENDED) == 0) {
+				*position = i;
+				return true;
+			}
+		}
+		return false;
+	}
+	unsigned i = keyQueueIndex[index];
+	if (i - keyQueueFirst >= keyQueueEnd - keyQueueFirst
+		|| keyQueueStatus[QUEUE_SLOT(i)] == 0
+		|| keyQueueStatus[QUEUE_SLOT(i)] == 4
+		|| keyIndex(keyQueue[QUEUE_SLOT(i)]) != index)
+		return false;
+	*position = i;
+	return true;
+}
+
+void handleTapNextReleaseKey(int keyCode, bool isKeyUp) {
+	KBDLLHOOKSTRUCT tapNextReleaseKey = {0};
+	switch(keyCode) {
+		case MT_CTRL:
+			// simulate ctrl key pressed or released
+			tapNextReleaseKey.vkCode = VK_LCONTROL;
+			tapNextReleaseKey.scanCode = 29;
+			tapNextReleaseKey.flags = 0;
+			handleSystemKey(tapNextReleaseKey, isKeyUp);
+			break;
+		case MT_SHIFT:
+			// simulate shift key pressed or released
+			tapNextReleaseKey.vkCode = VK_SHIFT;
+			handleShiftKey(tapNextReleaseKey, isKeyUp);
+			break;
+		case MT_MOD3:
+			// simulate mod3Key pressed or released
+			tapNextReleaseKey.scanCode = config->scanCodeMod3L;
+			handleMod3Key(tapNextReleaseKey, isKeyUp);
+			handleMod3Key(tapNextReleaseKey, isKeyUp);
+			break;
+		case MT_MOD4:
+			// simulate mod4Key pressed or released
+			tapNextReleaseKey.scanCode = config->scanCodeMod4L;
+			handleMod4Key(tapNextReleaseKey, isKeyUp);
+			break;
+		case MT_ALT:
+			// simulate alt key pressed or released
+			tapNextReleaseKey.vkCode = VK_LMENU;
+			/* tapNextReleaseKey.scanCode = 29; */
+			tapNextReleaseKey.flags = 0;
+			handleSystemKey(tapNextReleaseKey, isKeyUp);
+			break;
+		case MT_WIN:
+			// simulate windows key pressed or released
+			tapNextReleaseKey.vkCode = VK_LWIN;
+			/* tapNextReleaseKey.scanCode = 29; */
+			tapNextReleaseKey.flags = 0;
+			handleSystemKey(tapNextReleaseKey, isKeyUp);
+			break;
+	}
+}
+
+static inline int tapNextReleaseOf(DWORD scanCode) {
+	return scanCode < LEN ? config->mappingTapNextRelease[scanCode] : MT_NONE;
+}
+
+static inline int strategyOf(unsigned position) {
+	return config->mappingTapStrategy[keyQueue[QUEUE_SLOT(position)].scanCode];
+}
+
+/**
+ * Finds the oldest ModTap key that is not decided yet (status 2).
+ * FIFO entries that were decided otherwise in the meantime are dropped.
+ * returns `false` if there is none
+ **/
+bool firstPendingTapNextRelease(unsigned *position) {
+	while (pendingTapNextReleaseFirst != pendingTapNextReleaseEnd) {
+		unsigned j = pendingTapNextRelease[QUEUE_SLOT(pendingTapNextReleaseFirst)];
+		if (keyQueueStatus[QUEUE_SLOT(j)] == 2) {
+			*position = j;
+			return true;
+		}
+		pendingTapNextReleaseFirst++;
+	}
+	return false;
+}
+
+// send key down for tap-next-release function of this key and mark it as activated
+void activateTapNextReleaseKey(unsigned position) {
+	handleTapNextReleaseKey(tapNextReleaseOf(keyQueue[QUEUE_SLOT(position)].scanCode), false);
+	keyQueueStatus[QUEUE_SLOT(position)] = 3;
+}
+
+// the key was tapped while it was held back: send key down and up
+void tapQueuedKey(KBDLLHOOKSTRUCT *queuedKey) {
+	updateStatesAndWriteKey(*queuedKey, false); // key down
+	// release key
+	queuedKey->flags += 0x80;
+	// TODO: Es wäre besser hier down und up auf einmal zu senden, damit notwendige Modifier nicht zweimal gesendet werden.
+	updateStatesAndWriteKey(*queuedKey, true); // key up
+}
+
+/**
+ * Sends the keys that were only held back by ModTap keys which are decided now.
+ * A key activated with MT_TAP_NEXT_RELEASE keeps holding back the following
+ * keys until they are released, like before there were other strategies.
+ **/
+void releaseDecidedKeys() {
+	unsigned end;
+	if (!firstPendingTapNextRelease(&end))
+		end = keyQueueEnd;
+	for (unsigned i = keyQueueFirst; i != end; i++) {
+		uint8_t status = keyQueueStatus[QUEUE_SLOT(i)];
+		if (status == 3 && strategyOf(i) == MT_TAP_NEXT_RELEASE)
+			break;
+		if (status == 1) {
+			updateStatesAndWriteKey(keyQueue[QUEUE_SLOT(i)], false); // key down
+		} else if (status == 4) {
+			tapQueuedKey(&keyQueue[QUEUE_SLOT(i)]);
+		} else {
+			continue;
+		}
+		keyQueueStatus[QUEUE_SLOT(i)] = 0;
+		keyQueueLength--;
+	}
+	while (keyQueueFirst != keyQueueEnd && keyQueueStatus[QUEUE_SLOT(keyQueueFirst)] == 0)
+		keyQueueFirst++;
+	if (keyQueueLength == 0)
+		resetKeyQueue();
+}
+
+void handleModTapTimeout(DWORD now) {
+	// combo keys come first, they go to the queue when they are not a combo
+	handleComboTimeout(now);
+
+	unsigned j;
+	bool activated = false;
+	// oldest first: a key is never decided before a key pressed earlier
+	while (firstPendingTapNextRelease(&j)) {
+		unsigned tappingTerm = config->mappingTapTerm[keyQueue[QUEUE_SLOT(j)].scanCode];
+		if (!tappingTerm || (int32_t)(now - keyQueue[QUEUE_SLOT(j)].time) < (int32_t)tappingTerm)
+			break;
+		pendingTapNextReleaseFirst++;
+		activateTapNextReleaseKey(j);
+		keyStatsDecision(KEYSTATS_HOLD_TIMEOUT);
+		activated = true;
+	}
+	if (activated)
+		releaseDecidedKeys();
+}
+
+bool nextModTapDeadline(DWORD *time) {
+	DWORD comboDeadline = 0;
+	bool combo = nextComboDeadline(&comboDeadline);
+	unsigned j;
+	unsigned tappingTerm = keyQueueLength && firstPendingTapNextRelease(&j)
+		? config->mappingTapTerm[keyQueue[QUEUE_SLOT(j)].scanCode] : 0;
+	if (!tappingTerm) {
+		if (combo)
+			*time = comboDeadline;
+		return combo;
+	}
+	*time = keyQueue[QUEUE_SLOT(j)].time + tappingTerm;
+	if (combo && (int32_t)(comboDeadline - *time) < 0)
+		*time = comboDeadline;
+	return true;
+}
+
+void appendToQueue(KBDLLHOOKSTRUCT keyInfo) {
+	// only keyDown events
+	unsigned position;
+	if (findInQueue(keyInfo, &position))
+		return; // auto repeat of a key in the queue
+	if (keyQueueEnd - keyQueueFirst >= QUEUE_SIZE)
+		cleanupKeyQueue();
+	if (keyQueueEnd - keyQueueFirst >= QUEUE_SIZE) {
+		keyStatsDecision(KEYSTATS_QUEUE_FULL);
+		return; // more keys pressed than the queue can hold
+	}
+	if (keyQueueLength)
+		keyStatsModTapRoll(keyQueue[QUEUE_SLOT(keyQueueFirst)].scanCode, keyInfo.scanCode);
+
+	// another key is pressed: this decides waiting MT_HOLD_ON_OTHER_KEY keys
+	bool activated = false;
+	unsigned j;
+	while (firstPendingTapNextRelease(&j) && strategyOf(j) == MT_HOLD_ON_OTHER_KEY) {
+		pendingTapNextReleaseFirst++;
+		activateTapNextReleaseKey(j);
+		keyStatsDecision(KEYSTATS_HOLD_OTHER_KEY);
+		activated = true;
+	}
+
+	position = keyQueueEnd++;
+	keyQueueLength++;
+	int tapNextRelease = tapNextReleaseOf(keyInfo.scanCode);
+	logKeyRecord(LOG_QUEUE_APPEND, NULL, keyInfo, FG_GRAY, tapNextRelease, QUEUE_SLOT(position), keyQueueLength);
+	keyQueue[QUEUE_SLOT(position)] = keyInfo;
+	keyQueueStatus[QUEUE_SLOT(position)] = tapNextRelease ? 2 : 1;
+	if (keyIndex(keyInfo) < KEY_INDEX_SIZE)
+		keyQueueIndex[keyIndex(keyInfo)] = position;
+	if (tapNextRelease)
+		pendingTapNextRelease[QUEUE_SLOT(pendingTapNextReleaseEnd++)] = position;
+
+	// a regular key does not need to wait for keys that are decided already
+	if (activated || (!tapNextRelease && keyQueueStatus[QUEUE_SLOT(keyQueueFirst)] == 3
+			&& strategyOf(keyQueueFirst) != MT_TAP_NEXT_RELEASE))
+		releaseDecidedKeys();
+}
+
+// returns true, key release has been handled
+bool checkQueue(KBDLLHOOKSTRUCT keyInfo) {
+	// only keyUp events
+	// definiton: tap = press + release
+	unsigned i;
+	if (!findInQueue(keyInfo, &i))
+		return false;
+	KBDLLHOOKSTRUCT *queuedKey = &keyQueue[QUEUE_SLOT(i)];
+
+	// no matter what type of key it is:
+	// activate the tap-next-release keys in the queue pressed earlier
+	unsigned j;
+	while (firstPendingTapNextRelease(&j)) {
+		if ((int)(j - i) > 0)
+			break; // pressed later
+		if (j != i && strategyOf(j) == MT_TAPPING_TERM)
+			break; // only decided by its tapping term (or its own release)
+		pendingTapNextReleaseFirst++;
+		if (j == i)
+			break; // released key itself (it is being tapped)
+		activateTapNextReleaseKey(j);
+		keyStatsDecision(KEYSTATS_HOLD_NEXT_RELEASE);
+	}
+	// depending on key type
+	if (keyQueueStatus[QUEUE_SLOT(i)] <= 2) {
+		// regular key (no tap-next-release function) or
+		// tap-next-release key which has not been activated
+		if (keyQueueStatus[QUEUE_SLOT(i)] == 2)
+			keyStatsDecision(KEYSTATS_TAP);
+		if (firstPendingTapNextRelease(&j) && (int)(j - i) < 0) {
+			// a key pressed earlier is not decided yet, so this one has to wait
+			keyQueueStatus[QUEUE_SLOT(i)] = 4;
+			keyStatsDecision(KEYSTATS_DELAYED_RELEASE);
+			return true;
+		}
+		tapQueuedKey(queuedKey);
+	} else {
+		// tap-next-release key which was activated
+		// send key up for alternative mapping
+		handleTapNextReleaseKey(tapNextReleaseOf(queuedKey->scanCode), true);
+	}
+	// set status to 0 (=handled)
+	keyQueueStatus[QUEUE_SLOT(i)] = 0;
+	int tapNextRelease = tapNextReleaseOf(keyInfo.scanCode);
+	logKeyRecord(LOG_QUEUE_REMOVE, NULL, keyInfo, FG_GRAY, tapNextRelease, QUEUE_SLOT(i), keyQueueLength - 1);
+	// if beginning of queue, move it to next tap-next-release key
+	if (i == keyQueueFirst) {
+		// queue always begins with tap-next-release keys
+		unsigned j = i + 1;
+		while (j != keyQueueEnd) {
+			uint8_t status = keyQueueStatus[QUEUE_SLOT(j)];
+			if (status == 2 || status == 3) {
+				// make this position the beginning of the queue
+				keyQueueFirst = j;
+				keyQueueLength--;
+				break;
+			} else if (status == 1) {
+				// press this key (key down was held back, now it does not depend of other key states anymore)
+				updateStatesAndWriteKey(keyQueue[QUEUE_SLOT(j)], false); // key down
+				keyQueueLength--;
+			} else if (status == 4) {
+				// released while it was held back
+				tapQueuedKey(&keyQueue[QUEUE_SLOT(j)]);
+				keyQueueLength--;
+			}
+			j++;
+		}
+		if (j == keyQueueEnd) {
+			resetKeyQueue();
+			return true;
+		}
+	} else if (i == keyQueueEnd - 1) {
+		// move the end of the queue back to the last entry which is not handled
+		unsigned j = i;
+		while (j != keyQueueFirst) {
+			j--;
+			if (keyQueueStatus[QUEUE_SLOT(j)] > 0) {
+				keyQueueLength--;
+				keyQueueEnd = j + 1;
+				break;
+			}
+		}
+		if (keyQueueEnd == i + 1)
+			resetKeyQueue();
+	} else {
+		// key released was neither first nor last in queue
+		keyQueueLength--;
+	}
+	releaseDecidedKeys();
+	return true;
+}
+
+void mapLevels_2_5_6(Config *c, TCHAR * mappingTableOutput, TCHAR * newChars) {
+	TCHAR *mappingTableLevel1 = c->mappingTable[0];
+	TCHAR * l1_lowercase = L"abcdefghijklmnopqrstuvwxyzäöüß.,";
+
+	TCHAR *ptr;
+	for (int i = 0; i < LEN; i++) {
+		ptr = wcschr(l1_lowercase, mappingTableLevel1[i]);
+		if (ptr != NULL && ptr < &l1_lowercase[32]) {
+			//printf("i = %d: mappingTableLevel1[i] = %c; ptr = %d; ptr = %s; index = %d\n", i, mappingTableLevel1[i], ptr, ptr, ptr-l1_lowercase+1);
+			mappingTableOutput[i] = newChars[ptr-l1_lowercase];
+		}
+	}
+}
+
+void setSpecialKey(Config *c, unsigned level, unsigned scanCode, uint8_t type, uint32_t value) {
+	SpecialKey *specialKey = &c->specialKeys[level - 1][scanCode];
+	specialKey->type = type;
+	specialKey->value = value;
+	specialKey->scanCode = 0;
+	if (type == SPECIAL_VK) {
+		if (value == VK_RETURN)
+			specialKey->scanCode = 0x1c;
+		else if (value == VK_INSERT)
+			specialKey->scanCode = 0x52;
+	}
+}
+
+void addSpecialKeys(Config *c, const SpecialKeyDefinition *definitions) {
+	for (; definitions->level; definitions++)
+		setSpecialKey(c, definitions->level, definitions->scanCode, definitions->type, definitions->value);
+}
+
+void initSpecialKeys(Config *c, const LayoutDescriptor *layoutDescriptor) {
+	memset(c->specialKeys, 0, sizeof(c->specialKeys));
+	addSpecialKeys(c, commonSpecialKeys);
+	addSpecialKeys(c, layoutDescriptor->specialKeys);
+
+	// keys defined in the layout file replace the special keys of the layout
+	if (layoutImage) {
+		for (int level = 1; level <= LAYOUT_IMAGE_LEVELS; level++) {
+			for (int i = 0; i < LEN; i++) {
+				const LayoutImageSpecialKey *specialKey = &layoutImage->specialKeys[level - 1][i];
+				if (specialKey->type != SPECIAL_NONE)
+					setSpecialKey(c, level, i, specialKey->type, (uint32_t)specialKey->plane << 16 | specialKey->value);
+				else if (layoutImage->chars[level - 1][i])
+					setSpecialKey(c, level, i, SPECIAL_NONE, 0);
+			}
+		}
+	}
+}
+
+/**
+ * Dead keys are the special keys of type SPECIAL_CHAR and the keys left of 1,
+ * right of ß and right of ü (of Neo) with a character which starts compose
+ * sequences. The compose trie gets the sequences of these dead keys.
+ **/
+void initDeadKeys(Config *c) {
+	TCHAR deadKeys[6 * 3 + 16 + 1];
+	unsigned deadKeyCount = 0;
+	memset(c->deadKeys, 0, sizeof c->deadKeys);
+	for (int level = 0; level < 6; level++) {
+		for (int i = 0; i < LEN; i++) {
+			const SpecialKey *specialKey = &c->specialKeys[level][i];
+			TCHAR key = 0;
+			if (specialKey->type == SPECIAL_CHAR)
+				key = specialKey->value;
+			else if (specialKey->type == SPECIAL_NONE && (i == 13 || i == 27 || i == 41))
+				key = c->mappingTable[level][i];
+			if (key == 0 || !isComposeDeadKey(key))
+				continue;
+			c->deadKeys[level][i] = key;
+			if (!wmemchr(deadKeys, key, deadKeyCount) && deadKeyCount < sizeof deadKeys / sizeof deadKeys[0] - 1)
+				deadKeys[deadKeyCount++] = key;
+		}
+	}
+	deadKeys[deadKeyCount] = 0;
+	buildComposeTrie(&c->compose, deadKeys);
+}
+
+static void addMacroOutput(KeyOutput *output, WORD vkCode, WORD scanCode, DWORD flags) {
+	output->vkCode = vkCode;
+	output->scanCode = scanCode;
+	output->flags = flags;
+	output->extraInfo = 0;
+}
+
+/**
+ * Builds the key events of the macro keys of the layout file: unicode
+ * characters, new line and tab as Return and Tab.
+ **/
+void initMacros(ConfigSet *s, Config *c) {
+	unsigned macroCount = 0, outputCount = 0;
+	unsigned capacity = MACRO_ARENA_SIZE - s->macroOutputsUsed;
+	if (capacity > MACRO_OUTPUTS_SIZE)
+		capacity = MACRO_OUTPUTS_SIZE;
+	c->macroOutputs = &s->macroOutputs[s->macroOutputsUsed];
+	for (int level = 0; level < 6; level++) {
+		for (int i = 0; i < LEN; i++) {
+			SpecialKey *specialKey = &c->specialKeys[level][i];
+			if (specialKey->type != SPECIAL_MACRO)
+				continue;
+			if (macroCount == MACRO_LEN) {
+				printf("\nMacro on level %d of scan code %d ignored (more than %d macros).\n", level + 1, i, MACRO_LEN);
+				specialKey->type = SPECIAL_NONE;
+				continue;
+			}
+			// the index comes from the file: plane 0 and within the pool
+			if (!layoutImage || specialKey->value >= LAYOUT_IMAGE_MACRO_POOL) {
+				printf("\nMacro on level %d of scan code %d ignored (invalid index %u).\n", level + 1, i, (unsigned)specialKey->value);
+				specialKey->type = SPECIAL_NONE;
+				continue;
+			}
+			const uint16_t *text = &layoutImage->macroPool[specialKey->value];
+			const uint16_t *poolEnd = &layoutImage->macroPool[LAYOUT_IMAGE_MACRO_POOL];
+			Macro *macro = &c->macros[macroCount];
+			macro->firstOutput = outputCount;
+			for (; text < poolEnd && *text; text++) {
+				// a surrogate pair is not cut off
+				unsigned needed = (*text & 0xfc00) == 0xd800 ? 4 : 2;
+				if (outputCount - macro->firstOutput + needed > MACRO_MAX_OUTPUTS || outputCount + needed > capacity)
+					break;
+				KeyOutput *output = &c->macroOutputs[outputCount];
+				if (*text == '\n') {
+					addMacroOutput(&output[0], VK_RETURN, 0x1c, 0);
+					addMacroOutput(&output[1], VK_RETURN, 0x1c, KEYEVENTF_KEYUP);
+				} else if (*text == '\t') {
+					addMacroOutput(&output[0], VK_TAB, 0x0f, 0);
+					addMacroOutput(&output[1], VK_TAB, 0x0f, KEYEVENTF_KEYUP);
+				} else {
+					addMacroOutput(&output[0], 0, *text, KEYEVENTF_UNICODE);
+					addMacroOutput(&output[1], 0, *text, KEYEVENTF_UNICODE | KEYEVENTF_KEYUP);
+				}
+				outputCount += 2;
+			}
+			if (text == poolEnd || *text)
+				printf("\nMacro on level %d of scan code %d is too long, it is cut off.\n", level + 1, i);
+			macro->outputCount = outputCount - macro->firstOutput;
+			specialKey->value = macroCount++;
+		}
+	}
+	c->macroOutputCount = outputCount;
+	s->macroOutputsUsed += outputCount;
+}
+
+ComboEntry *findComboEntry(Config *c, uint64_t keys) {
+	unsigned index = (keys * 0x9E3779B97F4A7C15ull) >> (64 - c->comboHashBits);
+	while (c->comboEntries[index].keys != 0 && c->comboEntries[index].keys != keys)
+		index = (index + 1) & ((1u << c->comboHashBits) - 1);
+	return &c->comboEntries[index];
+}
+
+void addComboEntry(Config *c, uint64_t keys, int combo, unsigned term) {
+	ComboEntry *entry = findComboEntry(c, keys);
+	if (entry->keys == 0) {
+		entry->keys = keys;
+		entry->combo = -1;
+	}
+	if (combo < 0)
+		entry->partial = true;
+	else if (entry->combo < 0)
+		entry->combo = combo;
+	if (term > entry->term)
+		entry->term = term;
+}
+
+/**
+ * Numbers the keys of the combos and builds the hash table of their key sets,
+ * with at least twice as many entries as key sets
+ **/
+void initCombos(ConfigSet *s, Config *c) {
+	static ComboEntry noComboEntries[16];
+	memset(c->comboKeyId, 0, sizeof c->comboKeyId);
+	c->comboEntries = noComboEntries;
+	c->comboHashBits = 4;
+	c->combos = &s->combos[s->combosUsed];
+
+	unsigned defined = 0, keySets = 0;
+	for (; defined < COMBO_LEN && combos[defined].keys[0]; defined++)
+		keySets += (1u << strlen(combos[defined].keys)) - 1;
+	if (!defined)
+		return;
+	unsigned bits = 4;
+	while ((1u << bits) < 2 * keySets && bits < COMBO_HASH_BITS)
+		bits++;
+	if (defined > COMBO_ARENA_LEN - s->combosUsed || (1u << bits) > COMBO_ARENA_SIZE - s->comboEntriesUsed) {
+		printf("\nCombos ignored (too many combos in all profiles).\n");
+		return;
+	}
+	c->comboEntries = &s->comboEntries[s->comboEntriesUsed];
+	c->comboHashBits = bits;
+	memset(c->comboEntries, 0, sizeof(ComboEntry) << bits);
+	s->comboEntriesUsed += 1u << bits;
+
+	unsigned keyIds = 0;
+	int count = 0;
+	for (int i = 0; i < COMBO_LEN && combos[i].keys[0]; i++) {
+		unsigned scanCodes[COMBO_MAX_KEYS];
+		int length = strlen(combos[i].keys);
+		unsigned newIds = 0;
+		bool valid = length >= 2;
+		for (int k = 0; k < length && valid; k++) {
+			scanCodes[k] = mapCharacterToScanCode[(unsigned char)combos[i].keys[k]];
+			valid = scanCodes[k] != 0 && scanCodes[k] < LEN;
+			for (int l = 0; l < k; l++)
+				valid = valid && scanCodes[l] != scanCodes[k];
+			if (valid && !c->comboKeyId[scanCodes[k]])
+				newIds++;
+		}
+		if (!valid || keyIds + newIds > COMBO_MAX_KEY_IDS) {
+			printf("\nCombo %s ignored (unknown key or too many keys).\n", combos[i].keys);
+			continue;
+		}
+		uint64_t keys = 0;
+		for (int k = 0; k < length; k++) {
+			if (!c->comboKeyId[scanCodes[k]])
+				c->comboKeyId[scanCodes[k]] = ++keyIds;
+			keys |= (uint64_t)1 << (c->comboKeyId[scanCodes[k]] - 1);
+		}
+		c->combos[count] = combos[i];
+		addComboEntry(c, keys, count, combos[i].term);
+		// all subsets the keys are pressed through
+		for (uint64_t part = (keys - 1) & keys; part; part = (part - 1) & keys)
+			addComboEntry(c, part, -1, combos[i].term);
+		count++;
+	}
+	c->comboCount = count;
+	s->combosUsed += count;
+}
+
+/**
+ * Copies the characters of the layout file into the mapping table
+ **/
+void applyLayoutImage(Config *c) {
+	if (!layoutImage)
+		return;
+	for (int level = 0; level < LAYOUT_IMAGE_LEVELS; level++) {
+		for (int i = 0; i < LEN; i++) {
+			if (layoutImage->chars[level][i])
+				c->mappingTable[level][i] = layoutImage->chars[level][i];
+		}
+	}
+}
+
+void initCharacterToScanCodeMap() {
+	mapCharacterToScanCode['q'] = 0x10;
+	mapCharacterToScanCode['w'] = 0x11;
+	mapCharacterToScanCode['e'] = 0x12;
+	mapCharacterToScanCode['r'] = 0x13;
+	mapCharacterToScanCode['t'] = 0x14;
+	mapCharacterToScanCode['z'] = 0x15;
+	mapCharacterToScanCode['u'] = 0x16;
+	mapCharacterToScanCode['i'] = 0x17;
+	mapCharacterToScanCode['o'] = 0x18;
+	mapCharacterToScanCode['p'] = 0x19;
+	mapCharacterToScanCode[0xfc] = 0x1a; // ü
+	mapCharacterToScanCode['+'] = 0x1b;
+	mapCharacterToScanCode['a'] = 0x1e;
+	mapCharacterToScanCode['s'] = 0x1f;
+	mapCharacterToScanCode['d'] = 0x20;
+	mapCharacterToScanCode['f'] = 0x21;
+	mapCharacterToScanCode['g'] = 0x22;
+	mapCharacterToScanCode['h'] = 0x23;
+	mapCharacterToScanCode['j'] = 0x24;
+	mapCharacterToScanCode['k'] = 0x25;
+	mapCharacterToScanCode['l'] = 0x26;
+	mapCharacterToScanCode[0xf6] = 0x27; // ö
+	mapCharacterToScanCode[0xe4] = 0x28; // ä
+	mapCharacterToScanCode['y'] = 0x2c;
+	mapCharacterToScanCode['x'] = 0x2d;
+	mapCharacterToScanCode['c'] = 0x2e;
+	mapCharacterToScanCode['v'] = 0x2f;
+	mapCharacterToScanCode['b'] = 0x30;
+	mapCharacterToScanCode['n'] = 0x31;
+	mapCharacterToScanCode['m'] = 0x32;
+	mapCharacterToScanCode[','] = 0x33;
+	mapCharacterToScanCode['.'] = 0x34;
+	mapCharacterToScanCode['-'] = 0x35;
+}
+
+bool isLetter(TCHAR key) {
+	return (key >= 65 && key <= 90  // A-Z
+	     || key >= 97 && key <= 122 // a-z
+	     || key == L'ä' || key == L'Ä'
+	     || key == L'ö' || key == L'Ö'
+	     || key == L'ü' || key == L'Ü'
+	     || key == L'ß' || key == L'ẞ');
+}
+
+void initLevelTable(Config *c) {
+	for (unsigned state = 0; state < (1 << LEVEL_BITS); state++) {
+		unsigned level = 1;
+
+		if (!(state & STATE_SHIFT) != !(state & STATE_SHIFT_LOCK)) // shift XOR shift lock
+			level = 2;
+		if (state & STATE_MOD3)
+			level = (supportLevels5and6 && level == 2) ? 5 : 3;
+		if (!(state & STATE_MOD4) != !(state & STATE_LEVEL4_LOCK))
+			level = (supportLevels5and6 && level == 3) ? 6 : 4;
+
+		c->levelTable[state] = level;
+		if ((state & STATE_CAPS_LOCK) && level <= 2)
+			c->mappingRowTable[state] = level == 1 ? ROW_CAPS_LEVEL1 : ROW_CAPS_LEVEL2;
+		else
+			c->mappingRowTable[state] = level - 1;
+	}
+}
+
+/**
+ * Caps lock swaps levels one and two, but only for letters
+ **/
+void initCapsLockRows(Config *c) {
+	TCHAR *mappingTableLevel1 = c->mappingTable[0];
+	TCHAR *mappingTableLevel2 = c->mappingTable[1];
+	for (int i = 0; i < LEN; i++) {
+		c->mappingTable[ROW_CAPS_LEVEL1][i] = isLetter(mappingTableLevel1[i]) ? mappingTableLevel2[i] : mappingTableLevel1[i];
+		c->mappingTable[ROW_CAPS_LEVEL2][i] = isLetter(mappingTableLevel2[i]) ? mappingTableLevel1[i] : mappingTableLevel2[i];
+	}
+}
+
+/**
+ * Builds all lookup tables of the configuration from the settings.
+ * Only reads the settings and the layout descriptors, so it may run on any
+ * thread as long as s is not the active set of configurations.
+ **/
+void buildConfig(ConfigSet *s, Config *c) {
+	TCHAR *mappingTableLevel1 = c->mappingTable[0];
+	TCHAR *mappingTableLevel2 = c->mappingTable[1];
+	TCHAR *mappingTableLevel3 = c->mappingTable[2];
+	TCHAR *mappingTableLevel4 = c->mappingTable[3];
+	TCHAR *mappingTableLevel5 = c->mappingTable[4];
+	TCHAR *mappingTableLevel6 = c->mappingTable[5];
+
+	memset(c, 0, sizeof(Config));
+
+	// settings used while handling key events
+	c->scanCodeMod3L = scanCodeMod3L;
+	if (quoteAsMod3R)
+		// use ä/quote key instead of #/backslash key as right level 3 modifier
+		c->scanCodeMod3R = SCANCODE_QUOTE_KEY;
+	else if (returnAsMod3R)
+		// use return key instead of #/backslash as right level 3 modifier
+		// (might be useful for US keyboards because the # key is missing there)
+		c->scanCodeMod3R = SCANCODE_RETURN_KEY;
+	else
+		c->scanCodeMod3R = scanCodeMod3R;
+	if (tabAsMod4L)
+		// use tab key instead of < key as left level 4 modifier
+		// (might be useful for US keyboards because the < key is missing there)
+		c->scanCodeMod4L = SCANCODE_TAB_KEY;
+	else
+		c->scanCodeMod4L = scanCodeMod4L;
+	c->capsLockEnabled = capsLockEnabled;
+	c->shiftLockEnabled = shiftLockEnabled;
+	c->level4LockEnabled = level4LockEnabled;
+	c->qwertzForShortcuts = qwertzForShortcuts;
+	c->swapLeftCtrlAndLeftAlt = swapLeftCtrlAndLeftAlt;
+	c->swapLeftCtrlLeftAltAndLeftWin = swapLeftCtrlLeftAltAndLeftWin;
+	c->capsLockAsEscape = capsLockAsEscape;
+	c->mod3RAsReturn = mod3RAsReturn;
+	c->mod4LAsTab = mod4LAsTab;
+	c->remapInjected = remapInjected;
+
+	// same for all layouts
+	wcscpy(mappingTableLevel1 +  2, L"1234567890-`");
+	wcscpy(mappingTableLevel1 + 71, L"789-456+1230.");
+	mappingTableLevel1[41] = L'^'; // key to the left of the "1" key, dead key
+	mappingTableLevel1[57] = L' '; // Spacebar → space
+	mappingTableLevel1[69] = L'\t'; // NumLock key → tabulator
+
+	mappingTableLevel2[41] = L'\u030C'; // key to the left of the "1" key, "Combining Caron"
+	wcscpy(mappingTableLevel2 +  2, L"°§ℓ»«$€„“”—̧");
+	wcscpy(mappingTableLevel2 + 71, L"✔✘†-♣€‣+♦♥♠␣."); // numeric keypad
+	mappingTableLevel2[57] = L' '; // Spacebar → space
+	mappingTableLevel2[69] = L'\t'; // NumLock key → tabulator
+	// https://neo-layout.org/grafik/aufsteller/neo20-aufsteller.pdf
+
+	wcscpy(mappingTableLevel3 + 41, L"^");
+	wcscpy(mappingTableLevel3 +  2, L"¹²³›‹¢¥‚‘’—̊");
+	wcscpy(mappingTableLevel3 + 16, L"…_[]^!<>=&ſ");
+	mappingTableLevel3[27] = L'\u0337'; // "Combining Short Solidus Overlay"
+	wcscpy(mappingTableLevel3 + 30, L"\\/{}*?()-:@");
+	wcscpy(mappingTableLevel3 + 44, L"#$|~`+%\"';");
+	wcscpy(mappingTableLevel3 + 71, L"↕↑↨−←:→±↔↓⇌%,"); // numeric keypad
+	mappingTableLevel3[55] = L'⋅'; // *-key on numeric keypad
+	mappingTableLevel3[57] = L' '; // Spacebar → space
+	mappingTableLevel3[69] = L'='; // num-lock-key
+
+	mappingTableLevel4[41] = L'\u0307'; // "Combining Dot Above"
+	wcscpy(mappingTableLevel4 +  2, L"ªº№⋮·£¤0/*-");
+	mappingTableLevel4[13] = L'\u00A8'; // "Diaresis"
+	wcscpy(mappingTableLevel4 + 21, L"¡789+−˝");
+	wcscpy(mappingTableLevel4 + 35, L"¿456,.");
+	wcscpy(mappingTableLevel4 + 49, L":123;");
+	mappingTableLevel4[55] = L'×'; // *-key on numeric keypad
+	mappingTableLevel4[74] = L'∖'; // --key on numeric keypad
+	mappingTableLevel4[78] = L'∓'; // +-key on numeric keypad
+	mappingTableLevel4[69] = L'≠'; // num-lock-key
+
+	// layout dependent (a layout file may name the layout it is based on)
+	const char *layoutName = layoutImage && layoutImage->baseLayout[0] ? layoutImage->baseLayout : layout;
+	const LayoutDescriptor *layoutDescriptor = findLayout(layoutName);
+	if (layoutDescriptor == NULL) {
+		printf("\nUnknown layout %s, using neo.\n", layoutName);
+		layoutDescriptor = &layouts[LAYOUT_NEO];
+	}
+	for (const LayoutRow *row = layoutDescriptor->rows; row->level; row++)
+		wcscpy(c->mappingTable[row->level - 1] + row->scanCode, row->chars);
+
+	// the characters derived from level 1 below are derived from the layout file, too
+	applyLayoutImage(c);
+
+	// use custom layout if it was defined
+	if (wcslen(customLayoutWcs) != 0) {
+		if (wcslen(customLayoutWcs) == 32) {
+			// custom layout
+			wcsncpy(mappingTableLevel1 + 16, customLayoutWcs, 11);
+			wcsncpy(mappingTableLevel1 + 30, customLayoutWcs + 11, 11);
+			wcsncpy(mappingTableLevel1 + 44, customLayoutWcs + 22, 10);
+		} else {
+			printf("\ncustomLayout given but its length is %i (expected: 32).\n", wcslen(customLayoutWcs));
+		}
+	}
+
+	// same for all layouts
+	wcscpy(mappingTableLevel1 + 27, L"´");
+	wcscpy(mappingTableLevel2 + 27, L"~");
+	// slash key is special: it has the same scan code in the main block and the numpad
+	wcscpy(c->numpadSlashKey, L"//÷∕⌀∣");
+
+	// map letters of level 2
+	TCHAR * charsLevel2;
+	charsLevel2 = L"ABCDEFGHIJKLMNOPQRSTUVWXYZÄÖÜẞ•–";
+	mapLevels_2_5_6(c, mappingTableLevel2, charsLevel2);
+
+	if (supportLevels5and6) {
+		// map main block on levels 5 and 6
+		// (Neo does not define characters for u, v and ü on level 5.)
+		TCHAR * charsLevel5 = L"αβχδεφγψιθκλμνοπϕρστuvωξυζηϵüςϑϱ";  // a-zäöüß.,
+		mapLevels_2_5_6(c, mappingTableLevel5, charsLevel5);
+		TCHAR * charsLevel6 = L"∀⇐ℂΔ∃ΦΓΨ∫Θ⨯Λ⇔ℕ∈ΠℚℝΣ∂⊂√ΩΞ∇ℤℵ∩∪∘↦⇒";  // a-zäöüß.,
+		mapLevels_2_5_6(c, mappingTableLevel6, charsLevel6);
+
+		// add number row and dead key in upper letter row
+		mappingTableLevel5[41] = L'\u0309'; // "Combining Hook Above"
+		wcscpy(mappingTableLevel5 +  2, L"₁₂₃♂♀⚥ϰ⟨⟩₀?");
+		mappingTableLevel5[13] = L'\u1FFE'; // "Greek Dasia"
+		mappingTableLevel5[27] = L'\u1FBF'; // "Greek Psili"
+		mappingTableLevel5[57] = L'\u00A0'; // space = no-break space
+		wcscpy(mappingTableLevel5 + 71, L"≪∩≫⊖⊂⊶⊃⊕≤∪≥‰′"); // numeric keypad
+
+		wcscpy(mappingTableLevel5 + 55, L"⊙");  // *-key on numeric keypad
+		wcscpy(mappingTableLevel5 + 69, L"≈");  // num-lock-key
+
+		mappingTableLevel6[41] = L'\u0323'; // "Combining Dot Below"
+		wcscpy(mappingTableLevel6 +  2, L"¬∨∧⊥∡∥→∞∝⌀?");
+		mappingTableLevel6[13] = L'\u0304'; // "Combining Macron"
+		wcscpy(mappingTableLevel6 + 27, L"˘");
+		mappingTableLevel6[57] = 0x202f;  // space = narrow no-break space
+		wcscpy(mappingTableLevel6 + 71, L"⌈⋂⌉∸⊆⊷⊇∔⌊⋃⌋□"); // numeric keypad
+		mappingTableLevel6[83] = 0x02dd; // double acute accent (not sure about this one)
+		wcscpy(mappingTableLevel6 + 55, L"⊗");  // *-key on numeric keypad
+		wcscpy(mappingTableLevel6 + 69, L"≡");  // num-lock-key
+	}
+
+	mappingTableLevel2[8] = 0x20AC;  // €
+
+	// characters defined in the layout file take precedence over the derived ones
+	applyLayoutImage(c);
+
+	// if quote/ä is the right level 3 modifier, copy symbol of quote/ä key to backslash/# key
+	if (quoteAsMod3R) {
+		mappingTableLevel1[43] = mappingTableLevel1[40];
+		mappingTableLevel2[43] = mappingTableLevel2[40];
+		mappingTableLevel3[43] = mappingTableLevel3[40];
+		mappingTableLevel4[43] = mappingTableLevel4[40];
+		if (supportLevels5and6) {
+			mappingTableLevel5[43] = mappingTableLevel5[40];
+			mappingTableLevel6[43] = mappingTableLevel6[40];
+		}
+	}
+
+	initCapsLockRows(c);
+	initLevelTable(c);
+
+	// dead keys and navigation keys
+	initSpecialKeys(c, layoutDescriptor);
+	initDeadKeys(c);
+	initMacros(s, c);
+
+	// apply modTap modifiers
+	// puts("\nModTap keys:");
+	for (int i=0; i<MOD_TAP_LEN && modTap[i].modifier; i++) {
+		unsigned int scanCode = mapCharacterToScanCode[(unsigned char)modTap[i].keycode];
+		c->mappingTapNextRelease[scanCode] = modTap[i].modifier;
+		c->mappingTapTerm[scanCode] = modTap[i].tappingTerm;
+		c->mappingTapStrategy[scanCode] = modTap[i].strategy;
+		// printf("%s (%i), %c (%i), sc=0x%X (%i)\n", MT_MODIFIER_STRING[modTap[i].modifier], modTap[i].modifier, modTap[i].keycode, (unsigned char)modTap[i].keycode, scanCode, scanCode);
+    }
+
+	initCombos(s, c);
+
+	// (the hook thread rebuilds the cache if the keyboard layout changes)
+	void *keyboardLayout = __atomic_load_n(&hookKeyboardLayout, __ATOMIC_RELAXED);
+	if (keyboardLayout)
+		fillKeyScanCache(c, keyboardLayout);
+}
+
+/**
+ * Builds the first configuration, before any key event is handled
+ **/
+void initLayout() {
+	configSet->combosUsed = configSet->comboEntriesUsed = configSet->macroOutputsUsed = 0;
+	buildConfig(configSet, config);
+	configSet->profileCount = 1;
+	lastBuiltConfigSet = configSet;
+}
+
+void reloadConfig(int profileCount, void (*applyProfile)(int profile)) {
+	// a configuration the hook thread has not switched to yet can be built again,
+	// otherwise the hook thread uses the last built one and the other one is free
+	ConfigSet *s = __atomic_exchange_n(&newConfigSet, NULL, __ATOMIC_ACQ_REL);
+	if (!s)
+		s = lastBuiltConfigSet == &configSets[0] ? &configSets[1] : &configSets[0];
+	if (!applyProfile || profileCount < 1)
+		profileCount = 1;
+	if (profileCount > PROFILE_COUNT)
+		profileCount = PROFILE_COUNT;
+	s->combosUsed = s->comboEntriesUsed = s->macroOutputsUsed = 0;
+	// the default profile last, so its settings are the current ones afterwards
+	for (int profile = profileCount - 1; profile >= 0; profile--) {
+		if (applyProfile)
+			applyProfile(profile);
+		buildConfig(s, &s->profiles[profile]);
+	}
+	s->profileCount = profileCount;
+	lastBuiltConfigSet = s;
+	__atomic_store_n(&newConfigSet, s, __ATOMIC_RELEASE);
+}
+
+void selectProfile(int profile) {
+	selectedProfile = profile;
+}
+
+/**
+ * Hook thread: switch to a new configuration (see reloadConfig()) or to the
+ * selected profile, but only while no modifier is held and the queue is empty,
+ * so no key is released with other settings than it was pressed with.
+ **/
+static inline void takeNewConfig() {
+	if ((!__atomic_load_n(&newConfigSet, __ATOMIC_RELAXED) && selectedProfile == configProfile)
+	    || (modState & STATE_MODIFIER_KEYS) || keyQueueLength || comboKeyCount || activeComboMask || passedComboKeys)
+		return;
+	ConfigSet *s = __atomic_exchange_n(&newConfigSet, NULL, __ATOMIC_ACQ_REL);
+	if (s)
+		configSet = s;
+	configProfile = selectedProfile;
+	Config *c = &configSet->profiles[configProfile >= 0 && configProfile < configSet->profileCount ? configProfile : 0];
+	if (c != config || s) {
+		config = c;
+		configChanges++;
+		repeatCache.valid = false;
+		resetCompose();
+		logMessage("New configuration\n", NULL);
+	}
+}
+
+void hotConfigMemory(void (*range)(void *address, size_t size)) {
+	range(config, sizeof(Config));
+	range(config->comboEntries, sizeof(ComboEntry) << config->comboHashBits);
+	if (config->comboCount)
+		range(config->combos, config->comboCount * sizeof(Combo));
+	if (config->macroOutputCount)
+		range(config->macroOutputs, config->macroOutputCount * sizeof(KeyOutput));
+}
+
+void hotStateMemory(void (*range)(void *address, size_t size)) {
+	range(keyQueue, sizeof keyQueue);
+	range(keyQueueStatus, sizeof keyQueueStatus);
+	range(keyQueueIndex, sizeof keyQueueIndex);
+	range(pendingTapNextRelease, sizeof pendingTapNextRelease);
+	range(keyDownState, sizeof keyDownState);
+	range(&repeatCache, sizeof repeatCache);
+	range(outputBuffer, sizeof outputBuffer);
+}
+
+KeyScanCacheEntry *findKeyScanCacheEntry(Config *c, TCHAR key) {
+	unsigned index = (key * 2654435761u) & (KEY_SCAN_CACHE_SIZE - 1);
+	while (c->keyScanCache[index].character != 0 && c->keyScanCache[index].character != key)
+		index = (index + 1) & (KEY_SCAN_CACHE_SIZE - 1);
+	return &c->keyScanCache[index];
+}
+
+void addToKeyScanCache(Config *c, TCHAR key) {
+	if (key == 0)
+		return;
+	KeyScanCacheEntry *entry = findKeyScanCacheEntry(c, key);
+	if (entry->character == 0) {
+		entry->character = key;
+		entry->keyScanResult = keyScanForLayout(key, c->keyScanCacheLayout);
+	}
+}
+
+void addTableToKeyScanCache(Config *c, TCHAR *table, int length) {
+	for (int i = 0; i < length; i++)
+		addToKeyScanCache(c, table[i]);
+}
+
+/**
+ * Shortcut layer: what a key sends while a system key (Ctrl, Alt, Win) is held
+ * on level 1 without any lock, the way updateStatesAndWriteKey() would map it.
+ * SHORTCUT_PASS lets the key event pass (qwertzForShortcuts, extended keys,
+ * keys without a character), another value is the virtual key to send
+ * instead (the character of the layout needs no modifiers).
+ * SHORTCUT_NONE keys (modifiers, ModTap and combo keys, special cases,
+ * characters sent as unicode or with modifiers) take the usual path.
+ **/
+#define SHORTCUT_NONE 0
+#define SHORTCUT_PASS 0xFF
+void buildShortcutLayer(Config *c) {
+	TCHAR *level1 = c->mappingTable[c->mappingRowTable[0]];
+	for (int scanCode = 0; scanCode < LEN; scanCode++) {
+		bool modifier = scanCode == 29 || scanCode == 42 || scanCode == 54 || scanCode == 56
+			|| scanCode == 91 || scanCode == 92 || scanCode == (int)c->scanCodeMod3L
+			|| scanCode == (int)c->scanCodeMod3R || scanCode == (int)c->scanCodeMod4L;
+		bool usual = modifier || c->mappingTapNextRelease[scanCode] || c->comboKeyId[scanCode];
+		// handled before the special cases, except the slash key on the numpad
+		c->shortcutVk[1][scanCode] = usual || scanCode == 53 ? SHORTCUT_NONE : SHORTCUT_PASS;
+
+		if (usual || c->specialKeys[0][scanCode].type != SPECIAL_NONE) {
+			c->shortcutVk[0][scanCode] = SHORTCUT_NONE;
+		} else if (c->qwertzForShortcuts || level1[scanCode] == 0) {
+			c->shortcutVk[0][scanCode] = SHORTCUT_PASS;
+		} else {
+			SHORT keyScanResult = findKeyScanCacheEntry(c, level1[scanCode])->keyScanResult;
+			c->shortcutVk[0][scanCode] = keyScanResult == -1 || (keyScanResult & 0xff00)
+				|| (keyScanResult & 0xff) == SHORTCUT_PASS ? SHORTCUT_NONE : keyScanResult & 0xff;
+		}
+	}
+}
+
+void fillKeyScanCache(Config *c, void *keyboardLayout) {
+	memset(c->keyScanCache, 0, sizeof c->keyScanCache);
+	c->keyScanCacheLayout = keyboardLayout;
+	for (int level = 0; level < 6; level++)
+		addTableToKeyScanCache(c, c->mappingTable[level], LEN);
+	addTableToKeyScanCache(c, c->numpadSlashKey, 6);
+	buildShortcutLayer(c);
+}
+
+void updateKeyScanCache(void *keyboardLayout) {
+	fillKeyScanCache(config, keyboardLayout);
+	repeatCache.valid = false;
+	__atomic_store_n(&hookKeyboardLayout, keyboardLayout, __ATOMIC_RELAXED);
+}
+
+/**
+ * Replacement for VkKeyScanEx(key, GetKeyboardLayout(0)).
+ * The hook thread has no window that could receive WM_INPUTLANGCHANGE,
+ * so a changed keyboard layout is detected by comparing the HKL.
+ **/
+SHORT keyScan(TCHAR key) {
+	void *keyboardLayout = currentKeyboardLayout();
+	if (keyboardLayout != config->keyScanCacheLayout) {
+		logMessage("Keyboard layout changed, rebuilding VkKeyScanEx cache\n", NULL);
+		updateKeyScanCache(keyboardLayout);
+	}
+	KeyScanCacheEntry *entry = findKeyScanCacheEntry(config, key);
+	if (entry->character == 0) {
+		// not in any mapping table (special cases): look it up once
+		entry->character = key;
+		entry->keyScanResult = keyScanForLayout(key, keyboardLayout);
+	}
+	return entry->keyScanResult;
+}
+
+void toggleBypassMode() {
+	bypassMode = !bypassMode;
+	resetCompose();
+	memset(keyDownState, 0, sizeof keyDownState);
+	bypassModeChanged();
+}
+
+/**
+ * Maps keyInfo flags (https://docs.microsoft.com/en-us/windows/win32/api/winuser/ns-winuser-kbdllhookstruct)
+ * to dwFlags for SendInput (https://docs.microsoft.com/en-us/windows/win32/api/winuser/ns-winuser-keybdinput)
+ **/
+DWORD dwFlagsFromKeyInfo(KBDLLHOOKSTRUCT keyInfo) {
+	DWORD dwFlags = 0;
+	if (keyInfo.flags & LLKHF_EXTENDED) dwFlags |= KEYEVENTF_EXTENDEDKEY;
+	if (keyInfo.flags & LLKHF_UP) dwFlags |= KEYEVENTF_KEYUP;
+	return dwFlags;
+}
+
+/**
+ * All keyboard events resulting from one hook call are collected in this
+ * buffer. The platform layer sends them with a single SendInput call in
+ * flushOutput(). This way modifiers, key and modifier releases of one logical
+ * keystroke reach the system in one piece and no other input can get in between.
+ */
+KeyOutput outputBuffer[OUTPUT_BUFFER_SIZE];
+int outputLength = 0;
+
+/**
+ * Modifiers sendChar() has pressed for a character and not released yet
+ * (INJECTED_*). They stay down for the following characters that need them.
+ * Any other output releases them first.
+ */
+enum injectedModifier {
+	INJECTED_ALTGR = 1 << 0,
+	INJECTED_CTRL  = 1 << 1,
+	INJECTED_ALT   = 1 << 2,
+	INJECTED_SHIFT = 1 << 3
+};
+static const struct { BYTE vkCode; BYTE scanCode; bool isExtendedKey; } injectedModifierKeys[] = {
+	{VK_RMENU, 56, true}, {VK_CONTROL, 29, false}, {VK_MENU, 56, false}, {VK_SHIFT, 42, false}
+};
+unsigned injectedModifiers = 0;
+
+static inline void appendOutput(WORD vkCode, WORD scanCode, DWORD dwFlags, ULONG_PTR dwExtraInfo) {
+	if (outputLength >= OUTPUT_BUFFER_SIZE)
+		flushOutput();
+	KeyOutput *output = &outputBuffer[outputLength++];
+	output->vkCode = vkCode;
+	output->scanCode = scanCode;
+	output->flags = dwFlags;
+	output->extraInfo = dwExtraInfo;
+}
+
+/**
+ * Presses and releases injected modifiers, so that exactly `modifiers` are down
+ **/
+void setInjectedModifiers(unsigned modifiers) {
+	for (unsigned i = 0; i < sizeof injectedModifierKeys / sizeof injectedModifierKeys[0]; i++) {
+		unsigned modifier = 1 << i;
+		if ((injectedModifiers & modifier) && !(modifiers & modifier))
+			appendOutput(injectedModifierKeys[i].vkCode, injectedModifierKeys[i].scanCode,
+				(injectedModifierKeys[i].isExtendedKey ? KEYEVENTF_EXTENDEDKEY : 0) | KEYEVENTF_KEYUP, 0);
+	}
+	for (unsigned i = 0; i < sizeof injectedModifierKeys / sizeof injectedModifierKeys[0]; i++) {
+		unsigned modifier = 1 << i;
+		if (!(injectedModifiers & modifier) && (modifiers & modifier))
+			appendOutput(injectedModifierKeys[i].vkCode, injectedModifierKeys[i].scanCode,
+				injectedModifierKeys[i].isExtendedKey ? KEYEVENTF_EXTENDEDKEY : 0, 0);
+	}
+	injectedModifiers = modifiers;
+}
+
+void releaseInjectedModifiers() {
+	setInjectedModifiers(0);
+}
+
+/**
+ * Appends a keyboard event to the output buffer (same parameters as keybd_event)
+ **/
+void sendKeyEvent(WORD vkCode, WORD scanCode, DWORD dwFlags, ULONG_PTR dwExtraInfo) {
+	if (injectedModifiers)
+		releaseInjectedModifiers();
+	appendOutput(vkCode, scanCode, dwFlags, dwExtraInfo);
+}
+
+void sendDown(BYTE vkCode, BYTE scanCode, bool isExtendedKey) {
+	sendKeyEvent(vkCode, scanCode, (isExtendedKey ? KEYEVENTF_EXTENDEDKEY : 0), 0);
+}
+
+void sendUp(BYTE vkCode, BYTE scanCode, bool isExtendedKey) {
+	sendKeyEvent(vkCode, scanCode, (isExtendedKey ? KEYEVENTF_EXTENDEDKEY : 0) | KEYEVENTF_KEYUP, 0);
+}
+
+void sendDownUp(BYTE vkCode, BYTE scanCode, bool isExtendedKey) {
+	sendDown(vkCode, scanCode, isExtendedKey);
+	sendUp(vkCode, scanCode, isExtendedKey);
+}
+
+void resetModifierState() {
+	static const struct { unsigned state; BYTE vkCode; BYTE scanCode; } sentModifiers[] = {
+		{STATE_SHIFT_LEFT, VK_LSHIFT, 42}, {STATE_SHIFT_RIGHT, VK_RSHIFT, 54},
+		{STATE_CTRL_LEFT, VK_LCONTROL, 29}, {STATE_CTRL_RIGHT, VK_RCONTROL, 29},
+		{STATE_ALT_LEFT, VK_LMENU, 56}, {STATE_WIN_LEFT, VK_LWIN, 91}, {STATE_WIN_RIGHT, VK_RWIN, 92},
+	};
+	for (unsigned i = 0; i < sizeof sentModifiers / sizeof sentModifiers[0]; i++) {
+		if (modState & sentModifiers[i].state)
+			sendUp(sentModifiers[i].vkCode, sentModifiers[i].scanCode, false);
+	}
+	modState &= STATE_SHIFT_LOCK | STATE_LEVEL4_LOCK | STATE_CAPS_LOCK;
+	resetKeyQueue();
+	resetCompose();
+	composedScanCode = deadKeyScanCode = macroScanCode = 0;
+	comboKeyCount = 0;
+	comboKeyMask = activeComboMask = passedComboKeys = 0;
+	activeComboModifier = MT_NONE;
+}
+
+static void sendUnicodeCharDownUp(TCHAR key) {
+	sendKeyEvent(0, key, KEYEVENTF_UNICODE, 0);
+	sendKeyEvent(0, key, KEYEVENTF_UNICODE | KEYEVENTF_KEYUP, 0);
+}
+
+/**
+ * Sends a character beyond the BMP as surrogate pair (key down). Both halves
+ * go out with the same SendInput call, high surrogate first.
+ **/
+void sendSurrogatePair(uint32_t codePoint) {
+	if (injectedModifiers)
+		releaseInjectedModifiers();
+	if (outputLength + 4 > OUTPUT_BUFFER_SIZE)
+		flushOutput();
+	codePoint -= 0x10000;
+	sendUnicodeCharDownUp(0xd800 + (codePoint >> 10));
+	sendUnicodeCharDownUp(0xdc00 + (codePoint & 0x3ff));
+}
+
+/**
+ * Sends the pending dead keys and characters as they are, they cannot be
+ * composed (the compose key itself gives nothing)
+ **/
+void sendPendingDeadKeys() {
+	for (int i = 0; i < composeLength; i++) {
+		if (composeSequence[i] != COMPOSE_KEY)
+			sendUnicodeCharDownUp(composeSequence[i]);
+	}
+	resetCompose();
+}
+
+/**
+ * Continues the compose sequence with a dead key (key down)
+ **/
+void pressDeadKey(TCHAR deadKey, KBDLLHOOKSTRUCT keyInfo) {
+	if (keyInfo.scanCode == deadKeyScanCode)
+		return;
+	deadKeyScanCode = keyInfo.scanCode;
+
+	int edge = composeStep(&config->compose, composeNode, deadKey);
+	if (edge < 0 || !config->compose.edgeNode[edge]) {
+		// no sequence goes on with this dead key, it starts a new one
+		sendPendingDeadKeys();
+		edge = composeStep(&config->compose, 0, deadKey);
+		if (edge < 0 || !config->compose.edgeNode[edge]) {
+			sendUnicodeCharDownUp(deadKey);
+			return;
+		}
+	}
+	composeSequence[composeLength++] = deadKey;
+	composeNode = config->compose.edgeNode[edge];
+}
+
+/**
+ * Character pressed after dead keys: sends the composed character or, in a
+ * sequence of the compose key, continues it (the trie is not deeper than
+ * composeSequence is long).
+ * returns `false` if there is none. Then the dead keys are sent and the
+ * character has to be sent as usual.
+ **/
+bool composeChar(TCHAR key, KBDLLHOOKSTRUCT keyInfo) {
+	int edge = composeStep(&config->compose, composeNode, key);
+	TCHAR result = edge < 0 ? 0 : config->compose.edgeResult[edge];
+	if (!result && edge >= 0 && config->compose.edgeNode[edge]) {
+		composeSequence[composeLength++] = key;
+		composeNode = config->compose.edgeNode[edge];
+		composedScanCode = keyInfo.scanCode; // its key up is swallowed as well
+		return true;
+	}
+	if (!result) {
+		sendPendingDeadKeys();
+		return false;
+	}
+	resetCompose();
+	sendUnicodeCharDownUp(result);
+	composedScanCode = keyInfo.scanCode;
+	logKeyRecord(LOG_MAPPED, " composed", keyInfo, FG_WHITE, result, 0, 0);
+	return true;
+}
+
+void sendUnicodeChar(TCHAR key, KBDLLHOOKSTRUCT keyInfo) {
+	if (composeLength && !(keyInfo.flags & LLKHF_UP) && composeChar(key, keyInfo))
+		return;
+	sendKeyEvent(0, key, KEYEVENTF_UNICODE | dwFlagsFromKeyInfo(keyInfo), 0);
+}
+
+/**
+ * Sends a char using emulated keyboard input
+ * This works for most cases, but not for dead keys etc
+ **/
+void sendChar(TCHAR key, KBDLLHOOKSTRUCT keyInfo) {
+	if (composeLength && !(keyInfo.flags & LLKHF_UP) && composeChar(key, keyInfo))
+		return;
+	SHORT keyScanResult = keyScan(key);
+
+	if (keyScanResult == -1 || (modState & (STATE_SHIFT_LOCK | STATE_CAPS_LOCK | STATE_LEVEL4_LOCK))
+		|| (keyInfo.vkCode >= 0x30 && keyInfo.vkCode <= 0x39)) {
+		// key not found in the current keyboard layout or shift lock is active
+		//
+		// If shift lock is active, a unicode letter will be sent. This implies
+		// that shortcuts don't work in shift lock mode. That's good, because
+		// people might not be aware that they would send Ctrl-S instead of
+		// Ctrl-s. Sending a unicode letter makes it possible to undo shift
+		// lock temporarily by holding one shift key because that way the
+		// shift key won't be sent.
+		//
+		// Furthermore, use unicode for number keys.
+		sendUnicodeChar(key, keyInfo);
+	} else {
+		keyInfo.vkCode = keyScanResult & 0xff;
+		char modifiers = keyScanResult >> 8;
+		unsigned needed = 0;
+		if (modifiers & 1) needed |= INJECTED_SHIFT;
+		if ((modifiers & 6) == 6) needed |= INJECTED_ALTGR;
+		else if (modifiers & 2) needed |= INJECTED_ALT;
+		else if (modifiers & 4) needed |= INJECTED_CTRL;
+
+		// modifiers the user holds are down already (sent by handleShiftKey() and handleSystemKey())
+		if (modState & (STATE_SHIFT_LEFT | STATE_SHIFT_RIGHT)) needed &= ~INJECTED_SHIFT;
+		if (modState & (STATE_CTRL_LEFT | STATE_CTRL_RIGHT)) needed &= ~INJECTED_CTRL;
+		if (modState & STATE_ALT_LEFT) needed &= ~INJECTED_ALT;
+
+		setInjectedModifiers(needed);
+		appendOutput(keyInfo.vkCode, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo), keyInfo.dwExtraInfo);
+	}
+}
+
+/**
+ * Sends the prebuilt key events of a macro (key down)
+ **/
+void sendMacro(const Macro *macro, KBDLLHOOKSTRUCT keyInfo) {
+	if (keyInfo.scanCode == macroScanCode)
+		return;
+	macroScanCode = keyInfo.scanCode;
+	sendPendingDeadKeys();
+	if (injectedModifiers)
+		releaseInjectedModifiers();
+	if (outputLength + macro->outputCount > OUTPUT_BUFFER_SIZE)
+		flushOutput();
+	memcpy(outputBuffer + outputLength, &config->macroOutputs[macro->firstOutput], macro->outputCount * sizeof(KeyOutput));
+	outputLength += macro->outputCount;
+}
+
+bool handleSpecialCases(KBDLLHOOKSTRUCT keyInfo, unsigned level) {
+	if (keyInfo.scanCode >= LEN) {
+		// swallow left Ctrl if it was injected by AltGr
+		return level == 4 && keyInfo.scanCode == 541;
+	}
+
+	SpecialKey specialKey = config->specialKeys[level - 1][keyInfo.scanCode];
+	switch (specialKey.type) {
+		case SPECIAL_CHAR:
+			sendChar(specialKey.value, keyInfo);
+			return true;
+		case SPECIAL_UNICODE:
+			if (specialKey.value <= 0xffff) {
+				sendUnicodeChar(specialKey.value, keyInfo);
+			} else if (!(keyInfo.flags & LLKHF_UP)) {
+				// the key up is swallowed, the pair is complete already
+				sendPendingDeadKeys();
+				sendSurrogatePair(specialKey.value);
+			}
+			return true;
+		case SPECIAL_VK:
+			resetCompose();
+			// extended flag (bit 0) is necessary for selecting text with shift + arrow
+			sendKeyEvent(specialKey.value, specialKey.scanCode, dwFlagsFromKeyInfo(keyInfo) | KEYEVENTF_EXTENDEDKEY, 0);
+			return true;
+		case SPECIAL_MACRO:
+			if (!(keyInfo.flags & LLKHF_UP))
+				sendMacro(&config->macros[specialKey.value], keyInfo);
+			else if (keyInfo.scanCode == macroScanCode)
+				macroScanCode = 0;
+			return true;
+		default:
+			return false;
+	}
+}
+
+static inline uint64_t comboBit(DWORD scanCode) {
+	unsigned id = scanCode < LEN ? config->comboKeyId[scanCode] : 0;
+	return id ? (uint64_t)1 << (id - 1) : 0;
+}
+
+void sendCombo(const Combo *combo) {
+	KBDLLHOOKSTRUCT keyInfo = {0};
+	switch (combo->type) {
+		case COMBO_TEXT:
+			for (const TCHAR *c = combo->text; *c; c++) {
+				keyInfo.flags = 0;
+				sendChar(*c, keyInfo);
+				keyInfo.flags = LLKHF_UP;
+				sendChar(*c, keyInfo);
+			}
+			break;
+		case COMBO_KEY:
+			sendDownUp(combo->value, combo->scanCode & 0xff, combo->scanCode & 0x100);
+			break;
+		case COMBO_MODIFIER:
+			handleTapNextReleaseKey(combo->value, false);
+			activeComboModifier = combo->value;
+			break;
+	}
+}
+
+/**
+ * The held back combo keys are decided: sends the combo if they are one,
+ * otherwise the keys as usual
+ **/
+void resolveCombo() {
+	KBDLLHOOKSTRUCT keys[COMBO_MAX_KEYS];
+	int count = comboKeyCount;
+	uint64_t mask = comboKeyMask;
+	memcpy(keys, comboKeys, count * sizeof keys[0]);
+	comboKeyCount = 0;
+	comboKeyMask = 0;
+	comboSent = count > 0;
+
+	ComboEntry *entry = findComboEntry(config, mask);
+	if (count > 1 && entry->keys == mask && entry->combo >= 0) {
+		logKeyRecord(LOG_MAPPED, " combo", keys[0], FG_WHITE, entry->combo, count, 0);
+		sendCombo(&config->combos[entry->combo]);
+		activeComboMask = mask;
+		return;
+	}
+	passedComboKeys |= mask;
+	for (int i = 0; i < count; i++) {
+		// the key events were swallowed, so keys which are not mapped are sent as they are
+		if (handleMappedKeyEvent(keys[i], WM_KEYDOWN))
+			sendKeyEvent(keys[i].vkCode, keys[i].scanCode, dwFlagsFromKeyInfo(keys[i]), 0);
+	}
+}
+
+/**
+ * Holds back the keys of combos until they are decided.
+ * returns `true` if the event was handled
+ **/
+bool handleComboKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	uint64_t bit = comboBit(keyInfo.scanCode);
+	if (bit & activeComboMask) {
+		// keys of the combo sent last: swallow autorepeat and release
+		if (isKeyUp) {
+			activeComboMask &= ~bit;
+			if (activeComboModifier) {
+				handleTapNextReleaseKey(activeComboModifier, true);
+				activeComboModifier = MT_NONE;
+			}
+		}
+		return true;
+	}
+
+	if (comboKeyCount) {
+		if ((bit & comboKeyMask) && !isKeyUp)
+			return true; // autorepeat
+		uint64_t keys = comboKeyMask | bit;
+		ComboEntry *entry = findComboEntry(config, keys);
+		if (bit && !isKeyUp && entry->keys == keys
+				&& (int32_t)(keyInfo.time - comboKeys[0].time) < (int32_t)entry->term) {
+			comboKeys[comboKeyCount++] = keyInfo;
+			comboKeyMask = keys;
+			if (!entry->partial)
+				resolveCombo(); // no longer combo with these keys
+			return true;
+		}
+		// any other key event (or one too late) decides the held back keys first
+		resolveCombo();
+		if (bit & activeComboMask)
+			return handleComboKey(keyInfo, isKeyUp);
+	}
+
+	if (bit & passedComboKeys) {
+		// autorepeat and release of a key which was no combo
+		if (isKeyUp)
+			passedComboKeys &= ~bit;
+		return false;
+	}
+	if (bit && !isKeyUp) {
+		// maybe the first key of a combo
+		comboKeys[0] = keyInfo;
+		comboKeyCount = 1;
+		comboKeyMask = bit;
+		return true;
+	}
+	return false;
+}
+
+void handleComboTimeout(DWORD now) {
+	if (comboKeyCount && (int32_t)(now - comboKeys[0].time) >= (int32_t)findComboEntry(config, comboKeyMask)->term)
+		resolveCombo();
+	comboSent = false;
+}
+
+bool nextComboDeadline(DWORD *time) {
+	if (!comboKeyCount)
+		return false;
+	*time = comboKeys[0].time + findComboEntry(config, comboKeyMask)->term;
+	return true;
+}
+
+bool isShift(KBDLLHOOKSTRUCT keyInfo) {
+	return keyInfo.vkCode == VK_SHIFT
+	    || keyInfo.vkCode == VK_LSHIFT
+	    || keyInfo.vkCode == VK_RSHIFT;
+}
+
+bool isMod3(KBDLLHOOKSTRUCT keyInfo) {
+	return keyInfo.scanCode == config->scanCodeMod3L
+	    || keyInfo.scanCode == config->scanCodeMod3R;
+}
+
+bool isMod4(KBDLLHOOKSTRUCT keyInfo) {
+	return keyInfo.scanCode == config->scanCodeMod4L
+	    || keyInfo.vkCode == VK_RMENU;
+}
+
+bool isSystemKeyPressed() {
+	return modState & STATE_SYSTEM_KEYS;
+}
+
+static inline void setModifier(unsigned modifier, bool pressed) {
+	modState = pressed ? modState | modifier : modState & ~modifier;
+}
+
+void toggleShiftLock() {
+	modState ^= STATE_SHIFT_LOCK;
+	logMessage("Shift lock %s!\n", modState & STATE_SHIFT_LOCK ? "activated" : "deactivated");
+}
+
+void toggleCapsLock() {
+	modState ^= STATE_CAPS_LOCK;
+	logMessage("Caps lock %s!\n", modState & STATE_CAPS_LOCK ? "activated" : "deactivated");
+}
+
+void capsLockPressedInBypass() {
+	// synchronize with capsLock state during bypass
+	if (config->shiftLockEnabled) {
+		toggleShiftLock();
+	} else if (config->capsLockEnabled) {
+		toggleCapsLock();
+	}
+}
+
+void toggleLevel4Lock() {
+	modState ^= STATE_LEVEL4_LOCK;
+	logMessage("Level4 lock %s!\n", modState & STATE_LEVEL4_LOCK ? "activated" : "deactivated");
+}
+
+static inline unsigned getLevel() {
+	return config->levelTable[modState & LEVEL_MASK];
+}
+
+void handleShiftKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	unsigned pressedShift = keyInfo.vkCode == VK_RSHIFT ? STATE_SHIFT_RIGHT : STATE_SHIFT_LEFT;
+	unsigned otherShift = keyInfo.vkCode == VK_RSHIFT ? STATE_SHIFT_LEFT : STATE_SHIFT_RIGHT;
+
+	setModifier(STATE_SHIFT | pressedShift, !isKeyUp);
+
+	if (isKeyUp) {
+		if ((modState & otherShift) && !bypassMode) {
+			if (config->shiftLockEnabled) {
+				sendDownUp(VK_CAPITAL, 58, false);
+				toggleShiftLock();
+			} else if (config->capsLockEnabled) {
+				sendDownUp(VK_CAPITAL, 58, false);
+				toggleCapsLock();
+			}
+		}
+		sendUp(keyInfo.vkCode, keyInfo.scanCode, false);
+	} else { // key down
+		sendDown(keyInfo.vkCode, keyInfo.scanCode, false);
+	}
+}
+
+/**
+ * returns `true` if no systemKey was pressed -> continue execution, `false` otherwise
+ **/
+bool handleSystemKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	bool newStateValue = !isKeyUp;
+	DWORD dwFlags = isKeyUp ? KEYEVENTF_KEYUP : keyInfo.flags;
+
+	// Check also the scan code because AltGr sends VK_LCONTROL with scanCode 541
+	if (keyInfo.vkCode == VK_LCONTROL && keyInfo.scanCode == 29) {
+		if (config->swapLeftCtrlAndLeftAlt) {
+			setModifier(STATE_ALT_LEFT, newStateValue);
+			sendKeyEvent(VK_LMENU, 56, dwFlags, 0);
+		} else if (config->swapLeftCtrlLeftAltAndLeftWin) {
+			setModifier(STATE_WIN_LEFT, newStateValue);
+			sendKeyEvent(VK_LWIN, 91, dwFlags, 0);
+		} else {
+			setModifier(STATE_CTRL_LEFT, newStateValue);
+			sendKeyEvent(VK_LCONTROL, 29, dwFlags, 0);
+		}
+		return false;
+	} else if (keyInfo.vkCode == VK_RCONTROL) {
+		setModifier(STATE_CTRL_RIGHT, newStateValue);
+		sendKeyEvent(VK_RCONTROL, 29, dwFlags, 0);
+	} else if (keyInfo.vkCode == VK_LMENU) {
+		if (config->swapLeftCtrlAndLeftAlt || config->swapLeftCtrlLeftAltAndLeftWin) {
+			setModifier(STATE_CTRL_LEFT, newStateValue);
+			sendKeyEvent(VK_LCONTROL, 29, dwFlags, 0);
+		} else {
+			setModifier(STATE_ALT_LEFT, newStateValue);
+			sendKeyEvent(VK_LMENU, 56, dwFlags, 0);
+		}
+		return false;
+	} else if (keyInfo.vkCode == VK_LWIN) {
+		if (config->swapLeftCtrlLeftAltAndLeftWin) {
+			setModifier(STATE_ALT_LEFT, newStateValue);
+			sendKeyEvent(VK_LMENU, 56, dwFlags, 0);
+		} else {
+			setModifier(STATE_WIN_LEFT, newStateValue);
+			sendKeyEvent(VK_LWIN, 91, dwFlags, 0);
+		}
+		return false;
+	} else if (keyInfo.vkCode == VK_RWIN) {
+		setModifier(STATE_WIN_RIGHT, newStateValue);
+		sendKeyEvent(VK_RWIN, 92, dwFlags, 0);
+		return false;
+	}
+
+	return true;
+}
+
+void handleMod3Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	if (isKeyUp) {
+		if (keyInfo.scanCode == config->scanCodeMod3R) {
+			modState &= ~STATE_MOD3_RIGHT;
+			setModifier(STATE_MOD3, modState & STATE_MOD3_LEFT);
+			if (config->mod3RAsReturn && (modState & STATE_MOD3_RIGHT_ALONE)) {
+				sendUp(keyInfo.vkCode, keyInfo.scanCode, false); // release Mod3_R
+				sendDownUp(VK_RETURN, 28, true); // send Return
+				modState &= ~STATE_MOD3_RIGHT_ALONE;
+			}
+		} else { // scanCodeMod3L (CapsLock)
+			modState &= ~STATE_MOD3_LEFT;
+			setModifier(STATE_MOD3, modState & STATE_MOD3_RIGHT);
+			if (config->capsLockAsEscape && (modState & STATE_MOD3_LEFT_ALONE)) {
+				sendUp(VK_CAPITAL, 58, false); // release Mod3_R
+				sendDownUp(VK_ESCAPE, 1, true); // send Escape
+				modState &= ~STATE_MOD3_LEFT_ALONE;
+			}
+		}
+	} else { // keyDown
+		if (keyInfo.scanCode == config->scanCodeMod3R) {
+			modState |= STATE_MOD3_RIGHT;
+			if (config->mod3RAsReturn)
+				modState |= STATE_MOD3_RIGHT_ALONE;
+		} else { // VK_CAPITAL (CapsLock)
+			modState |= STATE_MOD3_LEFT;
+			if (config->capsLockAsEscape)
+				modState |= STATE_MOD3_LEFT_ALONE;
+		}
+		modState |= STATE_MOD3;
+	}
+}
+
+void handleMod4Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	if (isKeyUp) {
+		if (keyInfo.scanCode == config->scanCodeMod4L) {
+			modState &= ~STATE_MOD4_LEFT;
+			if ((modState & STATE_MOD4_RIGHT) && config->level4LockEnabled) {
+				toggleLevel4Lock();
+			} else if (config->mod4LAsTab && (modState & STATE_MOD4_LEFT_ALONE)) {
+				sendUp(keyInfo.vkCode, keyInfo.scanCode, false); // release Mod4_L
+				sendDownUp(VK_TAB, 15, true); // send Tab
+				modState &= ~STATE_MOD4_LEFT_ALONE;
+				setModifier(STATE_MOD4, modState & STATE_MOD4_RIGHT);
+				return;
+			}
+		} else { // scanCodeMod4R
+			modState &= ~STATE_MOD4_RIGHT;
+			if ((modState & STATE_MOD4_LEFT) && config->level4LockEnabled)
+				toggleLevel4Lock();
+		}
+		setModifier(STATE_MOD4, modState & (STATE_MOD4_LEFT | STATE_MOD4_RIGHT));
+	} else { // keyDown
+		if (keyInfo.scanCode == config->scanCodeMod4L) {
+			modState |= STATE_MOD4_LEFT;
+			if (config->mod4LAsTab)
+				setModifier(STATE_MOD4_LEFT_ALONE, !(modState & (STATE_MOD4_RIGHT | STATE_MOD3_LEFT | STATE_MOD3_RIGHT)));
+		} else { // scanCodeMod4R
+			modState |= STATE_MOD4_RIGHT;
+			/* ALTGR triggers two keys: LCONTROL and RMENU
+					we don't want to have any of those two here effective but return -1 seems
+					to change nothing, so we simply send keyup here.  */
+			sendUp(VK_RMENU, 56, false);
+		}
+		modState |= STATE_MOD4;
+	}
+}
+
+/**
+ * updates system key and layerLock states; writes key
+ * returns `true` if next hook should be called, `false` otherwise
+ **/
+bool updateStatesAndWriteKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	bool continueExecution = handleSystemKey(keyInfo, isKeyUp);
+	if (!continueExecution) return false;
+
+	unsigned level = getLevel();
+	keyStatsKey(level, keyInfo.scanCode, isKeyUp);
+
+	if (keyInfo.scanCode == deadKeyScanCode && isKeyUp)
+		deadKeyScanCode = 0;
+	if (keyInfo.scanCode == composedScanCode) {
+		composedScanCode = 0;
+		// the composed character was sent on key down, an autorepeat sends the key as usual
+		if (isKeyUp)
+			return false;
+	}
+
+	if (isMod3(keyInfo)) {
+		// if (keyQueueLength)
+		// 	return false;
+		handleMod3Key(keyInfo, isKeyUp);
+		return false;
+	} else if (isMod4(keyInfo)) {
+		// if (keyQueueLength)
+		// 	return false;
+		handleMod4Key(keyInfo, isKeyUp);
+		return false;
+	}
+	return writeKey(keyInfo, isKeyUp);
+}
+
+/**
+ * writes the key up of a key pressed with the level and system key bits `recorded`
+ * returns `true` if next hook should be called, `false` otherwise
+ **/
+bool writeKeyUpWithState(KBDLLHOOKSTRUCT keyInfo, unsigned recorded) {
+	unsigned current = modState & KEY_DOWN_STATE_BITS;
+	modState = (modState & ~KEY_DOWN_STATE_BITS) | (recorded & KEY_DOWN_STATE_BITS);
+	bool callNext = writeMappedKey(keyInfo, true, getLevel());
+	modState = (modState & ~KEY_DOWN_STATE_BITS) | current;
+	return callNext;
+}
+
+/**
+ * writes a key which is not Mod3 or Mod4, a key up with the state of its key down
+ * returns `true` if next hook should be called, `false` otherwise
+ **/
+bool writeKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	unsigned index = keyIndex(keyInfo);
+	if (index >= KEY_INDEX_SIZE)
+		return writeMappedKey(keyInfo, isKeyUp, getLevel());
+	unsigned recorded = keyDownState[index];
+	if (isKeyUp) {
+		keyDownState[index] = 0;
+		if (recorded & KEY_DOWN_RECORDED)
+			return writeKeyUpWithState(keyInfo, recorded);
+		return writeMappedKey(keyInfo, true, getLevel());
+	}
+
+	unsigned state = KEY_DOWN_RECORDED | (modState & KEY_DOWN_STATE_BITS);
+	if ((recorded & KEY_DOWN_RECORDED) && recorded != state) {
+		// autorepeat after a modifier was released: release what the key sent so far
+		KBDLLHOOKSTRUCT keyUp = keyInfo;
+		keyUp.flags |= LLKHF_UP;
+		if (writeKeyUpWithState(keyUp, recorded))
+			sendKeyEvent(keyUp.vkCode, keyUp.scanCode, dwFlagsFromKeyInfo(keyUp), 0);
+	}
+	keyDownState[index] = state;
+	return writeMappedKey(keyInfo, false, getLevel());
+}
+
+/**
+ * maps a key with `level` and the current `modState` and writes it
+ * returns `true` if next hook should be called, `false` otherwise
+ **/
+bool writeMappedKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp, unsigned level) {
+	if (keyInfo.scanCode < LEN && config->deadKeys[level - 1][keyInfo.scanCode] && !isSystemKeyPressed()) {
+		if (!isKeyUp)
+			pressDeadKey(config->deadKeys[level - 1][keyInfo.scanCode], keyInfo);
+		return false;
+	} else if ((keyInfo.flags & LLKHF_EXTENDED) && keyInfo.scanCode != 53) {
+		// handle numpad slash key (scanCode=53 + extended bit) later
+		return true;
+	} else if (handleSpecialCases(keyInfo, level)) {
+		return false;
+	} else if (level == 1 && keyInfo.vkCode >= 0x30 && keyInfo.vkCode <= 0x39) {
+		// numbers 0 to 9 -> don't remap, unless they go on with a compose sequence (♫ 1 2 → ½)
+		// (the dead keys of a sequence that does not go on are dropped, see handleMappedKeyEvent())
+		if (composeLength && !isKeyUp && composeStep(&config->compose, composeNode, keyInfo.vkCode) >= 0)
+			return !composeChar(keyInfo.vkCode, keyInfo);
+	} else if (!(config->qwertzForShortcuts && isSystemKeyPressed())) {
+		TCHAR key;
+		if ((keyInfo.flags & LLKHF_EXTENDED) && keyInfo.scanCode == 53) {
+			// slash key ("/") on numpad
+			key = config->numpadSlashKey[level-1];
+			keyInfo.flags = 0;
+		} else if (keyInfo.scanCode < LEN) {
+			// (caps lock is included in the row)
+			key = config->mappingTable[config->mappingRowTable[modState & LEVEL_MASK]][keyInfo.scanCode];
+		} else {
+			key = 0;
+		}
+		if (key != 0 && (keyInfo.flags & LLKHF_INJECTED) == 0) {
+			// if key must be mapped
+			logKeyRecord(LOG_MAPPED, " mapped", keyInfo, FG_WHITE, key, level, 0);
+			sendChar(key, keyInfo);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static inline bool isRepeat(KBDLLHOOKSTRUCT keyInfo) {
+	return repeatCache.valid
+		&& keyInfo.scanCode == repeatCache.scanCode
+		&& keyInfo.vkCode == repeatCache.vkCode
+		&& keyInfo.flags == repeatCache.flags
+		&& modState == repeatCache.modState
+		&& injectedModifiers == repeatCache.injectedModifiers
+		&& outputLength + repeatCache.outputCount <= OUTPUT_BUFFER_SIZE;
+}
+
+/**
+ * Keeps the output of a key down (written to the output buffer from `outputStart` on)
+ * for its repeats. Modifiers are never cached, their repeats may change the state,
+ * neither is a key which ended a compose sequence (its output has the dead keys).
+ **/
+void rememberRepeat(KBDLLHOOKSTRUCT keyInfo, unsigned stateBefore, unsigned injectedBefore, int composeBefore, int outputStart, bool callNext) {
+	int count = outputLength - outputStart;
+	repeatCache.valid = modState == stateBefore && injectedModifiers == injectedBefore
+		&& count >= 0 && count <= REPEAT_OUTPUT_SIZE
+		&& composeBefore == 0 && composeLength == 0 && keyInfo.scanCode != composedScanCode
+		&& !isMod3(keyInfo) && !isMod4(keyInfo)
+		&& keyInfo.vkCode != VK_LCONTROL && keyInfo.vkCode != VK_RCONTROL && keyInfo.vkCode != VK_LMENU
+		&& keyInfo.vkCode != VK_LWIN && keyInfo.vkCode != VK_RWIN;
+	if (!repeatCache.valid)
+		return;
+	repeatCache.scanCode = keyInfo.scanCode;
+	repeatCache.vkCode = keyInfo.vkCode;
+	repeatCache.flags = keyInfo.flags;
+	repeatCache.modState = modState;
+	repeatCache.injectedModifiers = injectedModifiers;
+	repeatCache.callNext = callNext;
+	repeatCache.outputCount = count;
+	memcpy(repeatCache.outputs, outputBuffer + outputStart, count * sizeof(KeyOutput));
+}
+
+/**
+ * Handles a key event received by the hook; mapped keys are written to the output buffer.
+ * returns `true` if next hook should be called, `false` otherwise
+ **/
+bool handleKeyEvent(KBDLLHOOKSTRUCT keyInfo, WPARAM wparam) {
+	takeNewConfig();
+
+	if (keyInfo.flags & LLKHF_INJECTED) {
+		// injected by another program (the platform layer does not pass our own events on)
+		if (!config->remapInjected || keyInfo.vkCode == VK_PACKET) {
+			logKeyEvent((keyInfo.flags & LLKHF_UP) ? "injected up" : "injected down", keyInfo, FG_YELLOW);
+			return true;
+		}
+		keyInfo.flags &= ~LLKHF_INJECTED; // remapped like a physical key
+	}
+
+	if (!bypassMode && (comboKeyCount || activeComboMask || comboBit(keyInfo.scanCode))) {
+		bool isKeyUp = (wparam == WM_KEYUP || wparam == WM_SYSKEYUP);
+		repeatCache.valid = false;
+		comboSent = false;
+		if (handleComboKey(keyInfo, isKeyUp))
+			return false;
+		if (comboSent) {
+			// passing the event on would overtake the output for the held back keys
+			comboSent = false;
+			if (handleMappedKeyEvent(keyInfo, wparam))
+				sendKeyEvent(keyInfo.vkCode, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo), 0);
+			return false;
+		}
+	}
+	return handleMappedKeyEvent(keyInfo, wparam);
+}
+
+/**
+ * Fast path for a key while a system key is held on level 1 (see buildShortcutLayer()),
+ * with the same result as the usual path
+ * returns 1 if next hook should be called, 0 if not and -1 if the key takes the usual path
+ **/
+int handleShortcutKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
+	unsigned index = keyIndex(keyInfo);
+	if (keyInfo.scanCode >= LEN || keyQueueLength || composeLength || composedScanCode
+			|| keyInfo.scanCode == deadKeyScanCode)
+		return -1;
+	uint8_t vk = config->shortcutVk[(keyInfo.flags & LLKHF_EXTENDED) ? 1 : 0][keyInfo.scanCode];
+	unsigned state = KEY_DOWN_RECORDED | (modState & KEY_DOWN_STATE_BITS);
+	// a key down with another state is released (or repeated) by the usual path
+	if (vk == SHORTCUT_NONE || (keyDownState[index] && keyDownState[index] != state))
+		return -1;
+	if (vk != SHORTCUT_PASS && config->keyScanCacheLayout != currentKeyboardLayout())
+		return -1; // keyScan() rebuilds the cache and the shortcut layer
+
+	logKeyEvent(isKeyUp ? "key up" : "key down", keyInfo, FG_CYAN);
+	uint64_t start = latencyNow();
+	keyStatsKey(1, keyInfo.scanCode, isKeyUp);
+	repeatCache.valid = false;
+	keyDownState[index] = isKeyUp ? 0 : state;
+	if (!isKeyUp)
+		modState &= ~(STATE_MOD3_LEFT_ALONE | STATE_MOD3_RIGHT_ALONE | STATE_MOD4_LEFT_ALONE);
+	if (injectedModifiers)
+		releaseInjectedModifiers();
+
+	int callNext = vk == SHORTCUT_PASS || (keyInfo.vkCode >= 0x30 && keyInfo.vkCode <= 0x39);
+	if (!callNext)
+		appendOutput(vk, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo), keyInfo.dwExtraInfo);
+	latencyRecord(PHASE_MAPPING, latencyNow() - start);
+	return callNext;
+}
+
+/**
+ * handleKeyEvent() for all events which are not held back for combos
+ **/
+bool handleMappedKeyEvent(KBDLLHOOKSTRUCT keyInfo, WPARAM wparam) {
+	bool isKeyUp = (wparam == WM_KEYUP || wparam == WM_SYSKEYUP);
+
+	// the tapping term of a ModTap key may have passed before the timer of the platform layer fired
+	if (keyQueueLength)
+		handleModTapTimeout(keyInfo.time);
+
+	if (isShift(keyInfo)) {
+		// if (keyQueueLength)
+		// 	return false;
+		handleShiftKey(keyInfo, isKeyUp);
+		return false;
+	}
+
+	// Shift + Pause
+	if (wparam == WM_KEYDOWN && keyInfo.vkCode == VK_PAUSE && (modState & STATE_SHIFT)) {
+		toggleBypassMode();
+		return false;
+	}
+
+	if (bypassMode) {
+		if (keyInfo.vkCode == VK_CAPITAL && !(keyInfo.flags & LLKHF_UP))
+			capsLockPressedInBypass();
+		return true;
+	}
+
+	if ((modState & STATE_SYSTEM_KEYS) && !(modState & LEVEL_MASK)) {
+		int callNext = handleShortcutKey(keyInfo, isKeyUp);
+		if (callNext >= 0)
+			return callNext;
+	}
+
+	if (isKeyUp) {
+		logKeyEvent("key up", keyInfo, FG_CYAN);
+		repeatCache.valid = false;
+
+		if (keyQueueLength) {
+			// int index;
+			uint64_t start = latencyNow();
+			bool keyReleasedHandled = checkQueue(keyInfo);
+			latencyRecord(PHASE_QUEUE, latencyNow() - start);
+			if (keyReleasedHandled)
+				return false;
+		}
+		uint64_t start = latencyNow();
+		bool callNext = updateStatesAndWriteKey(keyInfo, true);
+		latencyRecord(PHASE_MAPPING, latencyNow() - start);
+		if (!callNext) return false;
+
+	} else {  // key down
+		if (logEnabled)
+			logLevel(getLevel());
+
+		logKeyEvent("key down", keyInfo, FG_CYAN);
+
+		if (keyQueueLength || tapNextReleaseOf(keyInfo.scanCode)) {
+			repeatCache.valid = false;
+			uint64_t start = latencyNow();
+			appendToQueue(keyInfo);
+			latencyRecord(PHASE_QUEUE, latencyNow() - start);
+			return false;
+		}
+
+		modState &= ~(STATE_MOD3_LEFT_ALONE | STATE_MOD3_RIGHT_ALONE | STATE_MOD4_LEFT_ALONE);
+
+		uint64_t start = latencyNow();
+		bool callNext;
+		if (isRepeat(keyInfo)) {
+			memcpy(outputBuffer + outputLength, repeatCache.outputs, repeatCache.outputCount * sizeof(KeyOutput));
+			outputLength += repeatCache.outputCount;
+			callNext = repeatCache.callNext;
+		} else {
+			unsigned stateBefore = modState;
+			unsigned injectedBefore = injectedModifiers;
+			int composeBefore = composeLength;
+			int outputStart = outputLength;
+			unsigned index = keyIndex(keyInfo);
+			unsigned recorded = index < KEY_INDEX_SIZE ? keyDownState[index] : 0;
+			callNext = updateStatesAndWriteKey(keyInfo, false);
+			rememberRepeat(keyInfo, stateBefore, injectedBefore, composeBefore, outputStart, callNext);
+			// the output starts with the release of what the key sent with its old state
+			if ((recorded & KEY_DOWN_RECORDED) && recorded != (KEY_DOWN_RECORDED | (stateBefore & KEY_DOWN_STATE_BITS)))
+				repeatCache.valid = false;
+		}
+		latencyRecord(PHASE_MAPPING, latencyNow() - start);
+		if (!callNext) return false;
+	}
+
+	// the event reaches the system unchanged, not with the modifiers of the last character
+	if (injectedModifiers)
+		releaseInjectedModifiers();
+	// and cancels the dead keys
+	if (!isKeyUp)
+		resetCompose();
+	return true;
+}
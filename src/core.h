@@ -0,0 +1,275 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CORE_H
+#define _CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "keydefs.h"
+
+/**
+ * The remapping core: layout tables, modifier/lock state machine and the
+ * TapNextRelease (ModTap) queue. It does not call any Win32 function.
+ * Key events go in through handleKeyEvent(), the key events to emit are
+ * collected in outputBuffer. The platform layer (main.c on Windows, bench.c
+ * everywhere) feeds the events and provides the functions declared at the
+ * end of this file.
+ */
+
+#define LEN 103
+#define SCANCODE_TAB_KEY 15
+#define SCANCODE_CAPSLOCK_KEY 58
+#define SCANCODE_LOWER_THAN_KEY 86 // <
+#define SCANCODE_QUOTE_KEY 40      // Ä
+#define SCANCODE_HASH_KEY 43       // #
+#define SCANCODE_RETURN_KEY 28
+// #define SCANCODE_ANY_ALT_KEY 56        // Alt or AltGr
+
+enum modTapModifier {
+	MT_NONE,
+	MT_CTRL,
+	MT_SHIFT,
+	MT_MOD3,
+	MT_MOD4,
+	MT_ALT,
+	MT_WIN
+};
+
+/**
+ * Bits of the modifier and lock state (modState)
+ */
+enum stateBit {
+	// the lowest LEVEL_BITS bits select the level
+	STATE_SHIFT            = 1 << 0,  // state of the last shift key event
+	STATE_MOD3             = 1 << 1,  // any level 3 modifier pressed
+	STATE_MOD4             = 1 << 2,  // any level 4 modifier pressed
+	STATE_SHIFT_LOCK       = 1 << 3,
+	STATE_LEVEL4_LOCK      = 1 << 4,
+	STATE_CAPS_LOCK        = 1 << 5,
+	// modifier keys
+	STATE_SHIFT_LEFT       = 1 << 6,
+	STATE_SHIFT_RIGHT      = 1 << 7,
+	STATE_MOD3_LEFT        = 1 << 8,
+	STATE_MOD3_RIGHT       = 1 << 9,
+	STATE_MOD4_LEFT        = 1 << 10,
+	STATE_MOD4_RIGHT       = 1 << 11,
+	STATE_CTRL_LEFT        = 1 << 12,
+	STATE_CTRL_RIGHT       = 1 << 13,
+	STATE_ALT_LEFT         = 1 << 14,
+	STATE_WIN_LEFT         = 1 << 15,
+	STATE_WIN_RIGHT        = 1 << 16,
+	// modifier pressed and no other key since then (capsLockAsEscape, mod3RAsReturn, mod4LAsTab)
+	STATE_MOD3_LEFT_ALONE  = 1 << 17,
+	STATE_MOD3_RIGHT_ALONE = 1 << 18,
+	STATE_MOD4_LEFT_ALONE  = 1 << 19
+};
+#define LEVEL_BITS 6
+#define LEVEL_MASK ((1 << LEVEL_BITS) - 1)
+#define STATE_SYSTEM_KEYS (STATE_CTRL_LEFT | STATE_CTRL_RIGHT | STATE_ALT_LEFT | STATE_WIN_LEFT | STATE_WIN_RIGHT)
+#define STATE_MODIFIER_KEYS (STATE_SHIFT_LEFT | STATE_SHIFT_RIGHT | STATE_MOD3_LEFT | STATE_MOD3_RIGHT \
+	| STATE_MOD4_LEFT | STATE_MOD4_RIGHT | STATE_SYSTEM_KEYS)
+
+/**
+ * How a ModTap key decides between its letter (tap) and its modifier (hold).
+ * With a tapping term, a key held longer than that is always a hold.
+ */
+enum modTapStrategy {
+	MT_TAP_NEXT_RELEASE,  // hold if another key is pressed and released meanwhile, keys pressed later wait until they are released
+	MT_PERMISSIVE_HOLD,   // like MT_TAP_NEXT_RELEASE, but keys pressed after the decision are not held back
+	MT_HOLD_ON_OTHER_KEY, // hold as soon as another key is pressed
+	MT_TAPPING_TERM       // only the tapping term decides
+};
+#define MOD_TAP_DEFAULT_TERM 200 // ms, for MT_TAPPING_TERM without a tapping term
+
+typedef struct ModTap {
+	int modifier;
+	int keycode;
+	int tappingTerm; // ms, 0: none
+	int strategy;    // modTapStrategy
+} ModTap;
+#define MOD_TAP_LEN 256 // one entry per keycode, so every key can be a ModTap key
+
+/**
+ * Combos: keys pressed together (in any order, the later ones within the
+ * combo term after the first) send a text or a key or hold a modifier instead
+ * of their own characters.
+ */
+enum comboType {
+	COMBO_TEXT,
+	COMBO_KEY,      // virtual key
+	COMBO_MODIFIER  // modTapModifier, held until the first key of the combo is released
+};
+#define COMBO_MAX_KEYS 3
+#define COMBO_TEXT_LEN 32
+#define COMBO_DEFAULT_TERM 50 // ms
+
+typedef struct Combo {
+	char keys[COMBO_MAX_KEYS + 1]; // like the keycode of ModTap, zero terminated
+	int type;      // comboType
+	int value;     // virtual key or modifier
+	int scanCode;  // COMBO_KEY: scan code, 0x100 for extended keys
+	int term;      // ms
+	TCHAR text[COMBO_TEXT_LEN];
+} Combo;
+#define COMBO_LEN 256
+
+/**
+ * Settings, see settings.ini
+ * They have to be set before initLayout() or reloadConfig() is called and are
+ * only read by these functions, the hook thread uses a copy.
+ */
+extern char layout[100];
+extern TCHAR customLayoutWcs[33];
+extern const struct LayoutImage *layoutImage;
+extern bool quoteAsMod3R;
+extern bool returnAsMod3R;
+extern bool tabAsMod4L;
+extern DWORD scanCodeMod3L;
+extern DWORD scanCodeMod3R;
+extern DWORD scanCodeMod4L;
+extern bool capsLockEnabled;
+extern bool shiftLockEnabled;
+extern bool level4LockEnabled;
+extern bool qwertzForShortcuts;
+extern bool swapLeftCtrlAndLeftAlt;
+extern bool swapLeftCtrlLeftAltAndLeftWin;
+extern bool supportLevels5and6;
+extern bool capsLockAsEscape;
+extern bool mod3RAsReturn;
+extern bool mod4LAsTab;
+extern bool remapInjected;
+extern ModTap modTap[MOD_TAP_LEN];
+extern Combo combos[COMBO_LEN];
+extern char *MT_MODIFIER_STRING[7];
+
+/**
+ * State
+ */
+extern bool bypassMode;
+extern unsigned modState; // STATE_*
+extern int keyQueueLength;
+
+void initCharacterToScanCodeMap();
+void initLayout();
+
+/**
+ * Builds a new configuration from the settings on the calling thread (not the
+ * hook thread). handleKeyEvent() switches to it as soon as no modifier is held.
+ * Must not be called by two threads at the same time.
+ * With profiles, one configuration is built per profile: applyProfile() sets
+ * the settings of a profile before it is built, profile 0 (the default) comes
+ * last. Without (NULL), only profile 0 is built from the current settings.
+ **/
+#define PROFILE_COUNT 8
+void reloadConfig(int profileCount, void (*applyProfile)(int profile));
+
+/**
+ * Hook thread: switches to the configuration of another profile (0 if the
+ * profile does not exist), like reloadConfig() at the next key event without
+ * held modifiers. The cost of a key event does not depend on the profiles.
+ **/
+void selectProfile(int profile);
+
+/**
+ * Hook thread: the memory it touches for every key event, to lock it into the
+ * working set. hotConfigMemory() calls `range` for the active configuration
+ * with its combos and macro events, which changes whenever configChanges is
+ * counted up. hotStateMemory() calls it for the key queue, the key states
+ * and the output buffer.
+ **/
+extern unsigned configChanges;
+void hotConfigMemory(void (*range)(void *address, size_t size));
+void hotStateMemory(void (*range)(void *address, size_t size));
+void resetKeyQueue();
+
+/**
+ * Releases the modifiers the core has sent down and forgets all held keys and
+ * the queue (locks are kept). For key events that never reached the hook,
+ * e.g. after it was reinstalled. The key up events go to the output buffer.
+ **/
+void resetModifierState();
+void toggleBypassMode();
+
+/**
+ * Caps Lock was pressed during bypass mode (it reached the system unchanged):
+ * toggles shift lock or caps lock, so they stay in sync with the Caps Lock
+ * state of the system. If the platform layer does not pass the key events to
+ * handleKeyEvent() in bypass mode, it calls this when the state has changed.
+ **/
+void capsLockPressedInBypass();
+
+/**
+ * Rebuilds the cache for keyScan() (call it after initLayout()).
+ **/
+void updateKeyScanCache(void *keyboardLayout);
+
+/**
+ * ModTap keys with a tapping term are decided when it has passed (the time of
+ * key events, ms), combo keys when the combo term has passed. The platform
+ * layer should call handleModTapTimeout() at the time returned by
+ * nextModTapDeadline() (`false` if there is none) unless another key event
+ * comes first; the result is written to the output buffer.
+ **/
+void handleModTapTimeout(DWORD now);
+bool nextModTapDeadline(DWORD *time);
+
+/**
+ * Handles a key event received by the hook; mapped keys are written to the output buffer.
+ * returns `true` if the event should be passed on unchanged, `false` if it was swallowed
+ **/
+bool handleKeyEvent(KBDLLHOOKSTRUCT keyInfo, WPARAM wparam);
+
+/**
+ * Key events to emit (same fields as KEYBDINPUT), in order.
+ * The platform layer sends and clears them after each handleKeyEvent() call.
+ */
+typedef struct KeyOutput {
+	WORD vkCode;
+	WORD scanCode;
+	DWORD flags;
+	ULONG_PTR extraInfo;
+} KeyOutput;
+
+#define OUTPUT_BUFFER_SIZE 256 // a whole macro fits in (see initMacros)
+extern KeyOutput outputBuffer[OUTPUT_BUFFER_SIZE];
+extern int outputLength;
+
+/**
+ * Appends a keyboard event to the output buffer (same parameters as keybd_event)
+ **/
+void sendKeyEvent(WORD vkCode, WORD scanCode, DWORD dwFlags, ULONG_PTR dwExtraInfo);
+DWORD dwFlagsFromKeyInfo(KBDLLHOOKSTRUCT keyInfo);
+
+/**
+ * Shift, Ctrl, Alt and AltGr pressed for a mapped character stay down as long as
+ * the following characters need them (bitmask, 0 if none). The platform layer
+ * should release them after a short pause with releaseInjectedModifiers(),
+ * the key up events are written to the output buffer.
+ */
+extern unsigned injectedModifiers;
+void releaseInjectedModifiers();
+
+/**
+ * Provided by the platform layer
+ */
+void flushOutput();                                        // emit and clear outputBuffer
+void *currentKeyboardLayout();                             // GetKeyboardLayout(0)
+SHORT keyScanForLayout(TCHAR key, void *keyboardLayout);   // VkKeyScanEx
+uint64_t latencyNow();                                     // time source for latency.h
+void bypassModeChanged();                                  // e.g. update the tray icon
+
+#endif
@@ -0,0 +1,66 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core.h"
+#include "hostplatform.h"
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+/**
+ * Platform layer for the remapping core (see core.h)
+ **/
+uint64_t latencyNow() {
+#ifdef _WIN32
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+uint64_t latencyFrequency() {
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return frequency.QuadPart;
+#else
+	return 1000000000;
+#endif
+}
+
+void *currentKeyboardLayout() {
+	return NULL;
+}
+
+/**
+ * Like VkKeyScanEx with a US layout for letters and digits,
+ * everything else is sent as unicode character.
+ **/
+SHORT keyScanForLayout(TCHAR key, void *keyboardLayout) {
+	if (key >= L'a' && key <= L'z')
+		return key - L'a' + 'A';
+	if (key >= L'A' && key <= L'Z')
+		return 0x100 | key;
+	if (key >= L'0' && key <= L'9')
+		return key;
+	return -1;
+}
+
+void bypassModeChanged() {
+}
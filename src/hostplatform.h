@@ -0,0 +1,31 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOSTPLATFORM_H
+#define _HOSTPLATFORM_H
+
+#include <stdint.h>
+
+/**
+ * Platform layer of the core for the programs built with the host compiler
+ * (bench.c, stress.c, see hostplatform.c). They only add flushOutput().
+ */
+
+/**
+ * returns the ticks of latencyNow() per second
+ */
+uint64_t latencyFrequency();
+
+#endif
@@ -0,0 +1,52 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "injection.h"
+
+KeyOutput injectionQueue[INJECTION_QUEUE_SIZE];
+unsigned injectionHead = 0;    // next event to write, only modified by the producer
+unsigned injectionTail = 0;    // next event to read, only modified by the consumer
+unsigned injectionUnsent = 0;  // pushed but not sent yet
+
+bool injectionPush(const KeyOutput *outputs, int count, bool useReserve) {
+	unsigned tail = __atomic_load_n(&injectionTail, __ATOMIC_ACQUIRE);
+	unsigned size = useReserve ? INJECTION_QUEUE_SIZE : INJECTION_QUEUE_SIZE - INJECTION_KEY_UP_RESERVE;
+	if (injectionHead - tail + count > size)
+		return false;
+	for (int i = 0; i < count; i++)
+		injectionQueue[(injectionHead + i) & (INJECTION_QUEUE_SIZE - 1)] = outputs[i];
+	__atomic_add_fetch(&injectionUnsent, count, __ATOMIC_RELAXED);
+	__atomic_store_n(&injectionHead, injectionHead + count, __ATOMIC_RELEASE);
+	return true;
+}
+
+int injectionPop(KeyOutput *outputs, int max) {
+	unsigned head = __atomic_load_n(&injectionHead, __ATOMIC_ACQUIRE);
+	int count = 0;
+	while (injectionTail + count != head && count < max) {
+		outputs[count] = injectionQueue[(injectionTail + count) & (INJECTION_QUEUE_SIZE - 1)];
+		count++;
+	}
+	__atomic_store_n(&injectionTail, injectionTail + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+void injectionSent(int count) {
+	__atomic_sub_fetch(&injectionUnsent, count, __ATOMIC_RELEASE);
+}
+
+bool injectionPending() {
+	return __atomic_load_n(&injectionUnsent, __ATOMIC_ACQUIRE) != 0;
+}
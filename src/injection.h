@@ -0,0 +1,56 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _INJECTION_H
+#define _INJECTION_H
+
+#include <stdbool.h>
+#include "core.h"
+
+/**
+ * Injection queue for the pipelined mode (setting injectionThread).
+ * The hook thread pushes the output of each key event into a
+ * single-producer single-consumer ring buffer, an injector thread sends the
+ * queued events in order. Events count as pending until they have been sent,
+ * so the hook can tell whether passing an event on would overtake them.
+ */
+#define INJECTION_QUEUE_SIZE 1024 // must be a power of two
+#define INJECTION_KEY_UP_RESERVE 256 // only for the key ups of events which did not fit
+
+/**
+ * Producer side (hook thread only): appends all events or none of them.
+ * Without `useReserve`, INJECTION_KEY_UP_RESERVE places stay free.
+ * returns `false` if there is not enough space
+ */
+bool injectionPush(const KeyOutput *outputs, int count, bool useReserve);
+
+/**
+ * Consumer side (injector thread only): takes up to max events out of the queue.
+ * They stay pending until injectionSent() is called.
+ * returns the number of events
+ */
+int injectionPop(KeyOutput *outputs, int max);
+
+/**
+ * Consumer side: count events have been sent
+ */
+void injectionSent(int count);
+
+/**
+ * True if events have been pushed but not sent yet
+ */
+bool injectionPending();
+
+#endif
@@ -0,0 +1,84 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "keystats.h"
+
+const char *KEYSTATS_DECISION_NAMES[KEYSTATS_DECISION_COUNT] = {
+	"tap", "hold other key", "hold next release", "hold timeout", "delayed release", "queue full"
+};
+
+bool keyStatsEnabled = false;
+
+uint32_t keyCounts[KEYSTATS_LEVELS][LEN];
+uint32_t modTapRolls[LEN][LEN];
+uint32_t decisionCounts[KEYSTATS_DECISION_COUNT];
+bool keyDown[LEN]; // hook thread only, to skip the autorepeat
+
+// single writer: a relaxed load and store is enough and compiles to a plain increment
+#define INCREMENT(var) __atomic_store_n(&(var), (var) + 1, __ATOMIC_RELAXED)
+#define LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+void keyStatsKey(unsigned level, unsigned scanCode, bool isKeyUp) {
+	if (!keyStatsEnabled || scanCode >= LEN)
+		return;
+	if (isKeyUp) {
+		keyDown[scanCode] = false;
+	} else if (!keyDown[scanCode] && level >= 1 && level <= KEYSTATS_LEVELS) {
+		keyDown[scanCode] = true;
+		INCREMENT(keyCounts[level - 1][scanCode]);
+	}
+}
+
+void keyStatsModTapRoll(unsigned modTapScanCode, unsigned scanCode) {
+	if (keyStatsEnabled && modTapScanCode < LEN && scanCode < LEN)
+		INCREMENT(modTapRolls[modTapScanCode][scanCode]);
+}
+
+void keyStatsDecision(enum keyStatsDecision decision) {
+	if (keyStatsEnabled)
+		INCREMENT(decisionCounts[decision]);
+}
+
+bool keyStatsWriteCsv(const char *filename) {
+	FILE *file = fopen(filename, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "level,scancode,keystrokes\n");
+	for (int level = 0; level < KEYSTATS_LEVELS; level++) {
+		for (int scanCode = 0; scanCode < LEN; scanCode++) {
+			uint32_t count = LOAD(keyCounts[level][scanCode]);
+			if (count)
+				fprintf(file, "%d,%d,%u\n", level + 1, scanCode, count);
+		}
+	}
+
+	fprintf(file, "\nmodtap_scancode,next_scancode,rolls\n");
+	for (int modTap = 0; modTap < LEN; modTap++) {
+		for (int scanCode = 0; scanCode < LEN; scanCode++) {
+			uint32_t count = LOAD(modTapRolls[modTap][scanCode]);
+			if (count)
+				fprintf(file, "%d,%d,%u\n", modTap, scanCode, count);
+		}
+	}
+
+	fprintf(file, "\nmodtap_decision,count\n");
+	for (int decision = 0; decision < KEYSTATS_DECISION_COUNT; decision++)
+		fprintf(file, "%s,%u\n", KEYSTATS_DECISION_NAMES[decision], LOAD(decisionCounts[decision]));
+
+	fclose(file);
+	return true;
+}
@@ -0,0 +1,73 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _KEYSTATS_H
+#define _KEYSTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+
+/**
+ * Opt-in keystroke statistics for tuning layouts (setting keyStats).
+ * Only the hook thread counts, with plain increments into fixed arrays;
+ * any other thread may write them to a file at any time (a count may be
+ * off by the event that is being counted at that moment).
+ */
+#define KEYSTATS_LEVELS 6
+
+/**
+ * How the ModTap queue (see checkQueue()) decided a key
+ */
+enum keyStatsDecision {
+	KEYSTATS_TAP,               // ModTap key released before it was decided: its character
+	KEYSTATS_HOLD_OTHER_KEY,    // became a modifier when another key was pressed (MT_HOLD_ON_OTHER_KEY)
+	KEYSTATS_HOLD_NEXT_RELEASE, // became a modifier when a key pressed later was released
+	KEYSTATS_HOLD_TIMEOUT,      // became a modifier after its tapping term
+	KEYSTATS_DELAYED_RELEASE,   // key released while a ModTap key pressed earlier was not decided yet
+	KEYSTATS_QUEUE_FULL,        // key dropped, more keys held than the queue can hold
+	KEYSTATS_DECISION_COUNT
+};
+
+/**
+ * True if the hook thread counts (set on start)
+ */
+extern bool keyStatsEnabled;
+
+/**
+ * Hook thread only: a key is pressed (counted once, not its autorepeat) or released.
+ * level is 1 to 6.
+ */
+void keyStatsKey(unsigned level, unsigned scanCode, bool isKeyUp);
+
+/**
+ * Hook thread only: a key is pressed while a ModTap key is held (a roll)
+ */
+void keyStatsModTapRoll(unsigned modTapScanCode, unsigned scanCode);
+
+/**
+ * Hook thread only
+ */
+void keyStatsDecision(enum keyStatsDecision decision);
+
+/**
+ * Writes all counters which are not zero as CSV.
+ * returns `false` if the file could not be opened
+ */
+bool keyStatsWriteCsv(const char *filename);
+
+extern const char *KEYSTATS_DECISION_NAMES[KEYSTATS_DECISION_COUNT];
+
+#endif
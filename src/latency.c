@@ -0,0 +1,178 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "latency.h"
+
+const char *LATENCY_PHASE_NAMES[PHASE_COUNT] = {"total", "queue", "mapping", "injection"};
+const char *REINSTALL_REASON_NAMES[REINSTALL_REASON_COUNT] = {"probe lost", "retry"};
+
+typedef struct Histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint32_t buckets[LATENCY_BUCKETS];
+} Histogram;
+
+Histogram histograms[PHASE_COUNT];
+uint64_t ticksPerSecond = 1000000000;
+
+typedef struct ReinstallCounters {
+	uint32_t reinstalls;
+	uint32_t failures;
+} ReinstallCounters;
+
+ReinstallCounters reinstallCounters[REINSTALL_REASON_COUNT];
+uint32_t droppedEvents;  // the injection queue was full (see queueInjection() in main.c)
+
+// single writer: a relaxed load and store is enough and compiles to a plain increment
+#define STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELAXED)
+#define LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+void latencySetFrequency(uint64_t frequency) {
+	ticksPerSecond = frequency;
+}
+
+unsigned bucketIndex(uint64_t ns) {
+	if (ns < LATENCY_SUB_BUCKETS)
+		return ns;
+	unsigned log2 = 63 - __builtin_clzll(ns);
+	unsigned sub = (ns >> (log2 - 2)) & (LATENCY_SUB_BUCKETS - 1);
+	unsigned index = (log2 - 1) * LATENCY_SUB_BUCKETS + sub;
+	return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+uint64_t bucketLowerBound(unsigned index) {
+	if (index < LATENCY_SUB_BUCKETS)
+		return index;
+	unsigned log2 = index / LATENCY_SUB_BUCKETS + 1;
+	unsigned sub = index % LATENCY_SUB_BUCKETS;
+	return (uint64_t)(LATENCY_SUB_BUCKETS + sub) << (log2 - 2);
+}
+
+uint64_t bucketUpperBound(unsigned index) {
+	return bucketLowerBound(index + 1) - 1;
+}
+
+void latencyRecord(enum latencyPhase phase, uint64_t ticks) {
+	Histogram *h = &histograms[phase];
+	uint64_t ns = ticksPerSecond == 1000000000 ? ticks : ticks * 1000000000 / ticksPerSecond;
+
+	if (h->count == 0 || ns < h->min)
+		STORE(h->min, ns);
+	if (ns > h->max)
+		STORE(h->max, ns);
+	STORE(h->sum, h->sum + ns);
+	unsigned index = bucketIndex(ns);
+	STORE(h->buckets[index], h->buckets[index] + 1);
+	// count last: a reader never sees more events than bucket entries
+	__atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELEASE);
+}
+
+void latencyRecordHookReinstall(enum hookReinstallReason reason, bool installed) {
+	ReinstallCounters *c = &reinstallCounters[reason];
+	STORE(c->reinstalls, c->reinstalls + 1);
+	if (!installed)
+		STORE(c->failures, c->failures + 1);
+}
+
+void latencyRecordDroppedEvents(unsigned count) {
+	STORE(droppedEvents, droppedEvents + count);
+}
+
+uint64_t percentile(Histogram *h, uint64_t count, uint64_t max, unsigned permille) {
+	uint64_t rank = (count * permille + 999) / 1000;
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += LOAD(h->buckets[i]);
+		if (seen >= rank) {
+			uint64_t upper = bucketUpperBound(i);
+			return upper < max ? upper : max;
+		}
+	}
+	return max;
+}
+
+void latencySummary(enum latencyPhase phase, LatencySummary *summary) {
+	Histogram *h = &histograms[phase];
+	summary->count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+	if (summary->count == 0) {
+		*summary = (LatencySummary){0};
+		return;
+	}
+	summary->min = LOAD(h->min);
+	summary->max = LOAD(h->max);
+	summary->mean = LOAD(h->sum) / summary->count;
+	summary->p50 = percentile(h, summary->count, summary->max, 500);
+	summary->p90 = percentile(h, summary->count, summary->max, 900);
+	summary->p99 = percentile(h, summary->count, summary->max, 990);
+	summary->p999 = percentile(h, summary->count, summary->max, 999);
+}
+
+void latencyFormatSummary(char *buffer, size_t size) {
+	size_t pos = 0;
+	pos += snprintf(buffer, size, "%-10s %9s %8s %8s %8s %8s %8s %9s (in µs)\n",
+		"phase", "events", "min", "median", "p90", "p99", "p99.9", "max");
+	for (int phase = 0; phase < PHASE_COUNT && pos < size; phase++) {
+		LatencySummary s;
+		latencySummary(phase, &s);
+		pos += snprintf(buffer + pos, size - pos, "%-10s %9llu %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f\n",
+			LATENCY_PHASE_NAMES[phase], (unsigned long long)s.count,
+			s.min / 1000.0, s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0, s.p999 / 1000.0, s.max / 1000.0);
+	}
+	for (int reason = 0; reason < REINSTALL_REASON_COUNT && pos < size; reason++) {
+		pos += snprintf(buffer + pos, size - pos, "hook reinstalls (%s): %u, failed: %u\n", REINSTALL_REASON_NAMES[reason],
+			LOAD(reinstallCounters[reason].reinstalls), LOAD(reinstallCounters[reason].failures));
+	}
+	if (pos < size)
+		snprintf(buffer + pos, size - pos, "events dropped (injection queue full): %u\n", LOAD(droppedEvents));
+}
+
+bool latencyWriteCsv(const char *filename) {
+	FILE *file = fopen(filename, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "phase,events,min_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		LatencySummary s;
+		latencySummary(phase, &s);
+		fprintf(file, "%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", LATENCY_PHASE_NAMES[phase],
+			(unsigned long long)s.count, (unsigned long long)s.min, (unsigned long long)s.mean,
+			(unsigned long long)s.p50, (unsigned long long)s.p90, (unsigned long long)s.p99,
+			(unsigned long long)s.p999, (unsigned long long)s.max);
+	}
+
+	fprintf(file, "\nphase,from_ns,to_ns,events\n");
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+			uint32_t count = LOAD(histograms[phase].buckets[i]);
+			if (count)
+				fprintf(file, "%s,%llu,%llu,%u\n", LATENCY_PHASE_NAMES[phase],
+					(unsigned long long)bucketLowerBound(i), (unsigned long long)bucketUpperBound(i), count);
+		}
+	}
+
+	fprintf(file, "\nreinstall_reason,reinstalls,failed\n");
+	for (int reason = 0; reason < REINSTALL_REASON_COUNT; reason++)
+		fprintf(file, "%s,%u,%u\n", REINSTALL_REASON_NAMES[reason],
+			LOAD(reinstallCounters[reason].reinstalls), LOAD(reinstallCounters[reason].failures));
+
+	fprintf(file, "\ndropped_events\n%u\n", LOAD(droppedEvents));
+
+	fclose(file);
+	return true;
+}
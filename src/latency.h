@@ -0,0 +1,97 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Latency histograms for the phases of the keyboard hook callback.
+ * Only the hook thread records values, any other thread may read them
+ * at any time (without locking, a summary may be off by the event that
+ * is being recorded at that moment).
+ */
+enum latencyPhase {
+	PHASE_TOTAL,     // whole hook callback
+	PHASE_QUEUE,     // appendToQueue / checkQueue (including keys they release)
+	PHASE_MAPPING,   // updateStatesAndWriteKey
+	PHASE_INJECTION, // SendInput
+	PHASE_COUNT
+};
+
+// log-linear buckets: four buckets per power of two, up to 2^48 ns
+#define LATENCY_SUB_BUCKETS 4
+#define LATENCY_BUCKETS (48 * LATENCY_SUB_BUCKETS)
+
+typedef struct LatencySummary {
+	uint64_t count;
+	uint64_t min;  // all values in nanoseconds
+	uint64_t max;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+} LatencySummary;
+
+/**
+ * Why the watchdog in main.c reinstalled the keyboard hook
+ */
+enum hookReinstallReason {
+	REINSTALL_PROBE_LOST,     // input arrived, but a probe event injected afterwards never reached the hook
+	REINSTALL_RETRY,          // the previous SetWindowsHookEx call failed
+	REINSTALL_REASON_COUNT
+};
+
+/**
+ * Ticks per second of the time source passed to latencyRecord
+ */
+void latencySetFrequency(uint64_t ticksPerSecond);
+
+/**
+ * Hook thread only: add a measured duration
+ */
+void latencyRecord(enum latencyPhase phase, uint64_t ticks);
+
+void latencySummary(enum latencyPhase phase, LatencySummary *summary);
+
+/**
+ * Hook thread only: count a reinstallation of the hook (`installed` is `false` if it failed)
+ */
+void latencyRecordHookReinstall(enum hookReinstallReason reason, bool installed);
+
+/**
+ * Hook thread only: count key events dropped because the injection queue was full
+ */
+void latencyRecordDroppedEvents(unsigned count);
+
+/**
+ * Writes a human readable summary of all phases, the hook reinstallations and dropped events into `buffer`
+ */
+void latencyFormatSummary(char *buffer, size_t size);
+
+/**
+ * Writes summaries and histograms of all phases as CSV.
+ * returns `false` if the file could not be opened
+ */
+bool latencyWriteCsv(const char *filename);
+
+extern const char *LATENCY_PHASE_NAMES[PHASE_COUNT];
+extern const char *REINSTALL_REASON_NAMES[REINSTALL_REASON_COUNT];
+
+#endif
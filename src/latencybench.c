@@ -0,0 +1,321 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Measures the latency of neo-llkh from end to end: scan codes are injected
+ * with SendInput, pass the keyboard hook like key presses (neo-llkh needs
+ * remapInjected=1, e.g. in a profile for this program) and the time until the
+ * WM_CHAR or WM_KEYDOWN of the result arrives at the window procedure of the
+ * own window is measured. Run it once with and once without neo-llkh:
+ *
+ *   neo-llkh-latencybench.exe save=baseline.csv       (neo-llkh not running)
+ *   neo-llkh-latencybench.exe compare=baseline.csv [modTap=j] [rounds=200]
+ *
+ * The scan codes are those of the Neo2 layout (see cases[]).
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+
+#define DEFAULT_ROUNDS 200
+#define RESPONSE_TIMEOUT 500 // ms until a key counts as lost
+#define SETTLE_TIME 15       // ms for modifiers and key releases to arrive
+#define MAX_CASE_NAME 32
+
+enum expectedMessage {
+	EXPECT_CHAR,   // WM_CHAR
+	EXPECT_KEYDOWN // WM_KEYDOWN of a key which is not a modifier
+};
+
+/**
+ * A path through the core: the modifier is held while the key is tapped
+ **/
+typedef struct LatencyCase {
+	const char *name;
+	WORD modifier; // scan code, 0: none
+	WORD scanCode; // 0: not measured
+	enum expectedMessage expected;
+	double *latencies; // µs
+	int count;
+	int lost;
+} LatencyCase;
+
+static LatencyCase cases[] = {
+	{"level 1",            0,                       18, EXPECT_CHAR},    // l
+	{"sendChar Shift",     SCANCODE_CAPSLOCK_KEY,   21, EXPECT_CHAR},    // ! (Shift+1)
+	{"sendChar AltGr",     SCANCODE_CAPSLOCK_KEY,   18, EXPECT_CHAR},    // [ (AltGr+8)
+	{"sendUnicodeChar",    SCANCODE_CAPSLOCK_KEY,   20, EXPECT_CHAR},    // ^ (SPECIAL_UNICODE of all layouts)
+	{"level 4 navigation", SCANCODE_LOWER_THAN_KEY, 31, EXPECT_KEYDOWN}, // left arrow
+	{"ModTap tap",         0,                       0,  EXPECT_CHAR},    // modTap=<key>
+};
+#define CASE_COUNT (sizeof cases / sizeof cases[0])
+#define MODTAP_CASE (CASE_COUNT - 1)
+
+LARGE_INTEGER frequency;
+bool waiting = false;
+enum expectedMessage waitingFor;
+LARGE_INTEGER received;
+
+bool isModifierVk(WPARAM vk) {
+	switch (vk) {
+		case VK_SHIFT: case VK_CONTROL: case VK_MENU: case VK_CAPITAL: case VK_PACKET:
+		case VK_LSHIFT: case VK_RSHIFT: case VK_LCONTROL: case VK_RCONTROL: case VK_LMENU: case VK_RMENU:
+			return true;
+		default:
+			return false;
+	}
+}
+
+LRESULT CALLBACK windowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+	switch (message) {
+		case WM_CHAR:
+			if (waiting && waitingFor == EXPECT_CHAR) {
+				QueryPerformanceCounter(&received);
+				waiting = false;
+			}
+			return 0;
+		case WM_KEYDOWN:
+		case WM_SYSKEYDOWN:
+			if (waiting && waitingFor == EXPECT_KEYDOWN && !isModifierVk(wParam)) {
+				QueryPerformanceCounter(&received);
+				waiting = false;
+			}
+			return 0;
+		case WM_SYSCHAR:
+			return 0; // no menu beep for AltGr characters
+		case WM_DESTROY:
+			PostQuitMessage(0);
+			return 0;
+	}
+	return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+/**
+ * Dispatches messages for `ms` milliseconds, with `untilResponse` only until the awaited message arrived
+ **/
+void pumpMessages(DWORD ms, bool untilResponse) {
+	DWORD start = GetTickCount();
+	for (;;) {
+		MSG msg;
+		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
+		if (untilResponse && !waiting)
+			return;
+		DWORD elapsed = GetTickCount() - start;
+		if (elapsed >= ms)
+			return;
+		MsgWaitForMultipleObjects(0, NULL, FALSE, ms - elapsed, QS_ALLINPUT);
+	}
+}
+
+void setScanCodeInput(INPUT *input, WORD scanCode, bool isKeyUp) {
+	memset(input, 0, sizeof *input);
+	input->type = INPUT_KEYBOARD;
+	input->ki.wScan = scanCode;
+	input->ki.dwFlags = KEYEVENTF_SCANCODE | (isKeyUp ? KEYEVENTF_KEYUP : 0);
+}
+
+void sendScanCode(WORD scanCode, bool isKeyUp) {
+	INPUT input;
+	setScanCodeInput(&input, scanCode, isKeyUp);
+	SendInput(1, &input, sizeof input);
+}
+
+/**
+ * Taps the key of a case (with its modifier held) and records the time until the response
+ **/
+void measure(LatencyCase *c) {
+	if (c->modifier) {
+		sendScanCode(c->modifier, false);
+		pumpMessages(SETTLE_TIME, false);
+	}
+
+	INPUT tap[2];
+	setScanCodeInput(&tap[0], c->scanCode, false);
+	setScanCodeInput(&tap[1], c->scanCode, true);
+	waitingFor = c->expected;
+	waiting = true;
+	LARGE_INTEGER sent;
+	QueryPerformanceCounter(&sent);
+	SendInput(2, tap, sizeof tap[0]);
+	pumpMessages(RESPONSE_TIMEOUT, true);
+	if (waiting) {
+		waiting = false;
+		c->lost++;
+	} else {
+		c->latencies[c->count++] = (double)(received.QuadPart - sent.QuadPart) * 1e6 / frequency.QuadPart;
+	}
+
+	if (c->modifier)
+		sendScanCode(c->modifier, true);
+	pumpMessages(SETTLE_TIME, false);
+}
+
+int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+double percentile(const LatencyCase *c, int percent) {
+	int index = (c->count * percent + 99) / 100 - 1;
+	return c->latencies[index < 0 ? 0 : index];
+}
+
+/**
+ * Reads the p50 values of an earlier run (written with save=) into `baseline`
+ **/
+bool readBaseline(const char *filename, double baseline[CASE_COUNT]) {
+	FILE *file = fopen(filename, "r");
+	if (!file)
+		return false;
+	for (int i = 0; i < CASE_COUNT; i++)
+		baseline[i] = -1;
+	char line[128];
+	while (fgets(line, sizeof line, file)) {
+		char name[MAX_CASE_NAME];
+		double p50;
+		if (sscanf(line, "%31[^;];%lf", name, &p50) != 2)
+			continue;
+		for (int i = 0; i < CASE_COUNT; i++) {
+			if (strcmp(cases[i].name, name) == 0)
+				baseline[i] = p50;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+bool writeResults(const char *filename) {
+	FILE *file = fopen(filename, "w");
+	if (!file)
+		return false;
+	fprintf(file, "case;p50;p90;p99;max;lost\n");
+	for (int i = 0; i < CASE_COUNT; i++) {
+		const LatencyCase *c = &cases[i];
+		if (c->count)
+			fprintf(file, "%s;%.1f;%.1f;%.1f;%.1f;%d\n", c->name, percentile(c, 50), percentile(c, 90),
+				percentile(c, 99), c->latencies[c->count - 1], c->lost);
+	}
+	fclose(file);
+	return true;
+}
+
+void printResults(const double *baseline) {
+	printf("\n%-20s %7s %9s %9s %9s %9s %6s%s\n", "case", "n", "p50 us", "p90 us", "p99 us", "max us", "lost",
+		baseline ? "   p50 vs. baseline" : "");
+	for (int i = 0; i < CASE_COUNT; i++) {
+		const LatencyCase *c = &cases[i];
+		if (!c->scanCode) {
+			printf("%-20s not measured (modTap=<key>)\n", c->name);
+			continue;
+		}
+		if (!c->count) {
+			printf("%-20s %7d no response\n", c->name, 0);
+			continue;
+		}
+		printf("%-20s %7d %9.1f %9.1f %9.1f %9.1f %6d", c->name, c->count, percentile(c, 50),
+			percentile(c, 90), percentile(c, 99), c->latencies[c->count - 1], c->lost);
+		if (baseline && baseline[i] >= 0)
+			printf("   %+9.1f", percentile(c, 50) - baseline[i]);
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int rounds = DEFAULT_ROUNDS;
+	char *saveFile = NULL;
+	double baseline[CASE_COUNT];
+	bool hasBaseline = false;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "rounds=", 7) == 0) {
+			rounds = atoi(argv[i] + 7);
+		} else if (strncmp(argv[i], "save=", 5) == 0) {
+			saveFile = argv[i] + 5;
+		} else if (strncmp(argv[i], "compare=", 8) == 0) {
+			hasBaseline = readBaseline(argv[i] + 8, baseline);
+			if (!hasBaseline) {
+				printf("Cannot read %s\n", argv[i] + 8);
+				return 1;
+			}
+		} else if (strncmp(argv[i], "modTap=", 7) == 0 && argv[i][7]) {
+			// ModTap keys are given by their QWERTZ position, like in settings.ini
+			SHORT vk = VkKeyScanEx(argv[i][7], GetKeyboardLayout(0));
+			cases[MODTAP_CASE].scanCode = vk == -1 ? 0 : MapVirtualKeyA(vk & 0xff, MAPVK_VK_TO_VSC);
+		} else {
+			printf("Unknown parameter %s\n", argv[i]);
+			printf("Usage: %s [rounds=<n>] [modTap=<key>] [save=<file.csv>] [compare=<file.csv>]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (rounds < 1)
+		rounds = 1;
+
+	for (int i = 0; i < CASE_COUNT; i++) {
+		cases[i].latencies = malloc(rounds * sizeof(double));
+		if (!cases[i].latencies)
+			return 1;
+	}
+	QueryPerformanceFrequency(&frequency);
+
+	WNDCLASSEX windowClass = {sizeof windowClass};
+	windowClass.lpfnWndProc = windowProc;
+	windowClass.hInstance = GetModuleHandle(NULL);
+	windowClass.lpszClassName = TEXT("neo-llkh-latencybench");
+	RegisterClassEx(&windowClass);
+	HWND window = CreateWindowEx(0, windowClass.lpszClassName, TEXT("neo-llkh latency benchmark"),
+		WS_OVERLAPPEDWINDOW | WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT, 400, 100,
+		NULL, NULL, windowClass.hInstance, NULL);
+	SetForegroundWindow(window);
+	pumpMessages(200, false);
+	if (GetForegroundWindow() != window) {
+		printf("The benchmark window did not get the focus.\n");
+		return 1;
+	}
+
+	bool capsLockOn = GetKeyState(VK_CAPITAL) & 1;
+	printf("%d rounds, do not type meanwhile...\n", rounds);
+	for (int round = 0; round < rounds; round++) {
+		// interleaved, so load changes affect all cases alike
+		for (int i = 0; i < CASE_COUNT; i++) {
+			if (cases[i].scanCode)
+				measure(&cases[i]);
+		}
+		if (GetForegroundWindow() != window) {
+			printf("The benchmark window lost the focus.\n");
+			return 1;
+		}
+	}
+	// without neo-llkh, Mod3 is caps lock
+	if ((GetKeyState(VK_CAPITAL) & 1) != capsLockOn) {
+		sendScanCode(SCANCODE_CAPSLOCK_KEY, false);
+		sendScanCode(SCANCODE_CAPSLOCK_KEY, true);
+		pumpMessages(SETTLE_TIME, false);
+	}
+	DestroyWindow(window);
+
+	for (int i = 0; i < CASE_COUNT; i++)
+		qsort(cases[i].latencies, cases[i].count, sizeof(double), compareDoubles);
+	printResults(hasBaseline ? baseline : NULL);
+	if (saveFile && !writeResults(saveFile)) {
+		printf("Cannot write %s\n", saveFile);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,249 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Compiles a text layout file into the binary image loaded with
+ * layoutFile=<file> (see layoutfile.h):
+ *
+ *   make layoutc && ./layoutc example.layout example.nlay
+ *
+ * The text format is line based, see example.layout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "layoutfile.h"
+#include "layouts.h"
+
+typedef struct VirtualKeyName {
+	const char *name;
+	uint16_t vkCode;
+} VirtualKeyName;
+
+static const VirtualKeyName virtualKeyNames[] = {
+	{"BACK", VK_BACK},
+	{"TAB", VK_TAB},
+	{"RETURN", VK_RETURN},
+	{"ESCAPE", VK_ESCAPE},
+	{"SPACE", VK_SPACE},
+	{"PRIOR", VK_PRIOR},
+	{"NEXT", VK_NEXT},
+	{"END", VK_END},
+	{"HOME", VK_HOME},
+	{"LEFT", VK_LEFT},
+	{"UP", VK_UP},
+	{"RIGHT", VK_RIGHT},
+	{"DOWN", VK_DOWN},
+	{"INSERT", VK_INSERT},
+	{"DELETE", VK_DELETE},
+	{NULL, 0}
+};
+
+static const char *inputName;
+static int lineNumber;
+static unsigned macroPoolLength;
+
+static void fail(const char *message, const char *detail) {
+	fprintf(stderr, "%s:%d: %s%s%s\n", inputName, lineNumber, message, detail ? ": " : "", detail ? detail : "");
+	exit(1);
+}
+
+/**
+ * Decodes one UTF-8 character or escape sequence (\uXXXX, \UXXXXXXXX, \s for
+ * space, \t for tab, \n for a new line, \\ for backslash) and advances *text.
+ */
+static uint32_t nextChar(const char **text) {
+	const unsigned char *p = (const unsigned char *)*text;
+	uint32_t codePoint;
+	int length;
+
+	if (p[0] == '\\') {
+		switch (p[1]) {
+			case 'u':
+			case 'U': {
+				char *end;
+				char digits[9] = {0};
+				int digitCount = p[1] == 'u' ? 4 : 8;
+				strncpy(digits, (const char *)p + 2, digitCount);
+				codePoint = strtoul(digits, &end, 16);
+				if (end != digits + digitCount || codePoint == 0)
+					fail("invalid escape sequence", *text);
+				length = 2 + digitCount;
+				break;
+			}
+			case 's': codePoint = ' '; length = 2; break;
+			case 't': codePoint = '\t'; length = 2; break;
+			case 'n': codePoint = '\n'; length = 2; break;
+			case '\\': codePoint = '\\'; length = 2; break;
+			default: fail("invalid escape sequence", *text);
+		}
+	} else if (p[0] < 0x80) {
+		codePoint = p[0];
+		length = 1;
+	} else if ((p[0] & 0xe0) == 0xc0 && (p[1] & 0xc0) == 0x80) {
+		codePoint = (p[0] & 0x1f) << 6 | (p[1] & 0x3f);
+		length = 2;
+	} else if ((p[0] & 0xf0) == 0xe0 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80) {
+		codePoint = (p[0] & 0x0f) << 12 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+		length = 3;
+	} else if ((p[0] & 0xf8) == 0xf0 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80 && (p[3] & 0xc0) == 0x80) {
+		codePoint = (p[0] & 0x07) << 18 | (p[1] & 0x3f) << 12 | (p[2] & 0x3f) << 6 | (p[3] & 0x3f);
+		length = 4;
+	} else {
+		fail("invalid UTF-8", NULL);
+	}
+	if (codePoint > 0x10ffff || (codePoint >= 0xd800 && codePoint <= 0xdfff))
+		fail("invalid character", *text);
+
+	*text += length;
+	return codePoint;
+}
+
+static uint16_t nextBmpChar(const char **text) {
+	uint32_t codePoint = nextChar(text);
+	if (codePoint > 0xffff)
+		fail("character outside of the Basic Multilingual Plane not allowed here", NULL);
+	return codePoint;
+}
+
+static void setUnicodeKey(LayoutImageSpecialKey *specialKey, uint32_t codePoint) {
+	specialKey->type = SPECIAL_UNICODE;
+	specialKey->plane = codePoint >> 16;
+	specialKey->value = codePoint & 0xffff;
+}
+
+static unsigned parseNumber(const char *text, unsigned max, const char *what) {
+	char *end;
+	unsigned long value = text ? strtoul(text, &end, 0) : 0;
+	if (!text || *end || value > max)
+		fail(what, text);
+	return value;
+}
+
+static uint16_t parseVirtualKey(const char *text) {
+	for (const VirtualKeyName *key = virtualKeyNames; key->name; key++) {
+		if (strcmp(key->name, text) == 0)
+			return key->vkCode;
+	}
+	if (strlen(text) == 1)
+		return (unsigned char)text[0];  // digits and capital letters are their own virtual key code
+	return parseNumber(text, 0xfe, "invalid virtual key");
+}
+
+static void parseLine(char *line, LayoutImage *image) {
+	line[strcspn(line, "\r\n")] = 0;
+	char *directive = strtok(line, " \t");
+	if (!directive || directive[0] == '#')
+		return;
+
+	if (strcmp(directive, "base") == 0) {
+		char *name = strtok(NULL, " \t");
+		if (!name || !findLayout(name))
+			fail("unknown layout", name);
+		strcpy(image->baseLayout, name);
+		return;
+	}
+
+	unsigned level = parseNumber(strtok(NULL, " \t"), LAYOUT_IMAGE_LEVELS, "invalid level");
+	unsigned scanCode = parseNumber(strtok(NULL, " \t"), LEN - 1, "invalid scan code");
+	const char *value = strtok(NULL, " \t");
+	if (level == 0)
+		fail("invalid level", "0");
+	if (!value)
+		fail("missing value", directive);
+
+	if (strcmp(directive, "row") == 0) {
+		while (*value) {
+			if (scanCode >= LEN)
+				fail("row is too long", NULL);
+			uint32_t codePoint = nextChar(&value);
+			// characters beyond the BMP do not fit into the mapping table
+			if (codePoint > 0xffff)
+				setUnicodeKey(&image->specialKeys[level - 1][scanCode], codePoint);
+			else
+				image->chars[level - 1][scanCode] = codePoint;
+			scanCode++;
+		}
+		return;
+	}
+
+	LayoutImageSpecialKey *specialKey = &image->specialKeys[level - 1][scanCode];
+	if (strcmp(directive, "dead") == 0) {
+		specialKey->type = SPECIAL_CHAR;
+		specialKey->value = nextBmpChar(&value);
+	} else if (strcmp(directive, "unicode") == 0) {
+		setUnicodeKey(specialKey, nextChar(&value));
+	} else if (strcmp(directive, "vk") == 0) {
+		specialKey->type = SPECIAL_VK;
+		specialKey->value = parseVirtualKey(value);
+		value += strlen(value);
+	} else if (strcmp(directive, "macro") == 0) {
+		specialKey->type = SPECIAL_MACRO;
+		specialKey->value = macroPoolLength;
+		while (*value) {
+			uint32_t codePoint = nextChar(&value);
+			if (macroPoolLength >= LAYOUT_IMAGE_MACRO_POOL - 2)
+				fail("macros are too long", NULL);
+			if (codePoint > 0xffff) {
+				image->macroPool[macroPoolLength++] = 0xd800 + ((codePoint - 0x10000) >> 10);
+				image->macroPool[macroPoolLength++] = 0xdc00 + (codePoint & 0x3ff);
+			} else {
+				image->macroPool[macroPoolLength++] = codePoint;
+			}
+		}
+		image->macroPool[macroPoolLength++] = 0;
+	} else {
+		fail("unknown directive", directive);
+	}
+	if (*value)
+		fail("only one character expected", NULL);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <layout file> <compiled layout file>\n", argv[0]);
+		return 1;
+	}
+
+	inputName = argv[1];
+	FILE *input = fopen(inputName, "r");
+	if (!input) {
+		perror(inputName);
+		return 1;
+	}
+
+	LayoutImage image;
+	memset(&image, 0, sizeof image);
+	memcpy(image.magic, LAYOUT_IMAGE_MAGIC, sizeof image.magic);
+	image.version = LAYOUT_IMAGE_VERSION;
+	image.levels = LAYOUT_IMAGE_LEVELS;
+	image.keys = LEN;
+
+	char line[1024];
+	while (fgets(line, sizeof line, input)) {
+		lineNumber++;
+		parseLine(line, &image);
+	}
+	fclose(input);
+
+	FILE *output = fopen(argv[2], "wb");
+	if (!output || fwrite(&image, sizeof image, 1, output) != 1 || fclose(output) != 0) {
+		perror(argv[2]);
+		return 1;
+	}
+	return 0;
+}
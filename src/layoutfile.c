@@ -0,0 +1,101 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "layoutfile.h"
+#include "layouts.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the image must have the same size everywhere
+typedef char layoutImageSizeCheck[sizeof(LayoutImage) == 32 + LAYOUT_IMAGE_LEVELS * LEN * 6 + LAYOUT_IMAGE_MACRO_POOL * 2 ? 1 : -1];
+
+/**
+ * a known type, a code point below 0x110000, a macro index in macroPool
+ **/
+static bool isValidSpecialKey(const LayoutImageSpecialKey *specialKey) {
+	if (specialKey->type > SPECIAL_MACRO)
+		return false;
+	if (specialKey->type == SPECIAL_UNICODE)
+		return specialKey->plane <= 0x10;
+	if (specialKey->type == SPECIAL_MACRO && specialKey->value >= LAYOUT_IMAGE_MACRO_POOL)
+		return false;
+	return specialKey->plane == 0;
+}
+
+static bool isValidLayoutImage(const LayoutImage *image) {
+	if (memcmp(image->magic, LAYOUT_IMAGE_MAGIC, sizeof image->magic) != 0
+			|| image->version != LAYOUT_IMAGE_VERSION
+			|| image->levels != LAYOUT_IMAGE_LEVELS
+			|| image->keys != LEN
+			|| memchr(image->baseLayout, 0, sizeof image->baseLayout) == NULL)
+		return false;
+	for (int level = 0; level < LAYOUT_IMAGE_LEVELS; level++) {
+		for (int i = 0; i < LEN; i++) {
+			if (!isValidSpecialKey(&image->specialKeys[level][i]))
+				return false;
+		}
+	}
+	return true;
+}
+
+const LayoutImage *mapLayoutImage(const char *filename) {
+	const LayoutImage *image = NULL;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	if (GetFileSize(file, NULL) == sizeof(LayoutImage)) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			image = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(LayoutImage));
+			CloseHandle(mapping);  // the view keeps the mapping alive
+		}
+	}
+	CloseHandle(file);
+#else
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+		return NULL;
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size == sizeof(LayoutImage)) {
+		void *view = mmap(NULL, sizeof(LayoutImage), PROT_READ, MAP_PRIVATE, file, 0);
+		if (view != MAP_FAILED)
+			image = view;
+	}
+	close(file);
+#endif
+
+	if (image && !isValidLayoutImage(image)) {
+		unmapLayoutImage(image);
+		return NULL;
+	}
+	return image;
+}
+
+void unmapLayoutImage(const LayoutImage *image) {
+	if (!image)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(image);
+#else
+	munmap((void *)image, sizeof(LayoutImage));
+#endif
+}
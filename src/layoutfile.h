@@ -0,0 +1,69 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LAYOUTFILE_H
+#define _LAYOUTFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+
+/**
+ * Compiled layout files (*.nlay): a fixed-size image in the byte order of the
+ * compiling machine (little endian on all Windows systems), written by layoutc
+ * from a text layout file (see example.layout) and selected with
+ * layoutFile=<file>. The image is memory-mapped and copied into
+ * the lookup tables by initLayout() without any parsing.
+ *
+ * Characters are UTF-16 code units, 0 means "not defined" (the key keeps the
+ * character of the base layout). A key with a character or a special key
+ * defined in the image replaces the special key of the base layout on that
+ * level. Characters beyond the Basic Multilingual Plane are special keys of
+ * type SPECIAL_UNICODE, their plane is in the extra byte.
+ *
+ * The strings of macro keys (SPECIAL_MACRO) are zero terminated one after
+ * another in macroPool (UTF-16, with surrogate pairs), the value of the key is the index of its first character.
+ */
+#define LAYOUT_IMAGE_MAGIC "NEOLAYOT"
+#define LAYOUT_IMAGE_VERSION 2
+#define LAYOUT_IMAGE_LEVELS 6
+#define LAYOUT_IMAGE_MACRO_POOL 4096
+
+typedef struct LayoutImageSpecialKey {
+	uint8_t type;         // enum specialKeyType, SPECIAL_NONE if not defined
+	uint8_t plane;        // bits 16 to 20 of the character of SPECIAL_UNICODE, 0 otherwise
+	uint16_t value;       // character, virtual key code or index in macroPool
+} LayoutImageSpecialKey;
+
+typedef struct LayoutImage {
+	char magic[8];        // LAYOUT_IMAGE_MAGIC without terminating zero
+	uint32_t version;     // LAYOUT_IMAGE_VERSION
+	uint16_t levels;      // LAYOUT_IMAGE_LEVELS
+	uint16_t keys;        // LEN
+	char baseLayout[16];  // name of the built-in layout the image is applied to, empty for the `layout` setting
+	uint16_t chars[LAYOUT_IMAGE_LEVELS][LEN];
+	LayoutImageSpecialKey specialKeys[LAYOUT_IMAGE_LEVELS][LEN];
+	uint16_t macroPool[LAYOUT_IMAGE_MACRO_POOL];
+} LayoutImage;
+
+/**
+ * Maps the compiled layout file into memory and checks its header and special keys.
+ * returns NULL if the file cannot be read or is not a valid layout image of this version
+ */
+const LayoutImage *mapLayoutImage(const char *filename);
+
+void unmapLayoutImage(const LayoutImage *image);
+
+#endif
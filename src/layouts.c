@@ -0,0 +1,180 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "layouts.h"
+
+static const LayoutRow neoRows[] = {
+	{1, 16, L"xvlcwkhgfqß´"},
+	{1, 30, L"uiaeosnrtdy"},
+	{1, 44, L"üöäpzbm,.j"},
+	{0}
+};
+
+static const LayoutRow adnwRows[] = {
+	{1, 16, L"kuü.ävgcljf´"},
+	{1, 30, L"hieaodtrnsß"},
+	{1, 44, L"xyö,qbpwmz"},
+	{0}
+};
+
+static const LayoutRow adnwzjfRows[] = {
+	{1, 16, L"kuü.ävgclßz´"},
+	{1, 30, L"hieaodtrnsf"},
+	{1, 44, L"xyö,qbpwmj"},
+	{0}
+};
+
+static const LayoutRow boneRows[] = {
+	{1, 16, L"jduaxphlmwß´"},
+	{1, 30, L"ctieobnrsgq"},
+	{1, 44, L"fvüäöyz,.k"},
+	{0}
+};
+
+static const LayoutRow koyRows[] = {
+	{1, 16, L"k.o,yvgclßz´"},
+	{1, 30, L"haeiudtrnsf"},
+	{1, 44, L"xqäüöbpwmj"},
+	{0}
+};
+
+// levels 3 and 4 of KOU and VOU
+#define KOU_VOU_ROWS \
+	{3, 16, L"@%{}^!<>=&€̷"}, \
+	{3, 30, L"|`()*?/:-_→"}, \
+	{3, 44, L"#[]~$+\"'\\;"}, \
+	{4,  4, L"✔✘·£¤0/*-¨"}, \
+	{4, 21, L":789+−˝"}, \
+	{4, 35, L"-456,;"}, \
+	{4, 49, L"_123."}
+
+static const LayoutRow kouRows[] = {
+	{1, 16, L"k.ouäqgclfj´"},
+	{1, 30, L"haeiybtrnsß"},
+	{1, 44, L"zx,üöpdwmv"},
+	KOU_VOU_ROWS,
+	{0}
+};
+
+static const LayoutRow vouRows[] = {
+	{1, 16, L"v.ouäqglhfj´"},
+	{1, 30, L"caeiybtrnsß"},
+	{1, 44, L"zx,üöpdwmk"},
+	KOU_VOU_ROWS,
+	{0}
+};
+
+static const LayoutRow qwertzRows[] = {
+	{1, 12, L"ß"},
+	{1, 16, L"qwertzuiopü+"},
+	{1, 30, L"asdfghjklöä"},
+	{1, 44, L"yxcvbnm,.-"},
+	{0}
+};
+
+const SpecialKeyDefinition commonSpecialKeys[] = {
+	{2, 27, SPECIAL_CHAR, L'\u0303'}, // perispomene (Tilde)
+	{2, 41, SPECIAL_CHAR, L'\u030C'}, // caron, wedge, háček (Hatschek)
+	{3, 13, SPECIAL_CHAR, L'\u030A'}, // overring
+	{3, 15, SPECIAL_CHAR, L'\u266B'}, // compose key ♫ (see compose.h)
+	{3, 20, SPECIAL_UNICODE, L'^'},
+	{3, 27, SPECIAL_CHAR, L'\u0337'}, // bar (diakritischer Schrägstrich)
+	{4, 13, SPECIAL_CHAR, L'\u00A8'}, // diaeresis, umlaut
+	{4, 27, SPECIAL_CHAR, L'\u02DD'}, // double acute (doppelter Akut)
+	{4, 41, SPECIAL_CHAR, L'\u0307'}, // dot above (Punkt, darüber)
+
+	{4, 16, SPECIAL_VK, VK_PRIOR},
+	{4, 18, SPECIAL_VK, VK_UP},
+	{4, 30, SPECIAL_VK, VK_HOME},
+	{4, 31, SPECIAL_VK, VK_LEFT},
+	{4, 32, SPECIAL_VK, VK_DOWN},
+	{4, 33, SPECIAL_VK, VK_RIGHT},
+	{4, 34, SPECIAL_VK, VK_END},
+	{4, 45, SPECIAL_VK, VK_TAB},
+	{4, 57, SPECIAL_VK, '0'},             // space bar
+
+	/** numeric keypad
+	 * --------------------
+	 * dec hex extended bit
+	 *  28  1C 1   Enter
+	 *  53  35 1   /
+	 *  55  37 0   *
+	 *  71  47 0   7 and Home
+	 *  74  4A 0   -
+	 *  75  4B 0   4 and Left
+	 *  76  4C 0   5
+	 *  77  4D 0   6 and Right
+	 *  78  4E 0   +
+	 *  79  4F 0   1 and End
+	 *  80  50 0   2 and Down
+	 *  81  51 0   3 and PgDn
+	 *  82  52 0   0 and Ins
+	 *  83  53 0   , and Del
+	 */
+	{4, 71, SPECIAL_VK, VK_HOME},
+	{4, 72, SPECIAL_VK, VK_UP},
+	{4, 73, SPECIAL_VK, VK_PRIOR},
+	{4, 75, SPECIAL_VK, VK_LEFT},
+	{4, 76, SPECIAL_VK, VK_ESCAPE},       // not sure about this one
+	{4, 77, SPECIAL_VK, VK_RIGHT},
+	{4, 79, SPECIAL_VK, VK_END},
+	{4, 80, SPECIAL_VK, VK_DOWN},
+	{4, 81, SPECIAL_VK, VK_NEXT},
+	{4, 82, SPECIAL_VK, VK_INSERT},
+	{4, 83, SPECIAL_VK, VK_DELETE},
+	{0}
+};
+
+static const SpecialKeyDefinition neoSpecialKeys[] = {
+	{3, 48, SPECIAL_UNICODE, L'`'},
+	{4, 17, SPECIAL_VK, VK_BACK},
+	{4, 19, SPECIAL_VK, VK_DELETE},
+	{4, 20, SPECIAL_VK, VK_NEXT},
+	{4, 44, SPECIAL_VK, VK_ESCAPE},
+	{4, 46, SPECIAL_VK, VK_INSERT},
+	{4, 47, SPECIAL_VK, VK_RETURN},
+	{0}
+};
+
+static const SpecialKeyDefinition kouVouSpecialKeys[] = {
+	{3, 31, SPECIAL_UNICODE, L'`'},
+	{4, 17, SPECIAL_VK, VK_NEXT},
+	{4, 19, SPECIAL_VK, VK_BACK},
+	{4, 20, SPECIAL_VK, VK_DELETE},
+	{4, 44, SPECIAL_VK, VK_INSERT},
+	{4, 46, SPECIAL_VK, VK_RETURN},
+	{4, 47, SPECIAL_VK, VK_ESCAPE},
+	{0}
+};
+
+const LayoutDescriptor layouts[LAYOUT_COUNT] = {
+	{LAYOUT_NEO,     "neo",     neoRows,     neoSpecialKeys},
+	{LAYOUT_ADNW,    "adnw",    adnwRows,    neoSpecialKeys},
+	{LAYOUT_ADNWZJF, "adnwzjf", adnwzjfRows, neoSpecialKeys},
+	{LAYOUT_BONE,    "bone",    boneRows,    neoSpecialKeys},
+	{LAYOUT_KOY,     "koy",     koyRows,     neoSpecialKeys},
+	{LAYOUT_KOU,     "kou",     kouRows,     kouVouSpecialKeys},
+	{LAYOUT_VOU,     "vou",     vouRows,     kouVouSpecialKeys},
+	{LAYOUT_QWERTZ,  "qwertz",  qwertzRows,  neoSpecialKeys}
+};
+
+const LayoutDescriptor *findLayout(const char *name) {
+	for (int i = 0; i < LAYOUT_COUNT; i++) {
+		if (strcmp(layouts[i].name, name) == 0)
+			return &layouts[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,85 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LAYOUTS_H
+#define _LAYOUTS_H
+
+#include <stdint.h>
+#include "keydefs.h"
+
+/**
+ * Registry of the built-in layouts. Everything that differs between the
+ * layouts is described here; the layout is looked up once by its name
+ * (setting `layout`) and initLayout() applies its descriptor.
+ */
+enum layoutId {
+	LAYOUT_NEO,
+	LAYOUT_ADNW,
+	LAYOUT_ADNWZJF,
+	LAYOUT_BONE,
+	LAYOUT_KOY,
+	LAYOUT_KOU,
+	LAYOUT_VOU,
+	LAYOUT_QWERTZ,
+	LAYOUT_COUNT
+};
+
+/**
+ * Consecutive keys of one level, starting with scanCode
+ */
+typedef struct LayoutRow {
+	uint8_t level;
+	uint8_t scanCode;
+	const TCHAR *chars;
+} LayoutRow;
+
+/**
+ * How a special key is sent
+ */
+enum specialKeyType {
+	SPECIAL_NONE,
+	SPECIAL_CHAR,     // dead key (see compose.h), sendChar if no compose sequence starts with it
+	SPECIAL_UNICODE,  // sendUnicodeChar
+	SPECIAL_VK,       // virtual key (navigation keys of level 4)
+	SPECIAL_MACRO     // string of the layout file
+};
+
+typedef struct SpecialKeyDefinition {
+	uint8_t level;
+	uint8_t scanCode;
+	uint8_t type;     // enum specialKeyType
+	TCHAR value;      // character or virtual key code
+} SpecialKeyDefinition;
+
+typedef struct LayoutDescriptor {
+	enum layoutId id;
+	const char *name;
+	const LayoutRow *rows;                     // applied on top of the rows all layouts share, ends with {0}
+	const SpecialKeyDefinition *specialKeys;   // applied after commonSpecialKeys, ends with {0}
+} LayoutDescriptor;
+
+extern const LayoutDescriptor layouts[LAYOUT_COUNT];
+
+/**
+ * Special keys of all layouts, ends with {0}
+ */
+extern const SpecialKeyDefinition commonSpecialKeys[];
+
+/**
+ * returns the layout with this name or NULL
+ */
+const LayoutDescriptor *findLayout(const char *name);
+
+#endif
@@ -0,0 +1,50 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include "log.h"
+
+bool logEnabled = false;
+
+LogRecord logBuffer[LOG_BUFFER_SIZE];
+unsigned logHead = 0; // next record to write, only modified by the producer
+unsigned logTail = 0; // next record to read, only modified by the consumer
+unsigned logDropped = 0;
+
+LogRecord *logReserve() {
+	unsigned tail = __atomic_load_n(&logTail, __ATOMIC_ACQUIRE);
+	if (logHead - tail >= LOG_BUFFER_SIZE) {
+		__atomic_add_fetch(&logDropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	return &logBuffer[logHead & (LOG_BUFFER_SIZE - 1)];
+}
+
+void logCommit() {
+	__atomic_store_n(&logHead, logHead + 1, __ATOMIC_RELEASE);
+}
+
+bool logPop(LogRecord *record) {
+	unsigned head = __atomic_load_n(&logHead, __ATOMIC_ACQUIRE);
+	if (head == logTail)
+		return false;
+	*record = logBuffer[logTail & (LOG_BUFFER_SIZE - 1)];
+	__atomic_store_n(&logTail, logTail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+unsigned logDroppedCount() {
+	return __atomic_load_n(&logDropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,97 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Debug log records.
+ * The hook thread writes fixed-size binary records into a single-producer
+ * single-consumer ring buffer. A logger thread formats them later, so no
+ * console I/O happens while a key event is being handled.
+ */
+enum logRecordType {
+	LOG_KEY_EVENT,     // text: description, key: event
+	LOG_LEVEL,         // values[0]: level
+	LOG_MAPPED,        // key: event, values[0]: mapped character, values[1]: level
+	LOG_QUEUE_APPEND,  // key: event, values[0]: tap next release modifier, values[1]: index, values[2]: keys pressed
+	LOG_QUEUE_REMOVE,  // same as LOG_QUEUE_APPEND
+	LOG_QUEUE_STATUS,  // items: status of all queue entries
+	LOG_QUEUE_CLEANUP, // values[0]: first moved index, values[1]: delta
+	LOG_MESSAGE        // text: printf format with at most one %s, arg: its argument
+};
+
+// console colors (see SetConsoleTextAttribute)
+#define FG_WHITE 15
+#define FG_YELLOW 14
+#define FG_CYAN 11
+#define FG_GRAY 8
+
+#define LOG_SHIFT_LOCK 1
+#define LOG_CAPS_LOCK 2
+#define LOG_LEVEL4_LOCK 4
+
+#define LOG_ITEMS_LEN 32
+
+typedef struct LogRecord {
+	uint8_t type;       // enum logRecordType
+	uint8_t color;      // console color
+	uint8_t locks;      // lock states when the record was written (LOG_*_LOCK)
+	uint8_t itemCount;  // number of valid entries in items
+	int32_t values[3];
+	const char *text;   // static strings only, they are read by the logger thread
+	const char *arg;
+	union {
+		struct {
+			uint32_t scanCode;
+			uint32_t vkCode;
+			uint32_t flags;
+			uint64_t extraInfo;
+		} key;
+		uint8_t items[LOG_ITEMS_LEN];
+	};
+} LogRecord;
+
+#define LOG_BUFFER_SIZE 1024 // must be a power of two
+
+/**
+ * True if records should be written at all.
+ * Check this before preparing a record, then logging costs nothing when it is off.
+ */
+extern bool logEnabled;
+
+/**
+ * Producer side (hook thread only): reserve the next free record or NULL
+ * if the buffer is full (the record is dropped and counted), then fill it
+ * and publish it with logCommit().
+ */
+LogRecord *logReserve();
+void logCommit();
+
+/**
+ * Consumer side (logger thread only): copy the oldest record into `record`.
+ * returns `false` if the buffer is empty
+ */
+bool logPop(LogRecord *record);
+
+/**
+ * Number of records dropped because the buffer was full.
+ */
+unsigned logDroppedCount();
+
+#endif
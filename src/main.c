@@ -1,4 +1,7 @@
 #define UNICODE
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0501 // Raw Input (Windows XP)
+#endif
 /**
  * Alternative Windows driver for the Neo2 based keyboard layouts:
  * Neo2 (https://neo-layout.org)
@@ -10,200 +13,85 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <wchar.h>
 #include <stdbool.h>
 #include "trayicon.h"
 #include "resources.h"
+#include "log.h"
+#include "latency.h"
+#include "core.h"
+#include "layouts.h"
+#include "layoutfile.h"
+#include "injection.h"
+#include "trace.h"
+#include "keystats.h"
+#include "settings.h"
 #include <io.h>
 
-typedef struct ModState {
-	bool shift, mod3, mod4;
-} ModState;
-
 HHOOK keyhook = NULL;
+HINSTANCE hookModule;
 HANDLE hConsole;
 #define APPNAME "neo-llkh"
-#define LEN 103
-#define SCANCODE_TAB_KEY 15
-#define SCANCODE_CAPSLOCK_KEY 58
-#define SCANCODE_LOWER_THAN_KEY 86 // <
-#define SCANCODE_QUOTE_KEY 40      // Ä
-#define SCANCODE_HASH_KEY 43       // #
-#define SCANCODE_RETURN_KEY 28
-// #define SCANCODE_ANY_ALT_KEY 56        // Alt or AltGr
-
-enum modTapModifier {
-	MT_NONE,
-	MT_CTRL,
-	MT_SHIFT,
-	MT_MOD3,
-	MT_MOD4,
-	MT_ALT,
-	MT_WIN
-};
-
-#define FG_WHITE 15
-#define FG_YELLOW 14
-#define FG_CYAN 11
-#define FG_GRAY 8
 
 /**
  * Some global settings.
  * These values can be set in a configuration file (settings.ini)
+ * The remapping settings are defined in core.c.
  */
-char layout[100];                    // keyboard layout by name (default: neo)
 char customLayout[65];               // custom keyboard layout (32 symbols but probably more than 32 bytes)
-TCHAR customLayoutWcs[33];           // custom keyboard layout in UTF-16 (32 symbols)
+char layoutFile[256];                // compiled layout file (*.nlay) applied on top of the layout (disabled if empty)
 bool debugWindow = false;            // show debug output in a separate console window
-bool quoteAsMod3R = false;           // use quote/ä as right level 3 modifier
-bool returnAsMod3R = false;          // use return as right level 3 modifier
-bool tabAsMod4L = false;             // use tab as left level 4 modifier
-DWORD scanCodeMod3L = SCANCODE_CAPSLOCK_KEY;
-DWORD scanCodeMod3R = SCANCODE_HASH_KEY;       // depends on quoteAsMod3R and returnAsMod3R
-DWORD scanCodeMod4L = SCANCODE_LOWER_THAN_KEY; // depends on tabAsMod4L
-// DWORD scanCodeMod4R = SCANCODE_ANY_ALT_KEY;
-bool capsLockEnabled = false;        // enable (allow) caps lock
-bool shiftLockEnabled = false;       // enable (allow) shift lock (disabled if capsLockEnabled is true)
-bool level4LockEnabled = false;      // enable (allow) level 4 lock (toggle by pressing both Mod4 keys at the same time)
-bool qwertzForShortcuts = false;     // use QWERTZ when Ctrl, Alt or Win is involved
-bool swapLeftCtrlAndLeftAlt = false; // swap left Ctrl and left Alt key
-bool swapLeftCtrlLeftAltAndLeftWin = false;  // swap left Ctrl, left Alt key and left Win key. Resulting order: Win, Alt, Ctrl (on a standard Windows keyboard)
-bool supportLevels5and6 = false;     // support levels five and six (greek letters and mathematical symbols)
-bool capsLockAsEscape = false;       // if true, hitting CapsLock alone sends Esc
-bool mod3RAsReturn = false;          // if true, hitting Mod3R alone sends Return
-bool mod4LAsTab = false;             // if true, hitting Mod4L alone sends Tab
-
-/**
- * True if no mapping should be done
- */
-bool bypassMode = false;
-
-/**
- * States of some keys and shift lock.
- */
-bool shiftLeftPressed = false;
-bool shiftRightPressed = false;
-bool shiftLockActive = false;
-bool capsLockActive = false;
-
-bool level3modLeftPressed = false;
-bool level3modRightPressed = false;
-bool level3modLeftAndNoOtherKeyPressed = false;
-bool level3modRightAndNoOtherKeyPressed = false;
-bool level4modLeftAndNoOtherKeyPressed = false;
-
-bool level4modLeftPressed = false;
-bool level4modRightPressed = false;
-bool level4LockActive = false;
-
-bool ctrlLeftPressed = false;
-bool ctrlRightPressed = false;
-bool altLeftPressed = false;
-bool winLeftPressed = false;
-bool winRightPressed = false;
-
-ModState modState = { false, false, false };
-
-int mapCharacterToScanCode[256] = {0};
-/**
- * Mapping tables for four levels.
- * They will be defined in initLayout().
- */
-TCHAR mappingTableLevel1[LEN] = {0};
-TCHAR mappingTableLevel2[LEN] = {0};
-TCHAR mappingTableLevel3[LEN] = {0};
-TCHAR mappingTableLevel4[LEN] = {0};
-TCHAR mappingTableLevel5[LEN] = {0};
-TCHAR mappingTableLevel6[LEN] = {0};
-CHAR mappingTableLevel4Special[LEN] = {0};
-TCHAR mappingTapNextRelease[LEN] = {0};
-TCHAR numpadSlashKey[7];
+char logFile[256];                   // write debug output to this file (disabled if empty)
+char recordTrace[256];               // record all key events into this trace file (disabled if empty)
+char replayTrace[256];               // replay this trace file on start (disabled if empty)
+bool replayMaxSpeed = false;         // replay as fast as possible instead of with the recorded timing
+bool useInjectorThread = false;      // send the mapped key events from a separate thread instead of the hook callback
+bool useKeyStats = false;            // count keystrokes and ModTap decisions (see keystats.h)
+int keyStatsInterval = 10;           // minutes between two saves of the keystroke statistics
+char hookPriority[16];               // priority of the hook thread: normal, high, timecritical or mmcss
+bool useLockMemory = false;          // keep the code and tables of the hook in memory (no page faults after idle periods)
+char bypassAppLists[2][1024];        // bypassApps: a new value is written to the buffer not in use, then published (see settings.h)
+char *bypassApps = bypassAppLists[0]; // programs (e.g. game.exe, comma separated) which switch on bypass mode while in the foreground
+char bypassDeviceLists[2][1024];     // bypassDevices, like bypassApps
+char *bypassDevices = bypassDeviceLists[0]; // keyboards (parts of their device names, comma separated) which are not remapped
+#define DEVICE_REMAP 0
+#define DEVICE_BYPASS -1
+int devicePolicy = DEVICE_REMAP;     // of the keyboard used last: DEVICE_REMAP, DEVICE_BYPASS or a profile (see updateRawInput())
+bool deviceBypassedKeys[2][1024];    // keys pressed on a bypassed keyboard, per extended flag and scan code (see isDeviceBypassed())
 
 /**
- * When a key with TapNextRelease function is pressed, the key to emit depends
- * on the order this and succesive keys are being released. Thus all keys
- * are stored in the keyQueue in the first place.
- */
-#define QUEUE_SIZE 50
-KBDLLHOOKSTRUCT keyQueue[QUEUE_SIZE];
-int keyQueueLength;
-int keyQueueFirst;
-int keyQueueLast;
-int keyQueueStatus[QUEUE_SIZE]; // 0=empty/handled, 1=regular key pressed, 2=TapNextRelease key not activated, 3=TapNextRelease key activated
-char *MT_MODIFIER_STRING[7] = {"", "CTRL", "SHIFT", "MOD3", "MOD4", "ALT", "WIN"};
-
-typedef struct ModTap {
-	int modifier;
-	int keycode;
-} ModTap;
-#define MOD_TAP_LEN 12
-ModTap modTap[MOD_TAP_LEN];
-int modTapKeyCount = 0;  // how many ModTap keys are defined
-
-bool handleSystemKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
-void handleShiftKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
-void handleMod3Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
-void handleMod4Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
-bool updateStatesAndWriteKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp);
-
-
-void convertToUTF8(TCHAR *wide, char *utf8) {
-	int sizeRequired = WideCharToMultiByte(
-			CP_UTF8, 0, &wide[0], -1, NULL,
-			0, NULL, NULL);
-	int bytesWritten = WideCharToMultiByte(
-			CP_UTF8, 0, &wide[0], -1, &utf8[0],
-			sizeRequired, NULL, NULL);
-}
-
-void resetKeyQueue() {
-	keyQueueLength = 0;
-	keyQueueFirst = 0;
-	keyQueueLast = -1;
-	memset(keyQueueStatus, 0, sizeof keyQueueStatus);
-}
-
-void cleanupKeyQueue() {
-	printf("\nkeyQueueStatus:");
-	for (int i = keyQueueFirst; i <= keyQueueLast; i++) {
-		printf(" %i", keyQueueStatus[i]);
-	}
-	printf("\n");
-
-	if (keyQueueFirst == 0) {
-		int firstEmptyPosition = 0;
-		while (keyQueueStatus[firstEmptyPosition])
-			firstEmptyPosition++;
-		int nextNonEmptyPosition = firstEmptyPosition;
-		while (!keyQueueStatus[nextNonEmptyPosition])
-			nextNonEmptyPosition++;
-		int delta = nextNonEmptyPosition - firstEmptyPosition;
-		SetConsoleTextAttribute(hConsole, FG_GRAY);
-		printf("cleanupKeyQueue: Move all entries starting from index %i back by %i\n", nextNonEmptyPosition, delta);
-		SetConsoleTextAttribute(hConsole, FG_WHITE);
-		// if keyQueueFirst = 45, move all entries back by 45
-		for (int i = nextNonEmptyPosition; i <= keyQueueLast; i++) {
-			keyQueue[i-delta] = keyQueue[i];
-			keyQueueStatus[i-delta];
-			keyQueueStatus[i] = 0;
-		}
-		keyQueueLast -= delta;
-		return;
-	}
-	// if keyQueueFirst = 45, move all entries back by 45
-	int delta = keyQueueFirst;
-	SetConsoleTextAttribute(hConsole, FG_GRAY);
-	printf("cleanupKeyQueue: Move all entries back by %i\n", delta);
-	SetConsoleTextAttribute(hConsole, FG_WHITE);
-	for (int i = keyQueueFirst; i <= keyQueueLast; i++) {
-		keyQueue[i-delta] = keyQueue[i];
-		// keyQueue[i] = 0;
-		keyQueueStatus[i-delta];
-		keyQueueStatus[i] = 0;
-	}
-	keyQueueLast -= delta;
-	keyQueueFirst = 0;
-}
+ * Profiles: sections [Profile <name>] of settings.ini with the programs they
+ * are used for (apps=<file names>) and settings which differ from [Settings].
+ * The ModTap keys and combos of a profile section replace the others,
+ * modTap=0 and combos=0 switch them off. The core builds a configuration per
+ * profile (see reloadConfig()), the hook thread selects one when another
+ * program comes to the foreground.
+ * A new list of profiles is written to the buffer not in use, then swapped.
+ **/
+#define PROFILE_SECTION_PREFIX "Profile "
+typedef struct Profiles {
+	int count;                         // including the default profile 0 (no section)
+	char sections[PROFILE_COUNT][64];
+	char apps[PROFILE_COUNT][512];     // comma separated
+	char devices[PROFILE_COUNT][512];  // keyboards, like bypassDevices
+} Profiles;
+Profiles profileLists[2];
+Profiles *profiles = &profileLists[0];  // used by the hook thread (acquire), published with release
+Profiles *loadingProfiles;              // the profiles reloadConfig() builds
+
+char ini[256];                       // path of settings.ini
+int commandLineArgc;                 // command line, applied again on every reload of the settings
+char **commandLineArgv;
+
+FILE *logFileHandle = NULL;
+HANDLE injectorThread = NULL;        // only if the injector thread was enabled on start
+HANDLE injectorWakeup;
+HANDLE traceWriterThread = NULL;
+char latencyCsvFile[256];            // latency statistics are saved here (same folder as settings.ini)
+char keyStatsCsvFile[256];           // keystroke statistics, like latencyCsvFile
+CRITICAL_SECTION keyStatsFileLock;   // the saving thread and the tray menu write the same file
+bool logToStdout = false;            // debug window or redirected output (e.g. in Git Bash)
 
 void SetStdOutToNewConsole() {
 	// allocate a console for this app
@@ -226,6 +114,56 @@ void SetStdOutToNewConsole() {
 	}
 }
 
+/**
+ * Writes the recorded trace records to the trace file (see recordTrace)
+ **/
+DWORD WINAPI traceWriterThreadMain(void *user) {
+	unsigned droppedReported = 0;
+
+	while (traceEnabled) {
+		traceFlush();
+		unsigned dropped = traceDroppedCount();
+		if (dropped != droppedReported) {
+			printf("(%u trace records dropped)\n", dropped - droppedReported);
+			droppedReported = dropped;
+		}
+		Sleep(50);
+	}
+	return 0;
+}
+
+void stopTraceRecording() {
+	if (!traceWriterThread)
+		return;
+	traceEnabled = false;
+	WaitForSingleObject(traceWriterThread, 1000);
+	traceClose();
+	traceWriterThread = NULL;
+}
+
+/**
+ * Saves the keystroke statistics (see keyStats)
+ * returns `false` if the file could not be written
+ **/
+bool saveKeyStatistics() {
+	EnterCriticalSection(&keyStatsFileLock);
+	bool saved = keyStatsWriteCsv(keyStatsCsvFile);
+	LeaveCriticalSection(&keyStatsFileLock);
+	return saved;
+}
+
+/**
+ * Saves the keystroke statistics every keyStatsInterval minutes
+ **/
+DWORD WINAPI keyStatsWriterThreadMain(void *user) {
+	while (true) {
+		Sleep((keyStatsInterval > 0 ? keyStatsInterval : 10) * 60000);
+		if (!saveKeyStatistics())
+			printf("\n%s konnte nicht geschrieben werden.\n", keyStatsCsvFile);
+	}
+	return 0;
+}
+
 BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
 	switch (fdwCtrlType) {
 		// Handle the Ctrl-c signal.
@@ -236,6 +174,7 @@ BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
 				return TRUE;
 			} else {
 				printf("Exit\n\n");
+				stopTraceRecording();
 				trayicon_remove();
 				return FALSE;
 			}
@@ -243,6 +182,7 @@ BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
 		// Remove tray icon when terminal (debug window) is being closed
 		case CTRL_CLOSE_EVENT:
 			printf("Exit\n\n");
+			stopTraceRecording();
 			trayicon_remove();
 			return FALSE;
 
@@ -275,457 +215,43 @@ void str2wcs(TCHAR *dest, char *src, size_t n) {
 	wcsncpy(dest, result, pos);
 }
 
-void handleTapNextReleaseKey(int keyCode, bool isKeyUp) {
-	KBDLLHOOKSTRUCT tapNextReleaseKey;
-	// memset(&tapNextReleaseKey, 0, sizeof(tapNextReleaseKey));
-	switch(keyCode) {
-		case MT_CTRL:
-			// simulate ctrl key pressed or released
-			tapNextReleaseKey.vkCode = VK_LCONTROL;
-			tapNextReleaseKey.scanCode = 29;
-			tapNextReleaseKey.flags = 0;
-			handleSystemKey(tapNextReleaseKey, isKeyUp);
-			break;
-		case MT_SHIFT:
-			// simulate shift key pressed or released
-			tapNextReleaseKey.vkCode = VK_SHIFT;
-			handleShiftKey(tapNextReleaseKey, isKeyUp);
-			break;
-		case MT_MOD3:
-			// simulate mod3Key pressed or released
-			tapNextReleaseKey.scanCode = scanCodeMod3L;
-			handleMod3Key(tapNextReleaseKey, isKeyUp);
-			handleMod3Key(tapNextReleaseKey, isKeyUp);
-			break;
-		case MT_MOD4:
-			// simulate mod4Key pressed or released
-			tapNextReleaseKey.scanCode = scanCodeMod4L;
-			handleMod4Key(tapNextReleaseKey, isKeyUp);
-			break;
-		case MT_ALT:
-			// simulate alt key pressed or released
-			tapNextReleaseKey.vkCode = VK_LMENU;
-			/* tapNextReleaseKey.scanCode = 29; */
-			tapNextReleaseKey.flags = 0;
-			handleSystemKey(tapNextReleaseKey, isKeyUp);
-			break;
-		case MT_WIN:
-			// simulate windows key pressed or released
-			tapNextReleaseKey.vkCode = VK_LWIN;
-			/* tapNextReleaseKey.scanCode = 29; */
-			tapNextReleaseKey.flags = 0;
-			handleSystemKey(tapNextReleaseKey, isKeyUp);
-			break;
-	}
-}
-
-void appendToQueue(KBDLLHOOKSTRUCT keyInfo) {
-	// only keyDown events
-	if (keyQueueLength && keyInfo.scanCode == keyQueue[keyQueueLast].scanCode)
-		return;
-	if (keyQueueLast >= QUEUE_SIZE - 1)
-		cleanupKeyQueue();
-	keyQueueLast++;
-	keyQueueLength++;
-	int character = MapVirtualKeyA(keyInfo.vkCode, MAPVK_VK_TO_CHAR);
-	int tapNextRelease = mappingTapNextRelease[keyInfo.scanCode];
-	SetConsoleTextAttribute(hConsole, FG_GRAY);
-	printf("Append key '%c%s%s' to queue at index %i ", character, tapNextRelease ? "|" : "", MT_MODIFIER_STRING[tapNextRelease], keyQueueLast);
-	if (keyQueueLength == 1)
-		printf("(1 key is pressed)\n");
-	else if (keyQueueLength > 1)
-		printf("(%i keys are pressed)\n", keyQueueLength);
-	else
-		printf("\n");
-	SetConsoleTextAttribute(hConsole, FG_WHITE);
-	// printf("keyQueueFirst: %i, keyQueueLast: %i, keyQueueLength: %i\n", keyQueueFirst, keyQueueLast, keyQueueLength);
-	keyQueue[keyQueueLast] = keyInfo;
-	keyQueueStatus[keyQueueLast] = tapNextRelease ? 2 : 1;
-}
-
-// returns true, key release has been handled
-bool checkQueue(KBDLLHOOKSTRUCT keyInfo) {
-	// only keyUp events
-	// definiton: tap = press + release
-	bool keyFoundInQueue = false;
-	int i = keyQueueFirst;
-	while (i <= keyQueueLast) {
-		// find released key in queue
-		if (keyQueueStatus[i] > 0 && keyInfo.scanCode == keyQueue[i].scanCode) {
-			keyFoundInQueue = true;
-			// printf("Key released is at index %i in queue.\n", i);
-			// no matter what type of key it is:
-			// check if keys in the queue pressed earlier are unactivated tap-next-release keys
-			for (int j=keyQueueFirst; j<i; j++) {
-				if (keyQueueStatus[j] == 2) {
-					// send key down for tap-next-release function of this key
-					handleTapNextReleaseKey(mappingTapNextRelease[keyQueue[j].scanCode], false);
-					// update status (mark as activated)
-					keyQueueStatus[j] = 3;
-				}
-			}
-			// depending on key type
-			if (keyQueueStatus[i] <= 2) {
-				// regular key (no tap-next-release function) or
-				// tap-next-release key which has not been activated
-				updateStatesAndWriteKey(keyQueue[i], false); // key down
-				// release key
-				keyQueue[i].flags += 0x80;
-				// TODO: Es wäre besser hier down und up auf einmal zu senden, damit notwendige Modifier nicht zweimal gesendet werden.
-				updateStatesAndWriteKey(keyQueue[i], true); // key up
-			} else {
-				// tap-next-release key which was activated
-				// send key up for alternative mapping
-				handleTapNextReleaseKey(mappingTapNextRelease[keyQueue[i].scanCode], true);
-			}
-			// set status to 0 (=handled)
-			keyQueueStatus[i] = 0;
-			int character = MapVirtualKeyA(keyInfo.vkCode, MAPVK_VK_TO_CHAR);
-			int tapNextRelease = mappingTapNextRelease[keyInfo.scanCode];
-			SetConsoleTextAttribute(hConsole, FG_GRAY);
-			printf("Remove key '%c%s%s' from queue at index %i ", character, tapNextRelease ? "|" : "", MT_MODIFIER_STRING[tapNextRelease], i);
-			if (keyQueueLength-1 == 1)
-				printf("(1 key is pressed)\n");
-			else if (keyQueueLength-1 > 1)
-				printf("(%i keys are pressed)\n", keyQueueLength);
-			else
-				printf("\n");
-			SetConsoleTextAttribute(hConsole, FG_WHITE);
-			// if beginning of queue, move it to next tap-next-release key
-			if (i == keyQueueFirst) {
-				// queue always begins with tap-next-release keys
-				// for (int j=i+1; j<keyQueueLast; j++) {
-				int j = i + 1;
-				while (j <= keyQueueLast) {
-					if (keyQueueStatus[j] >= 2) {
-						// make this position the beginning of the queue
-						keyQueueFirst = j;
-						keyQueueLength--;
-						break;
-					} else if (keyQueueStatus[j] == 1) {
-						// press this key (key down was held back, now it does not depend of other key states anymore)
-						updateStatesAndWriteKey(keyQueue[j], false); // key down
-						keyQueueLength--;
-					}
-					j++;
-				}
-				if (j > keyQueueLast)
-					resetKeyQueue();
-			} else if (i == keyQueueLast) {
-				int j = i - 1;
-				while (j >= keyQueueFirst) {
-					if (keyQueueStatus[j] > 0) {
-						keyQueueLength--;
-						keyQueueLast = j;
-						break;
-					}
-					j--;
-				}
-				if (j < keyQueueFirst)
-					resetKeyQueue();
-			} else {
-				// key released was neither first nor last in queue
-				keyQueueLength--;
-			}
-			break;
-		}
-		i++;
-	}
-	// if (keyFoundInQueue) {
-	// 	printf("keyQueueFirst: %i, keyQueueLast: %i, keyQueueLength: %i\n", keyQueueFirst, keyQueueLast, keyQueueLength);
-	// }
-	return keyFoundInQueue;
+/**
+ * Platform layer for the remapping core (see core.h)
+ **/
+uint64_t latencyNow() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
 }
 
-void mapLevels_2_5_6(TCHAR * mappingTableOutput, TCHAR * newChars) {
-	TCHAR * l1_lowercase = L"abcdefghijklmnopqrstuvwxyzäöüß.,";
-
-	TCHAR *ptr;
-	for (int i = 0; i < LEN; i++) {
-		ptr = wcschr(l1_lowercase, mappingTableLevel1[i]);
-		if (ptr != NULL && ptr < &l1_lowercase[32]) {
-			//printf("i = %d: mappingTableLevel1[i] = %c; ptr = %d; ptr = %s; index = %d\n", i, mappingTableLevel1[i], ptr, ptr, ptr-l1_lowercase+1);
-			mappingTableOutput[i] = newChars[ptr-l1_lowercase];
-		}
-	}
+void *currentKeyboardLayout() {
+	return GetKeyboardLayout(0);
 }
 
-void initLevel4SpecialCases() {
-	mappingTableLevel4Special[16] = VK_PRIOR;
-
-	if (strcmp(layout, "kou") == 0 || strcmp(layout, "vou") == 0) {
-		mappingTableLevel4Special[17] = VK_NEXT;
-		mappingTableLevel4Special[18] = VK_UP;
-		mappingTableLevel4Special[19] = VK_BACK;
-		mappingTableLevel4Special[20] = VK_DELETE;
-	} else {
-		mappingTableLevel4Special[17] = VK_BACK;
-		mappingTableLevel4Special[18] = VK_UP;
-		mappingTableLevel4Special[19] = VK_DELETE;
-		mappingTableLevel4Special[20] = VK_NEXT;
-	}
-
-	mappingTableLevel4Special[30] = VK_HOME;
-	mappingTableLevel4Special[31] = VK_LEFT;
-	mappingTableLevel4Special[32] = VK_DOWN;
-	mappingTableLevel4Special[33] = VK_RIGHT;
-	mappingTableLevel4Special[34] = VK_END;
-
-	if (strcmp(layout, "kou") == 0 || strcmp(layout, "vou") == 0) {
-		mappingTableLevel4Special[44] = VK_INSERT;
-		mappingTableLevel4Special[45] = VK_TAB;
-		mappingTableLevel4Special[46] = VK_RETURN;
-		mappingTableLevel4Special[47] = VK_ESCAPE;
-	} else {
-		mappingTableLevel4Special[44] = VK_ESCAPE;
-		mappingTableLevel4Special[45] = VK_TAB;
-		mappingTableLevel4Special[46] = VK_INSERT;
-		mappingTableLevel4Special[47] = VK_RETURN;
-	}
-
-	mappingTableLevel4Special[57] = '0'; // space bar
-
-	/** numeric keypad
-	 * --------------------
-	 * dec hex extended bit
-	 *  28  1C 1   Enter
-	 *  53  35 1   /
-	 *  55  37 0   *
-	 *  71  47 0   7 and Home
-	 *  74  4A 0   -
-	 *  75  4B 0   4 and Left
-	 *  76  4C 0   5
-	 *  77  4D 0   6 and Right
-	 *  78  4E 0   +
-	 *  79  4F 0   1 and End
-	 *  80  50 0   2 and Down
-	 *  81  51 0   3 and PgDn
-	 *  82  52 0   0 and Ins
-	 *  83  53 0   , and Del
-	 */
-	mappingTableLevel4Special[71] = VK_HOME;
-	mappingTableLevel4Special[72] = VK_UP;
-	mappingTableLevel4Special[73] = VK_PRIOR;
-	mappingTableLevel4Special[75] = VK_LEFT;
-	mappingTableLevel4Special[76] = VK_ESCAPE; // not sure about this one
-	mappingTableLevel4Special[77] = VK_RIGHT;
-	mappingTableLevel4Special[79] = VK_END;
-	mappingTableLevel4Special[80] = VK_DOWN;
-	mappingTableLevel4Special[81] = VK_NEXT;
-	mappingTableLevel4Special[82] = VK_INSERT;
-	mappingTableLevel4Special[83] = VK_DELETE;
-}
-
-void initCharacterToScanCodeMap() {
-	mapCharacterToScanCode['q'] = 0x10;
-	mapCharacterToScanCode['w'] = 0x11;
-	mapCharacterToScanCode['e'] = 0x12;
-	mapCharacterToScanCode['r'] = 0x13;
-	mapCharacterToScanCode['t'] = 0x14;
-	mapCharacterToScanCode['z'] = 0x15;
-	mapCharacterToScanCode['u'] = 0x16;
-	mapCharacterToScanCode['i'] = 0x17;
-	mapCharacterToScanCode['o'] = 0x18;
-	mapCharacterToScanCode['p'] = 0x19;
-	mapCharacterToScanCode[0xfc] = 0x1a; // ü
-	mapCharacterToScanCode['+'] = 0x1b;
-	mapCharacterToScanCode['a'] = 0x1e;
-	mapCharacterToScanCode['s'] = 0x1f;
-	mapCharacterToScanCode['d'] = 0x20;
-	mapCharacterToScanCode['f'] = 0x21;
-	mapCharacterToScanCode['g'] = 0x22;
-	mapCharacterToScanCode['h'] = 0x23;
-	mapCharacterToScanCode['j'] = 0x24;
-	mapCharacterToScanCode['k'] = 0x25;
-	mapCharacterToScanCode['l'] = 0x26;
-	mapCharacterToScanCode[0xf6] = 0x27; // ö
-	mapCharacterToScanCode[0xe4] = 0x28; // ä
-	mapCharacterToScanCode['y'] = 0x2c;
-	mapCharacterToScanCode['x'] = 0x2d;
-	mapCharacterToScanCode['c'] = 0x2e;
-	mapCharacterToScanCode['v'] = 0x2f;
-	mapCharacterToScanCode['b'] = 0x30;
-	mapCharacterToScanCode['n'] = 0x31;
-	mapCharacterToScanCode['m'] = 0x32;
-	mapCharacterToScanCode[','] = 0x33;
-	mapCharacterToScanCode['.'] = 0x34;
-	mapCharacterToScanCode['-'] = 0x35;
-}
-
-void initLayout() {
-	// same for all layouts
-	wcscpy(mappingTableLevel1 +  2, L"1234567890-`");
-	wcscpy(mappingTableLevel1 + 71, L"789-456+1230.");
-	mappingTableLevel1[57] = L' '; // Spacebar → space
-	mappingTableLevel1[69] = L'\t'; // NumLock key → tabulator
-
-	mappingTableLevel2[41] = L'\u030C'; // key to the left of the "1" key, "Combining Caron"
-	wcscpy(mappingTableLevel2 +  2, L"°§ℓ»«$€„“”—̧");
-	wcscpy(mappingTableLevel2 + 71, L"✔✘†-♣€‣+♦♥♠␣."); // numeric keypad
-	mappingTableLevel2[57] = L' '; // Spacebar → space
-	mappingTableLevel2[69] = L'\t'; // NumLock key → tabulator
-	// https://neo-layout.org/grafik/aufsteller/neo20-aufsteller.pdf
-
-	wcscpy(mappingTableLevel3 + 41, L"^");
-	wcscpy(mappingTableLevel3 +  2, L"¹²³›‹¢¥‚‘’—̊");
-	wcscpy(mappingTableLevel3 + 16, L"…_[]^!<>=&ſ");
-	mappingTableLevel3[27] = L'\u0337'; // "Combining Short Solidus Overlay"
-	wcscpy(mappingTableLevel3 + 30, L"\\/{}*?()-:@");
-	wcscpy(mappingTableLevel3 + 44, L"#$|~`+%\"';");
-	wcscpy(mappingTableLevel3 + 71, L"↕↑↨−←:→±↔↓⇌%,"); // numeric keypad
-	mappingTableLevel3[55] = L'⋅'; // *-key on numeric keypad
-	mappingTableLevel3[57] = L' '; // Spacebar → space
-	mappingTableLevel3[69] = L'='; // num-lock-key
-
-	mappingTableLevel4[41] = L'\u0307'; // "Combining Dot Above"
-	wcscpy(mappingTableLevel4 +  2, L"ªº№⋮·£¤0/*-");
-	mappingTableLevel4[13] = L'\u00A8'; // "Diaresis"
-	wcscpy(mappingTableLevel4 + 21, L"¡789+−˝");
-	wcscpy(mappingTableLevel4 + 35, L"¿456,.");
-	wcscpy(mappingTableLevel4 + 49, L":123;");
-	mappingTableLevel4[55] = L'×'; // *-key on numeric keypad
-	mappingTableLevel4[74] = L'∖'; // --key on numeric keypad
-	mappingTableLevel4[78] = L'∓'; // +-key on numeric keypad
-	mappingTableLevel4[69] = L'≠'; // num-lock-key
-
-	// layout dependent
-	if (strcmp(layout, "adnw") == 0) {
-		wcscpy(mappingTableLevel1 + 16, L"kuü.ävgcljf´");
-		wcscpy(mappingTableLevel1 + 30, L"hieaodtrnsß");
-		wcscpy(mappingTableLevel1 + 44, L"xyö,qbpwmz");
-
-	} else if (strcmp(layout, "adnwzjf") == 0) {
-		wcscpy(mappingTableLevel1 + 16, L"kuü.ävgclßz´");
-		wcscpy(mappingTableLevel1 + 30, L"hieaodtrnsf");
-		wcscpy(mappingTableLevel1 + 44, L"xyö,qbpwmj");
-
-	} else if (strcmp(layout, "bone") == 0) {
-		wcscpy(mappingTableLevel1 + 16, L"jduaxphlmwß´");
-		wcscpy(mappingTableLevel1 + 30, L"ctieobnrsgq");
-		wcscpy(mappingTableLevel1 + 44, L"fvüäöyz,.k");
-
-	} else if (strcmp(layout, "koy") == 0) {
-		wcscpy(mappingTableLevel1 + 16, L"k.o,yvgclßz´");
-		wcscpy(mappingTableLevel1 + 30, L"haeiudtrnsf");
-		wcscpy(mappingTableLevel1 + 44, L"xqäüöbpwmj");
-
-	} else if (strcmp(layout, "kou") == 0
-				|| strcmp(layout, "vou") == 0) {
-		if (strcmp(layout, "kou") == 0) {
-			wcscpy(mappingTableLevel1 + 16, L"k.ouäqgclfj´");
-			wcscpy(mappingTableLevel1 + 30, L"haeiybtrnsß");
-			wcscpy(mappingTableLevel1 + 44, L"zx,üöpdwmv");
-		} else {  // vou
-			wcscpy(mappingTableLevel1 + 16, L"v.ouäqglhfj´");
-			wcscpy(mappingTableLevel1 + 30, L"caeiybtrnsß");
-			wcscpy(mappingTableLevel1 + 44, L"zx,üöpdwmk");
-			/* mappingTapNextRelease[0x3A] = MT_SHIFT; // CapsLock */
-			/* mappingTapNextRelease[0x28] = MT_SHIFT; // Ä */
-		}
-
-		wcscpy(mappingTableLevel3 + 16, L"@%{}^!<>=&€̷");
-		wcscpy(mappingTableLevel3 + 30, L"|`()*?/:-_→");
-		wcscpy(mappingTableLevel3 + 44, L"#[]~$+\"'\\;");
-
-		wcscpy(mappingTableLevel4 +  4, L"✔✘·£¤0/*-¨");
-		wcscpy(mappingTableLevel4 + 21, L":789+−˝");
-		wcscpy(mappingTableLevel4 + 35, L"-456,;");
-		wcscpy(mappingTableLevel4 + 49, L"_123.");
-
-	} else if (strcmp(layout, "qwertz") == 0) {
-		wcscpy(mappingTableLevel1 + 12, L"ß");
-		wcscpy(mappingTableLevel1 + 16, L"qwertzuiopü+");
-		wcscpy(mappingTableLevel1 + 30, L"asdfghjklöä");
-		wcscpy(mappingTableLevel1 + 44, L"yxcvbnm,.-");
-
-	} else { // neo
-		wcscpy(mappingTableLevel1 + 16, L"xvlcwkhgfqß´");
-		wcscpy(mappingTableLevel1 + 30, L"uiaeosnrtdy");
-		wcscpy(mappingTableLevel1 + 44, L"üöäpzbm,.j");
-	}
-
-	// use custom layout if it was defined
-	if (wcslen(customLayoutWcs) != 0) {
-		if (wcslen(customLayoutWcs) == 32) {
-			// custom layout
-			wcsncpy(mappingTableLevel1 + 16, customLayoutWcs, 11);
-			wcsncpy(mappingTableLevel1 + 30, customLayoutWcs + 11, 11);
-			wcsncpy(mappingTableLevel1 + 44, customLayoutWcs + 22, 10);
-		} else {
-			printf("\ncustomLayout given but its length is %i (expected: 32).\n", wcslen(customLayoutWcs));
-		}
-	}
-
-	// same for all layouts
-	wcscpy(mappingTableLevel1 + 27, L"´");
-	wcscpy(mappingTableLevel2 + 27, L"~");
-	// slash key is special: it has the same scan code in the main block and the numpad
-	wcscpy(numpadSlashKey, L"//÷∕⌀∣");
-
-	// map letters of level 2
-	TCHAR * charsLevel2;
-	charsLevel2 = L"ABCDEFGHIJKLMNOPQRSTUVWXYZÄÖÜẞ•–";
-	mapLevels_2_5_6(mappingTableLevel2, charsLevel2);
-
-	if (supportLevels5and6) {
-		// map main block on levels 5 and 6
-		// (Neo does not define characters for u, v and ü on level 5.)
-		TCHAR * charsLevel5 = L"αβχδεφγψιθκλμνοπϕρστuvωξυζηϵüςϑϱ";  // a-zäöüß.,
-		mapLevels_2_5_6(mappingTableLevel5, charsLevel5);
-		TCHAR * charsLevel6 = L"∀⇐ℂΔ∃ΦΓΨ∫Θ⨯Λ⇔ℕ∈ΠℚℝΣ∂⊂√ΩΞ∇ℤℵ∩∪∘↦⇒";  // a-zäöüß.,
-		mapLevels_2_5_6(mappingTableLevel6, charsLevel6);
-
-		// add number row and dead key in upper letter row
-		mappingTableLevel5[41] = L'\u0309'; // "Combining Hook Above"
-		wcscpy(mappingTableLevel5 +  2, L"₁₂₃♂♀⚥ϰ⟨⟩₀?");
-		mappingTableLevel5[13] = L'\u1FFE'; // "Greek Dasia"
-		mappingTableLevel5[27] = L'\u1FBF'; // "Greek Psili"
-		mappingTableLevel5[57] = L'\u00A0'; // space = no-break space
-		wcscpy(mappingTableLevel5 + 71, L"≪∩≫⊖⊂⊶⊃⊕≤∪≥‰′"); // numeric keypad
-
-		wcscpy(mappingTableLevel5 + 55, L"⊙");  // *-key on numeric keypad
-		wcscpy(mappingTableLevel5 + 69, L"≈");  // num-lock-key
-
-		mappingTableLevel6[41] = L'\u0323'; // "Combining Dot Below"
-		wcscpy(mappingTableLevel6 +  2, L"¬∨∧⊥∡∥→∞∝⌀?");
-		mappingTableLevel6[13] = L'\u0304'; // "Combining Macron"
-		wcscpy(mappingTableLevel6 + 27, L"˘");
-		mappingTableLevel6[57] = 0x202f;  // space = narrow no-break space
-		wcscpy(mappingTableLevel6 + 71, L"⌈⋂⌉∸⊆⊷⊇∔⌊⋃⌋□"); // numeric keypad
-		mappingTableLevel6[83] = 0x02dd; // double acute accent (not sure about this one)
-		wcscpy(mappingTableLevel6 + 55, L"⊗");  // *-key on numeric keypad
-		wcscpy(mappingTableLevel6 + 69, L"≡");  // num-lock-key
-	}
-
-	// if quote/ä is the right level 3 modifier, copy symbol of quote/ä key to backslash/# key
-	if (quoteAsMod3R) {
-		mappingTableLevel1[43] = mappingTableLevel1[40];
-		mappingTableLevel2[43] = mappingTableLevel2[40];
-		mappingTableLevel3[43] = mappingTableLevel3[40];
-		mappingTableLevel4[43] = mappingTableLevel4[40];
-		if (supportLevels5and6) {
-			mappingTableLevel5[43] = mappingTableLevel5[40];
-			mappingTableLevel6[43] = mappingTableLevel6[40];
-		}
-	}
-
-	mappingTableLevel2[8] = 0x20AC;  // €
-
-	// level4 special cases
-	initLevel4SpecialCases();
-
-	// apply modTap modifiers
-	// puts("\nModTap keys:");
-	for (int i=0; i<MOD_TAP_LEN && modTap[i].modifier; i++) {
-		unsigned int scanCode = mapCharacterToScanCode[(unsigned char)modTap[i].keycode];
-		mappingTapNextRelease[scanCode] = modTap[i].modifier;
-		// printf("%s (%i), %c (%i), sc=0x%X (%i)\n", MT_MODIFIER_STRING[modTap[i].modifier], modTap[i].modifier, modTap[i].keycode, (unsigned char)modTap[i].keycode, scanCode, scanCode);
-    }
+SHORT keyScanForLayout(TCHAR key, void *keyboardLayout) {
+	return VkKeyScanEx(key, keyboardLayout);
 }
 
-void toggleBypassMode() {
-	bypassMode = !bypassMode;
-
+/**
+ * Bypass mode removes the hook, so key events reach the applications without
+ * any detour. Meanwhile Shift+Pause is a hot key of the hook thread. Caps Lock
+ * presses are not seen then, the locks are synchronized when the hook is back.
+ * Everything runs on the hook thread, the tray menu posts WM_TOGGLE_BYPASS.
+ **/
+#define WM_TOGGLE_BYPASS (WM_APP + 1)       // from the tray menu
+#define WM_UPDATE_BYPASS_HOOK (WM_APP + 2)  // bypassMode has changed
+#define WM_UPDATE_RAW_INPUT (WM_APP + 3)    // the settings have been reloaded (see updateRawInput())
+#define BYPASS_HOTKEY_ID 1
+#ifndef MOD_NOREPEAT
+#define MOD_NOREPEAT 0x4000
+#endif
+DWORD hookThreadId;
+HANDLE settingsTaken;  // auto reset, set when the hook thread uses the last reloaded settings (see reloadSettings())
+bool hookRemoved = false;                  // by bypass mode
+bool capsLockWhenRemoved;
+bool autoBypass = false;                   // bypass mode was switched on by bypassApps
+
+void bypassModeChanged() {
 	HINSTANCE hInstance = GetModuleHandle(NULL);
 	HICON icon = bypassMode
 		? LoadIcon(hInstance, MAKEINTRESOURCE(IDI_APPICON_DISABLED))
@@ -733,234 +259,102 @@ void toggleBypassMode() {
 
 	trayicon_change_icon(icon);
 	printf("%i bypass mode \n", bypassMode);
+	autoBypass = false;
+	// not while the hook callback is still running
+	PostThreadMessage(hookThreadId, WM_UPDATE_BYPASS_HOOK, 0, 0);
 }
 
-/**
- * Map a key scancode to the char that should be displayed after typing
- **/
-TCHAR mapScanCodeToChar(unsigned level, char in) {
-	switch (level) {
-		case 2:
-			return mappingTableLevel2[in];
-		case 3:
-			return mappingTableLevel3[in];
-		case 4:
-			return mappingTableLevel4[in];
-		case 5:
-			return mappingTableLevel5[in];
-		case 6:
-			return mappingTableLevel6[in];
-		default: // level 1
-			return mappingTableLevel1[in];
-	}
+void requestBypassToggle() {
+	PostThreadMessage(hookThreadId, WM_TOGGLE_BYPASS, 0, 0);
 }
 
 /**
- * Maps keyInfo flags (https://docs.microsoft.com/en-us/windows/win32/api/winuser/ns-winuser-kbdllhookstruct)
- * to dwFlags for keybd_event (https://docs.microsoft.com/en-us/windows/win32/api/winuser/nf-winuser-keybd_event)
+ * All our key events carry this signature in dwExtraInfo, so the hook passes
+ * them on at once when they come back to it
  **/
-DWORD dwFlagsFromKeyInfo(KBDLLHOOKSTRUCT keyInfo) {
-	DWORD dwFlags = 0;
-	if (keyInfo.flags & LLKHF_EXTENDED) dwFlags |= KEYEVENTF_EXTENDEDKEY;
-	if (keyInfo.flags & LLKHF_UP) dwFlags |= KEYEVENTF_KEYUP;
-	return dwFlags;
-}
-
-void sendDown(BYTE vkCode, BYTE scanCode, bool isExtendedKey) {
-	keybd_event(vkCode, scanCode, (isExtendedKey ? KEYEVENTF_EXTENDEDKEY : 0), 0);
-}
-
-void sendUp(BYTE vkCode, BYTE scanCode, bool isExtendedKey) {
-	keybd_event(vkCode, scanCode, (isExtendedKey ? KEYEVENTF_EXTENDEDKEY : 0) | KEYEVENTF_KEYUP, 0);
-}
+#define OWN_EXTRA_INFO 0x6E656F6B // "neok"
 
-void sendDownUp(BYTE vkCode, BYTE scanCode, bool isExtendedKey) {
-	sendDown(vkCode, scanCode, isExtendedKey);
-	sendUp(vkCode, scanCode, isExtendedKey);
+/**
+ * Sends the key events with a single SendInput call
+ **/
+void sendOutputs(const KeyOutput *outputs, int count) {
+	INPUT inputs[OUTPUT_BUFFER_SIZE];
+	for (int i = 0; i < count; i++) {
+		inputs[i].type = INPUT_KEYBOARD;
+		inputs[i].ki.wVk = outputs[i].vkCode;
+		inputs[i].ki.wScan = outputs[i].scanCode;
+		inputs[i].ki.dwFlags = outputs[i].flags;
+		inputs[i].ki.time = 0;
+		inputs[i].ki.dwExtraInfo = OWN_EXTRA_INFO;
+	}
+	SendInput(count, inputs, sizeof(INPUT));
 }
 
-void sendUnicodeChar(TCHAR key, KBDLLHOOKSTRUCT keyInfo) {
-	KEYBDINPUT kb={0};
-	INPUT Input={0};
-
-	kb.wScan = key;
-	kb.dwFlags = KEYEVENTF_UNICODE | dwFlagsFromKeyInfo(keyInfo);
-	Input.type = INPUT_KEYBOARD;
-	Input.ki = kb;
-	SendInput(1, &Input, sizeof(Input));
-}
+bool injectionDropped = false; // events were dropped, the core state is reset once the queue is sent (hook thread only)
 
 /**
- * Sends a char using emulated keyboard input
- * This works for most cases, but not for dead keys etc
+ * Hook thread: hands the key events to the injector thread
  **/
-void sendChar(TCHAR key, KBDLLHOOKSTRUCT keyInfo) {
-	SHORT keyScanResult = VkKeyScanEx(key, GetKeyboardLayout(0));
-
-	if (keyScanResult == -1 || shiftLockActive || capsLockActive || level4LockActive
-		|| (keyInfo.vkCode >= 0x30 && keyInfo.vkCode <= 0x39)) {
-		// key not found in the current keyboard layout or shift lock is active
-		//
-		// If shiftLockActive is true, a unicode letter will be sent. This implies
-		// that shortcuts don't work in shift lock mode. That's good, because
-		// people might not be aware that they would send Ctrl-S instead of
-		// Ctrl-s. Sending a unicode letter makes it possible to undo shift
-		// lock temporarily by holding one shift key because that way the
-		// shift key won't be sent.
-		//
-		// Furthermore, use unicode for number keys.
-		sendUnicodeChar(key, keyInfo);
-	} else {
-		keyInfo.vkCode = keyScanResult & 0xff;
-		char modifiers = keyScanResult >> 8;
-		bool shift = ((modifiers & 1) != 0);
-		bool alt = ((modifiers & 2) != 0);
-		bool ctrl = ((modifiers & 4) != 0);
-		bool altgr = alt && ctrl;
-		if (altgr) {
-			ctrl = false;
-			alt = false;
+void queueInjection(const KeyOutput *outputs, int count) {
+	// the queue is only full if injection is stalled for a long time. Waiting for it
+	// would stall the hook until Windows drops it, sending now would overtake the queue.
+	// The key ups still go into the reserve, so no key stays held in the system.
+	if (!injectionPush(outputs, count, false)) {
+		KeyOutput keyUps[OUTPUT_BUFFER_SIZE];
+		int keyUpCount = 0;
+		for (int i = 0; i < count && keyUpCount < OUTPUT_BUFFER_SIZE; i++) {
+			if (outputs[i].flags & KEYEVENTF_KEYUP)
+				keyUps[keyUpCount++] = outputs[i];
 		}
-
-		if (altgr) sendDown(VK_RMENU, 56, true);
-		if (ctrl) sendDown(VK_CONTROL, 29, false);
-		if (alt) sendDown(VK_MENU, 56, false); // ALT
-		if (shift) sendDown(VK_SHIFT, 42, false);
-
-		keybd_event(keyInfo.vkCode, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo), keyInfo.dwExtraInfo);
-
-		if (altgr) sendUp(VK_RMENU, 56, true);
-		if (ctrl) sendUp(VK_CONTROL, 29, false);
-		if (alt) sendUp(VK_MENU, 56, false); // ALT
-		if (shift) sendUp(VK_SHIFT, 42, false);
+		if (!injectionPush(keyUps, keyUpCount, true))
+			keyUpCount = 0;
+		latencyRecordDroppedEvents(count - keyUpCount); // shown in the latency statistics
+		injectionDropped = true;
 	}
+	SetEvent(injectorWakeup);
 }
 
 /**
- * Send a usually dead key by injecting space after (on down).
- * This will add an actual space if actual dead key is followed by "dead" key with this
+ * Sends the queued key events in order, as many as possible with one SendInput call.
+ * Our own events pass the hook again on the hook thread, which ignores injected events.
  **/
-void commitDeadKey(KBDLLHOOKSTRUCT keyInfo) {
-	if (!(keyInfo.flags & LLKHF_UP)) sendDownUp(VK_SPACE, 57, false);
-}
-
-bool handleLayer2SpecialCases(KBDLLHOOKSTRUCT keyInfo) {
-	switch(keyInfo.scanCode) {
-		case 27:
-			sendChar(L'\u0303', keyInfo);  // perispomene (Tilde)
-			return true;
-		case 41:
-			sendChar(L'\u030C', keyInfo);  // caron, wedge, háček (Hatschek)
-			return true;
-		default:
-			return false;
-	}
-}
-
-bool handleLayer3SpecialCases(KBDLLHOOKSTRUCT keyInfo) {
-	switch(keyInfo.scanCode) {
-		case 13:
-			sendChar(L'\u030A', keyInfo);  // overring
-			return true;
-		case 20:
-			sendUnicodeChar(L'^', keyInfo);
-			return true;
-		case 27:
-			sendChar(L'\u0337', keyInfo);  // bar (diakritischer Schrägstrich)
-			return true;
-		case 31:
-			if (strcmp(layout, "kou") == 0 || strcmp(layout, "vou") == 0) {
-				sendUnicodeChar(L'`', keyInfo);
-				return true;
-			}
-			return false;
-		case 48:
-			if (strcmp(layout, "kou") != 0 && strcmp(layout, "vou") != 0) {
-				sendUnicodeChar(L'`', keyInfo);
-				return true;
-			}
-			return false;
-		default:
-			return false;
-	}
-}
-
-bool handleLayer4SpecialCases(KBDLLHOOKSTRUCT keyInfo) {
-	// return if left Ctrl was injected by AltGr
-	if (keyInfo.scanCode == 541) return -1;
-
-	switch(keyInfo.scanCode) {
-		case 13:
-			sendChar(L'\u00A8', keyInfo);  // diaeresis, umlaut
-			return true;
-		case 27:
-			sendChar(L'\u02DD', keyInfo);  // double acute (doppelter Akut)
-			return true;
-		case 41:
-			sendChar(L'\u0307', keyInfo);  // dot above (Punkt, darüber)
-			return true;
-	}
-
-	// A second level 4 mapping table for special (non-unicode) keys.
-	// Maybe this could be included in the global TCHAR mapping table or level 4!?
-	BYTE bScan = 0;
-
-	if (mappingTableLevel4Special[keyInfo.scanCode] != 0) {
-		if (mappingTableLevel4Special[keyInfo.scanCode] == VK_RETURN)
-			bScan = 0x1c;
-		else if (mappingTableLevel4Special[keyInfo.scanCode] == VK_INSERT)
-			bScan = 0x52;
-
-		// extended flag (bit 0) is necessary for selecting text with shift + arrow
-		keybd_event(mappingTableLevel4Special[keyInfo.scanCode], bScan, dwFlagsFromKeyInfo(keyInfo) | KEYEVENTF_EXTENDEDKEY, 0);
-
-		return true;
+DWORD WINAPI injectorThreadMain(void *user) {
+	KeyOutput outputs[OUTPUT_BUFFER_SIZE];
+	while (true) {
+		WaitForSingleObject(injectorWakeup, INFINITE);
+		int count;
+		while ((count = injectionPop(outputs, OUTPUT_BUFFER_SIZE)) > 0) {
+			sendOutputs(outputs, count);
+			injectionSent(count);
+		}
 	}
-	return false;
-}
-
-bool isShift(KBDLLHOOKSTRUCT keyInfo) {
-	return keyInfo.vkCode == VK_SHIFT
-	    || keyInfo.vkCode == VK_LSHIFT
-	    || keyInfo.vkCode == VK_RSHIFT;
-}
-
-bool isMod3(KBDLLHOOKSTRUCT keyInfo) {
-	return keyInfo.scanCode == scanCodeMod3L
-	    || keyInfo.scanCode == scanCodeMod3R;
-}
-
-bool isMod4(KBDLLHOOKSTRUCT keyInfo) {
-	return keyInfo.scanCode == scanCodeMod4L
-	    || keyInfo.vkCode == VK_RMENU;
-}
-
-bool isSystemKeyPressed() {
-	return ctrlLeftPressed || ctrlRightPressed
-	    || altLeftPressed
-	    || winLeftPressed || winRightPressed;
-}
-
-bool isLetter(TCHAR key) {
-	return (key >= 65 && key <= 90  // A-Z
-	     || key >= 97 && key <= 122 // a-z
-	     || key == L'ä' || key == L'Ä'
-	     || key == L'ö' || key == L'Ö'
-	     || key == L'ü' || key == L'Ü'
-	     || key == L'ß' || key == L'ẞ');
+	return 0;
 }
 
-void toggleShiftLock() {
-	shiftLockActive = !shiftLockActive;
-	printf("Shift lock %s!\n", shiftLockActive ? "activated" : "deactivated");
+/**
+ * Sends the key events in the core's output buffer (or queues them for the injector thread)
+ **/
+void flushOutput() {
+	if (outputLength == 0)
+		return;
+	if (injectorThread)
+		queueInjection(outputBuffer, outputLength);
+	else
+		sendOutputs(outputBuffer, outputLength);
+	outputLength = 0;
 }
 
-void toggleCapsLock() {
-	capsLockActive = !capsLockActive;
-	printf("Caps lock %s!\n", capsLockActive ? "activated" : "deactivated");
-}
+/**
+ * Logger thread: format a key event record like
+ * "key down      | sc:030 vk:0x41 flags:0x00 extra:0 (A)"
+ **/
+void printKeyEventRecord(FILE *out, LogRecord *record) {
+	KBDLLHOOKSTRUCT keyInfo = {0};
+	keyInfo.scanCode = record->key.scanCode;
+	keyInfo.vkCode = record->key.vkCode;
+	keyInfo.flags = record->key.flags;
+	keyInfo.dwExtraInfo = record->key.extraInfo;
 
-void logKeyEvent(char *desc, KBDLLHOOKSTRUCT keyInfo, int color) {
 	char vkCodeLetter[4] = {'(', keyInfo.vkCode, ')', 0};
 	char *keyName;
 	switch (keyInfo.vkCode) {
@@ -1025,236 +419,304 @@ void logKeyEvent(char *desc, KBDLLHOOKSTRUCT keyInfo, int color) {
 			keyName = "";
 			//keyName = MapVirtualKeyA(keyInfo.vkCode, MAPVK_VK_TO_CHAR);
 	}
-	char *shiftLockCapsLockInfo = shiftLockActive ? " [shift lock active]"
-						: (capsLockActive ? " [caps lock active]" : "");
-	char *level4LockInfo = level4LockActive ? " [level4 lock active]" : "";
-	char *vkPacket = (desc=="injected" && keyInfo.vkCode == VK_PACKET) ? " (VK_PACKET)" : "";
+	char *shiftLockCapsLockInfo = (record->locks & LOG_SHIFT_LOCK) ? " [shift lock active]"
+						: ((record->locks & LOG_CAPS_LOCK) ? " [caps lock active]" : "");
+	char *level4LockInfo = (record->locks & LOG_LEVEL4_LOCK) ? " [level4 lock active]" : "";
+	char *vkPacket = ((keyInfo.flags & LLKHF_INJECTED) && keyInfo.vkCode == VK_PACKET) ? " (VK_PACKET)" : "";
 
-	if (color < 0)
-		color = FG_WHITE;
-	SetConsoleTextAttribute(hConsole, color);
-	printf(
+	fprintf(out,
 		"%-13s | sc:%03u vk:0x%02X flags:0x%02X extra:%d %s%s%s%s\n",
-		desc, keyInfo.scanCode, keyInfo.vkCode, keyInfo.flags, keyInfo.dwExtraInfo,
+		record->text, keyInfo.scanCode, keyInfo.vkCode, keyInfo.flags, (int)keyInfo.dwExtraInfo,
 		keyName, shiftLockCapsLockInfo, level4LockInfo, vkPacket
 	);
-	// reset color
-	SetConsoleTextAttribute(hConsole, FG_WHITE);
 }
 
-unsigned getLevel() {
-	unsigned level = 1;
-
-	if (modState.shift != shiftLockActive) // (modState.shift) XOR (shiftLockActive)
-		level = 2;
-	if (modState.mod3)
-		level = (supportLevels5and6 && level == 2) ? 5 : 3;
-	if (modState.mod4 != level4LockActive)
-		level = (supportLevels5and6 && level == 3) ? 6 : 4;
-
-	return level;
+void convertToUTF8(TCHAR *wide, char *utf8, int size) {
+	WideCharToMultiByte(CP_UTF8, 0, &wide[0], -1, &utf8[0], size, NULL, NULL);
 }
 
-void handleShiftKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
-	bool *pressedShift = keyInfo.vkCode == VK_RSHIFT ? &shiftRightPressed : &shiftLeftPressed;
-	bool *otherShift = keyInfo.vkCode == VK_RSHIFT ? &shiftLeftPressed : &shiftRightPressed;
-
-	modState.shift = !isKeyUp;
-	*pressedShift = !isKeyUp;
-
-	if (isKeyUp) {
-		if (*otherShift && !bypassMode) {
-			if (shiftLockEnabled) {
-				sendDownUp(VK_CAPITAL, 58, false);
-				toggleShiftLock();
-			} else if (capsLockEnabled) {
-				sendDownUp(VK_CAPITAL, 58, false);
-				toggleCapsLock();
-			}
+/**
+ * Logger thread: print one record
+ **/
+void printLogRecord(FILE *out, LogRecord *record) {
+	int character;
+	int tapNextRelease;
+	switch (record->type) {
+		case LOG_KEY_EVENT:
+			printKeyEventRecord(out, record);
+			break;
+		case LOG_LEVEL:
+			fprintf(out, "\nLEVEL %i\n", record->values[0]);
+			break;
+		case LOG_MAPPED: {
+			character = MapVirtualKeyA(record->key.vkCode, MAPVK_VK_TO_CHAR);
+			TCHAR keyUTF16[] = {record->values[0], 0};
+			char keyUTF8[8] = {0};
+			convertToUTF8(keyUTF16, keyUTF8, sizeof keyUTF8);
+			fprintf(out, "%-13s | sc:%03d %c->%s [0x%04X] (level %u)\n", record->text,
+				record->key.scanCode, character, keyUTF8, record->values[0], record->values[1]);
+			break;
 		}
-		sendUp(keyInfo.vkCode, keyInfo.scanCode, false);
-	} else { // key down
-		sendDown(keyInfo.vkCode, keyInfo.scanCode, false);
+		case LOG_QUEUE_APPEND:
+		case LOG_QUEUE_REMOVE:
+			character = MapVirtualKeyA(record->key.vkCode, MAPVK_VK_TO_CHAR);
+			tapNextRelease = record->values[0];
+			fprintf(out, "%s key '%c%s%s' %s queue at index %i ",
+				record->type == LOG_QUEUE_APPEND ? "Append" : "Remove",
+				character, tapNextRelease ? "|" : "", MT_MODIFIER_STRING[tapNextRelease],
+				record->type == LOG_QUEUE_APPEND ? "to" : "from", record->values[1]);
+			if (record->values[2] == 1)
+				fprintf(out, "(1 key is pressed)\n");
+			else if (record->values[2] > 1)
+				fprintf(out, "(%i keys are pressed)\n", record->values[2]);
+			else
+				fprintf(out, "\n");
+			break;
+		case LOG_QUEUE_STATUS:
+			fprintf(out, "\nkeyQueueStatus:");
+			for (int i = 0; i < record->itemCount; i++)
+				fprintf(out, " %i", record->items[i]);
+			fprintf(out, record->itemCount == LOG_ITEMS_LEN ? " ...\n" : "\n");
+			break;
+		case LOG_QUEUE_CLEANUP:
+			fprintf(out, record->text, record->values[0], record->values[1]);
+			break;
+		case LOG_MESSAGE:
+			fprintf(out, record->text, record->arg);
+			break;
 	}
 }
 
 /**
- * returns `true` if no systemKey was pressed -> continue execution, `false` otherwise
+ * Formats the records of the log buffer into the debug console and/or the
+ * log file. Runs with low priority, so it never competes with the hook thread.
  **/
-bool handleSystemKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
-	bool newStateValue = !isKeyUp;
-	DWORD dwFlags = isKeyUp ? KEYEVENTF_KEYUP : keyInfo.flags;
-
-	// Check also the scan code because AltGr sends VK_LCONTROL with scanCode 541
-	if (keyInfo.vkCode == VK_LCONTROL && keyInfo.scanCode == 29) {
-		if (swapLeftCtrlAndLeftAlt) {
-			altLeftPressed = newStateValue;
-			keybd_event(VK_LMENU, 56, dwFlags, 0);
-		} else if (swapLeftCtrlLeftAltAndLeftWin) {
-			winLeftPressed = newStateValue;
-			keybd_event(VK_LWIN, 91, dwFlags, 0);
-		} else {
-			ctrlLeftPressed = newStateValue;
-			keybd_event(VK_LCONTROL, 29, dwFlags, 0);
-		}
-		return false;
-	} else if (keyInfo.vkCode == VK_RCONTROL) {
-		ctrlRightPressed = newStateValue;
-		keybd_event(VK_RCONTROL, 29, dwFlags, 0);
-	} else if (keyInfo.vkCode == VK_LMENU) {
-		if (swapLeftCtrlAndLeftAlt || swapLeftCtrlLeftAltAndLeftWin) {
-			ctrlLeftPressed = newStateValue;
-			keybd_event(VK_LCONTROL, 29, dwFlags, 0);
-		} else {
-			altLeftPressed = newStateValue;
-			keybd_event(VK_LMENU, 56, dwFlags, 0);
+DWORD WINAPI loggerThreadMain(void *user) {
+	LogRecord record;
+	unsigned droppedReported = 0;
+
+	while (true) {
+		bool written = false;
+		while (logPop(&record)) {
+			if (logToStdout) {
+				SetConsoleTextAttribute(hConsole, record.color);
+				printLogRecord(stdout, &record);
+				// reset color
+				SetConsoleTextAttribute(hConsole, FG_WHITE);
+			}
+			if (logFileHandle)
+				printLogRecord(logFileHandle, &record);
+			written = true;
 		}
-		return false;
-	} else if (keyInfo.vkCode == VK_LWIN) {
-		if (swapLeftCtrlLeftAltAndLeftWin) {
-			altLeftPressed = newStateValue;
-			keybd_event(VK_LMENU, 56, dwFlags, 0);
-		} else {
-			winLeftPressed = newStateValue;
-			keybd_event(VK_LWIN, 91, dwFlags, 0);
+		unsigned dropped = logDroppedCount();
+		if (dropped != droppedReported) {
+			if (logToStdout)
+				printf("(%u log records dropped)\n", dropped - droppedReported);
+			if (logFileHandle)
+				fprintf(logFileHandle, "(%u log records dropped)\n", dropped - droppedReported);
+			droppedReported = dropped;
 		}
-		return false;
-	} else if (keyInfo.vkCode == VK_RWIN) {
-		winRightPressed = newStateValue;
-		keybd_event(VK_RWIN, 92, dwFlags, 0);
-		return false;
+		if (written && logFileHandle)
+			fflush(logFileHandle);
+		Sleep(10);
 	}
+	return 0;
+}
 
-	return true;
+/**
+ * Hook watchdog. Windows silently removes a low level hook, e.g. if the callback
+ * once took too long. Every WATCHDOG_INTERVAL the hook thread checks if there was
+ * input the hook has not seen (GetLastInputInfo also counts mouse input). Then it
+ * injects a probe event, which only has to reach the hook by the next check.
+ * All watchdog state is only used on the hook thread.
+ **/
+#define WATCHDOG_INTERVAL 2000               // ms
+#define WATCHDOG_MAX_BACKOFF 5               // wait at most 2^5 intervals after probes were lost
+#define WATCHDOG_PROBE_VK 0xE8               // unassigned virtual key
+#define WATCHDOG_PROBE_EXTRA_INFO 0x6E656F70 // "neop"
+DWORD lastHookEventTime;                     // GetTickCount() of the last event seen by the hook
+bool probePending = false;
+bool probeAnswered;
+unsigned probesLost = 0;                     // in a row; a reinstallation which does not help is not repeated every time
+unsigned watchdogSkip = 0;                   // checks left until the next probe
+
+/**
+ * Modifiers sent for a mapped character are released after this pause (see
+ * injectedModifiers), e.g. so that a following mouse click is no Shift+click
+ **/
+#define MODIFIER_RELEASE_DELAY 250 // ms
+UINT_PTR modifierReleaseTimer = 0;
+
+VOID CALLBACK releaseModifiers(HWND hwnd, UINT message, UINT_PTR timer, DWORD now) {
+	KillTimer(NULL, modifierReleaseTimer);
+	modifierReleaseTimer = 0;
+	releaseInjectedModifiers();
+	flushOutput();
 }
 
-void handleMod3Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
-	if (isKeyUp) {
-		if (keyInfo.scanCode == scanCodeMod3R) {
-			level3modRightPressed = false;
-			modState.mod3 = level3modLeftPressed | level3modRightPressed;
-			if (mod3RAsReturn && level3modRightAndNoOtherKeyPressed) {
-				sendUp(keyInfo.vkCode, keyInfo.scanCode, false); // release Mod3_R
-				sendDownUp(VK_RETURN, 28, true); // send Return
-				level3modRightAndNoOtherKeyPressed = false;
-			}
-		} else { // scanCodeMod3L (CapsLock)
-			level3modLeftPressed = false;
-			modState.mod3 = level3modLeftPressed | level3modRightPressed;
-			if (capsLockAsEscape && level3modLeftAndNoOtherKeyPressed) {
-				sendUp(VK_CAPITAL, 58, false); // release Mod3_R
-				sendDownUp(VK_ESCAPE, 1, true); // send Escape
-				level3modLeftAndNoOtherKeyPressed = false;
-			}
-		}
-	} else { // keyDown
-		if (keyInfo.scanCode == scanCodeMod3R) {
-			level3modRightPressed = true;
-			if (mod3RAsReturn)
-				level3modRightAndNoOtherKeyPressed = true;
-		} else { // VK_CAPITAL (CapsLock)
-			level3modLeftPressed = true;
-			if (capsLockAsEscape)
-				level3modLeftAndNoOtherKeyPressed = true;
-		}
-		modState.mod3 = level3modLeftPressed | level3modRightPressed;
-	}
+/**
+ * Tapping terms of ModTap keys and combo terms (see nextModTapDeadline()).
+ * A waitable timer in the message loop of the hook thread, with high resolution
+ * where available (CreateWaitableTimerExW, Windows 10 1803 and later).
+ **/
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x2
+#endif
+HANDLE modTapTimer = NULL;
+bool modTapTimerArmed = false;
+DWORD modTapTimerDeadline;
+
+HANDLE createModTapTimer() {
+	typedef HANDLE (WINAPI *CreateWaitableTimerExWFunction)(LPSECURITY_ATTRIBUTES, LPCWSTR, DWORD, DWORD);
+	CreateWaitableTimerExWFunction createWaitableTimerExW = (CreateWaitableTimerExWFunction)
+		GetProcAddress(GetModuleHandle(TEXT("kernel32.dll")), "CreateWaitableTimerExW");
+	HANDLE timer = NULL;
+	if (createWaitableTimerExW)
+		timer = createWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!timer)
+		timer = CreateWaitableTimer(NULL, FALSE, NULL);
+	return timer;
 }
 
-void handleMod4Key(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
-	if (isKeyUp) {
-		if (keyInfo.scanCode == scanCodeMod4L) {
-			level4modLeftPressed = false;
-			if (level4modRightPressed && level4LockEnabled) {
-				level4LockActive = !level4LockActive;
-				printf("Level4 lock %s!\n", level4LockActive ? "activated" : "deactivated");
-			} else if (mod4LAsTab && level4modLeftAndNoOtherKeyPressed) {
-				sendUp(keyInfo.vkCode, keyInfo.scanCode, false); // release Mod4_L
-				sendDownUp(VK_TAB, 15, true); // send Tab
-				level4modLeftAndNoOtherKeyPressed = false;
-				modState.mod4 = level4modLeftPressed | level4modRightPressed;
-				return;
-			}
-		} else { // scanCodeMod4R
-			level4modRightPressed = false;
-			if (level4modLeftPressed && level4LockEnabled) {
-				level4LockActive = !level4LockActive;
-				printf("Level4 lock %s!\n", level4LockActive ? "activated" : "deactivated");
-			}
-		}
-		modState.mod4 = level4modLeftPressed | level4modRightPressed;
-	} else { // keyDown
-		if (keyInfo.scanCode == scanCodeMod4L) {
-			level4modLeftPressed = true;
-			if (mod4LAsTab)
-				level4modLeftAndNoOtherKeyPressed = !(level4modRightPressed || level3modLeftPressed || level3modRightPressed);
-		} else { // scanCodeMod4R
-			level4modRightPressed = true;
-			/* ALTGR triggers two keys: LCONTROL and RMENU
-					we don't want to have any of those two here effective but return -1 seems
-					to change nothing, so we simply send keyup here.  */
-			sendUp(VK_RMENU, 56, false);
-		}
-		modState.mod4 = level4modLeftPressed | level4modRightPressed;
+/**
+ * Hook thread: (re)starts the timers the core needs after it has handled an event
+ **/
+void updateTimers() {
+	if (injectedModifiers) // restarts a running timer
+		modifierReleaseTimer = SetTimer(NULL, modifierReleaseTimer, MODIFIER_RELEASE_DELAY, releaseModifiers);
+
+	DWORD deadline;
+	if (!nextModTapDeadline(&deadline)) {
+		if (modTapTimerArmed)
+			CancelWaitableTimer(modTapTimer);
+		modTapTimerArmed = false;
+		return;
 	}
+	if (!modTapTimer || (modTapTimerArmed && deadline == modTapTimerDeadline))
+		return;
+	LONG delay = deadline - GetTickCount();
+	LARGE_INTEGER dueTime;
+	dueTime.QuadPart = -(LONGLONG)(delay > 0 ? delay : 0) * 10000; // relative, in 100 ns
+	modTapTimerArmed = SetWaitableTimer(modTapTimer, &dueTime, 0, NULL, NULL, FALSE);
+	modTapTimerDeadline = deadline;
 }
 
 /**
- * updates system key and layerLock states; writes key
- * returns `true` if next hook should be called, `false` otherwise
+ * Hook thread: locks the pages the hook callback touches into the working set
+ * (lockMemory, on start only), so the first key after an idle period does not wait for page
+ * faults: the code, the active configuration, the key queue and states, the
+ * output buffer and the top of the hook thread's stack. The configurations of
+ * the other profiles and of reloads and the buffers of the log and the trace
+ * stay pageable. relockConfigMemory() follows a switch of the configuration.
  **/
-bool updateStatesAndWriteKey(KBDLLHOOKSTRUCT keyInfo, bool isKeyUp) {
-	bool continueExecution = handleSystemKey(keyInfo, isKeyUp);
-	if (!continueExecution) return false;
+#define LOCKED_STACK_SIZE 32768
+#define LOCKED_CONFIG_RANGES 4
+SIZE_T neededLockSize;     // counted by addLockSize()
+SIZE_T configLockSize;     // part of the grown working set for the configuration
+struct { void *address; size_t size; } lockedConfigRanges[LOCKED_CONFIG_RANGES];
+int lockedConfigRangeCount = 0;
+unsigned lockedConfigChanges;
+bool lockFailed;
+bool memoryLocked = false; // lockHookMemory() succeeded on start (hook thread only)
+
+void addLockSize(void *address, size_t size) {
+	neededLockSize += (size + 4095) / 4096 * 4096 + 4096; // whole pages
+}
 
-	unsigned level = getLevel();
+void lockRange(void *address, size_t size) {
+	if (!VirtualLock(address, size))
+		lockFailed = true;
+}
 
-	if (isMod3(keyInfo)) {
-		// if (keyQueueLength)
-		// 	return false;
-		handleMod3Key(keyInfo, isKeyUp);
-		return false;
-	} else if (isMod4(keyInfo)) {
-		// if (keyQueueLength)
-		// 	return false;
-		handleMod4Key(keyInfo, isKeyUp);
-		return false;
-	} else if ((keyInfo.flags & LLKHF_EXTENDED) && keyInfo.scanCode != 53) {
-		// handle numpad slash key (scanCode=53 + extended bit) later
-		return true;
-	} else if (level == 2 && handleLayer2SpecialCases(keyInfo)) {
-		return false;
-	} else if (level == 3 && handleLayer3SpecialCases(keyInfo)) {
-		return false;
-	} else if (level == 4 && handleLayer4SpecialCases(keyInfo)) {
-		return false;
-	} else if (level == 1 && keyInfo.vkCode >= 0x30 && keyInfo.vkCode <= 0x39) {
-		// numbers 0 to 9 -> don't remap
-	} else if (!(qwertzForShortcuts && isSystemKeyPressed())) {
-		TCHAR key;
-		if ((keyInfo.flags & LLKHF_EXTENDED) && keyInfo.scanCode == 53) {
-			// slash key ("/") on numpad
-			key = numpadSlashKey[level-1];
-			keyInfo.flags = 0;
-		} else {
-			key = mapScanCodeToChar(level, keyInfo.scanCode);
-		}
-		if (capsLockActive && (level == 1 || level == 2) && isLetter(key)) {
-			key = mapScanCodeToChar(level==1 ? 2 : 1, keyInfo.scanCode);
-		}
-		if (key != 0 && (keyInfo.flags & LLKHF_INJECTED) == 0) {
-			// if key must be mapped
-			int character = MapVirtualKeyA(keyInfo.vkCode, MAPVK_VK_TO_CHAR);
-			TCHAR keyUTF16[] = {key, 0};
-			char keyUTF8[4];
-			convertToUTF8(keyUTF16, keyUTF8);
-			printf("%-13s | sc:%03d %c->%s [0x%04X] (level %u)\n", " mapped", keyInfo.scanCode, character, keyUTF8, key, level);
-			sendChar(key, keyInfo);
-			return false;
-		}
+void lockConfigRange(void *address, size_t size) {
+	lockedConfigRanges[lockedConfigRangeCount].address = address;
+	lockedConfigRanges[lockedConfigRangeCount++].size = size;
+	lockRange(address, size);
+}
+
+/**
+ * Grows the working set so `size` more bytes can be locked
+ **/
+bool growWorkingSet(SIZE_T size) {
+	HANDLE process = GetCurrentProcess();
+	SIZE_T minimum, maximum;
+	return GetProcessWorkingSetSize(process, &minimum, &maximum)
+		&& SetProcessWorkingSetSize(process, minimum + size, maximum + size);
+}
+
+void lockHookMemory() {
+	BYTE *image = (BYTE *) GetModuleHandle(NULL);
+	IMAGE_NT_HEADERS *headers = (IMAGE_NT_HEADERS *)(image + ((IMAGE_DOS_HEADER *) image)->e_lfanew);
+	IMAGE_SECTION_HEADER *sections = IMAGE_FIRST_SECTION(headers);
+	// commits the stack pages below this frame, the callback runs in them
+	volatile BYTE stack[LOCKED_STACK_SIZE];
+	memset((BYTE *) stack, 0, sizeof stack);
+
+	neededLockSize = 0;
+	for (int i = 0; i < headers->FileHeader.NumberOfSections; i++) {
+		if (sections[i].Characteristics & IMAGE_SCN_MEM_EXECUTE)
+			addLockSize(image + sections[i].VirtualAddress, sections[i].Misc.VirtualSize);
+	}
+	addLockSize((BYTE *) stack, sizeof stack);
+	hotStateMemory(addLockSize);
+	SIZE_T otherSize = neededLockSize;
+	hotConfigMemory(addLockSize);
+	configLockSize = neededLockSize - otherSize;
+
+	lockFailed = !growWorkingSet(neededLockSize);
+	for (int i = 0; i < headers->FileHeader.NumberOfSections && !lockFailed; i++) {
+		if (sections[i].Characteristics & IMAGE_SCN_MEM_EXECUTE)
+			lockRange(image + sections[i].VirtualAddress, sections[i].Misc.VirtualSize);
+	}
+	if (!lockFailed) {
+		lockRange((BYTE *) stack, sizeof stack);
+		hotStateMemory(lockRange);
+		hotConfigMemory(lockConfigRange);
+		lockedConfigChanges = configChanges;
+	}
+	if (lockFailed) {
+		printf("\nSpeicher des Hooks kann nicht gesperrt werden (Fehler %lu).\n", GetLastError());
+		return;
 	}
+	memoryLocked = true;
+	printf("\n%lu KB Speicher des Hooks gesperrt.\n", (unsigned long)(neededLockSize / 1024));
+}
 
-	return true;
+/**
+ * Hook thread: locks the configuration the core has switched to instead of the last one
+ **/
+void relockConfigMemory() {
+	lockedConfigChanges = configChanges;
+	for (int i = 0; i < lockedConfigRangeCount; i++)
+		VirtualUnlock(lockedConfigRanges[i].address, lockedConfigRanges[i].size);
+	lockedConfigRangeCount = 0;
+
+	neededLockSize = 0;
+	hotConfigMemory(addLockSize);
+	if (neededLockSize > configLockSize && growWorkingSet(neededLockSize - configLockSize))
+		configLockSize = neededLockSize;
+	hotConfigMemory(lockConfigRange);
+	// the state may share a page with the last configuration
+	hotStateMemory(lockRange);
+}
+
+/**
+ * Hook thread: the policy of the keyboard used last applies to key downs only.
+ * A key up follows its key down, so a modifier pressed on a remapped keyboard
+ * is released in the core even if a bypassed keyboard was used meanwhile.
+ **/
+bool isDeviceBypassed(KBDLLHOOKSTRUCT keyInfo, WPARAM wparam) {
+	bool isKeyUp = wparam == WM_KEYUP || wparam == WM_SYSKEYUP;
+	if (keyInfo.scanCode >= sizeof deviceBypassedKeys[0])
+		return !isKeyUp && devicePolicy == DEVICE_BYPASS;
+	bool *bypassed = &deviceBypassedKeys[(keyInfo.flags & LLKHF_EXTENDED) ? 1 : 0][keyInfo.scanCode];
+	if (isKeyUp) {
+		bool wasBypassed = *bypassed;
+		*bypassed = false;
+		return wasBypassed;
+	}
+	*bypassed = devicePolicy == DEVICE_BYPASS;
+	return *bypassed;
 }
 
 __declspec(dllexport)
@@ -1267,90 +729,413 @@ LRESULT CALLBACK keyevent(int code, WPARAM wparam, LPARAM lparam) {
 	}
 
 	KBDLLHOOKSTRUCT keyInfo = *((KBDLLHOOKSTRUCT *) lparam);
+	lastHookEventTime = GetTickCount();
+	if ((keyInfo.flags & LLKHF_INJECTED) && keyInfo.dwExtraInfo == OWN_EXTRA_INFO)
+		return CallNextHookEx(NULL, code, wparam, lparam); // sent by us, already mapped
 
+	uint64_t start = latencyNow();
 	if (keyInfo.flags & LLKHF_INJECTED) {
-		// process injected events like normal, because most probably we are injecting them
-		logKeyEvent((keyInfo.flags & LLKHF_UP) ? "injected up" : "injected down", keyInfo, FG_YELLOW);
+		if (keyInfo.dwExtraInfo == WATCHDOG_PROBE_EXTRA_INFO) {
+			probeAnswered = true;
+			return -1; // only meant for us
+		}
+	} else {
+		probesLost = 0;
+	}
+	if (!(keyInfo.flags & LLKHF_INJECTED) && isDeviceBypassed(keyInfo, wparam))
 		return CallNextHookEx(NULL, code, wparam, lparam);
+	if (injectionDropped && !injectionPending()) {
+		// the injector has caught up: release what the dropped events left pressed
+		injectionDropped = false;
+		resetModifierState();
+		flushOutput();
 	}
-
-	bool isKeyUp = (wparam == WM_KEYUP || wparam == WM_SYSKEYUP);
-
-	if (isShift(keyInfo)) {
-		// if (keyQueueLength)
-		// 	return false;
-		handleShiftKey(keyInfo, isKeyUp);
-		return -1;
+	bool callNext = handleKeyEvent(keyInfo, wparam);
+	if (memoryLocked && configChanges != lockedConfigChanges)
+		relockConfigMemory();
+
+	if (callNext && injectorThread && injectionPending()) {
+		// passing the event on would overtake the mapped events which are not sent yet
+		KeyOutput event = {keyInfo.vkCode, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo), 0};
+		queueInjection(&event, 1);
+		callNext = false;
 	}
 
-	// Shift + Pause
-	if (wparam == WM_KEYDOWN && keyInfo.vkCode == VK_PAUSE && modState.shift) {
-		toggleBypassMode();
-		return -1;
+	// send all keyboard events this event has been mapped to with one SendInput call
+	uint64_t injectionStart = latencyNow();
+	flushOutput();
+	latencyRecord(PHASE_INJECTION, latencyNow() - injectionStart);
+	updateTimers();
+
+	/* Passes the hook information to the next hook procedure in the current hook chain.
+	 * 1st Parameter hhk - Optional
+	 * 2nd Parameter nCode - The next hook procedure uses this code to determine how to process the hook information.
+	 * 3rd Parameter wParam - The wParam value passed to the current hook procedure.
+	 * 4th Parameter lParam - The lParam value passed to the current hook procedure
+	 */
+	LRESULT result = callNext ? CallNextHookEx(NULL, code, wparam, lparam) : -1;
+	latencyRecord(PHASE_TOTAL, latencyNow() - start);
+
+	if (traceEnabled) {
+		TraceRecord record;
+		record.time = keyInfo.time;
+		record.scanCode = keyInfo.scanCode;
+		record.vkCode = keyInfo.vkCode;
+		record.flags = keyInfo.flags;
+		record.message = wparam;
+		record.swallowed = !callNext;
+		record.reserved = 0;
+		traceAppend(&record);
 	}
+	return result;
+}
 
-	if (bypassMode) {
-		if (keyInfo.vkCode == VK_CAPITAL && !(keyInfo.flags & LLKHF_UP)) {
-			// synchronize with capsLock state during bypass
-			if (shiftLockEnabled) {
-				toggleShiftLock();
-			} else if (capsLockEnabled) {
-				toggleCapsLock();
-			}
-		}
-		return CallNextHookEx(NULL, code, wparam, lparam);
+/**
+ * Feeds the events of a recorded trace (see replayTrace) through the core
+ * and sends the result like the hook would. Events injected while recording
+ * are skipped, they are generated again by the core.
+ * Runs on the hook thread before the hook is installed, so the core is never
+ * used by two threads at the same time.
+ **/
+void replayTraceFile(char *filename) {
+	size_t count;
+	TraceRecord *records = traceLoad(filename, &count);
+	if (!records)
+		return;
+
+	printf("\nSpiele %s ab (%u Ereignisse)\n", filename, (unsigned)count);
+	unsigned mismatches = 0;
+	uint64_t start = latencyNow();
+	for (size_t i = 0; i < count; i++) {
+		if (records[i].flags & LLKHF_INJECTED)
+			continue;
+		if (!replayMaxSpeed && i > 0 && records[i].time > records[i-1].time)
+			Sleep(records[i].time - records[i-1].time);
+
+		KBDLLHOOKSTRUCT keyInfo = {0};
+		keyInfo.vkCode = records[i].vkCode;
+		keyInfo.scanCode = records[i].scanCode;
+		keyInfo.flags = records[i].flags;
+		keyInfo.time = records[i].time;
+		bool callNext = handleKeyEvent(keyInfo, records[i].message);
+		if (callNext) // the event would have reached the system unchanged
+			sendKeyEvent(keyInfo.vkCode, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo), 0);
+		flushOutput();
+		if (records[i].swallowed != TRACE_UNKNOWN && records[i].swallowed == callNext)
+			mismatches++;
 	}
+	releaseInjectedModifiers();
+	flushOutput();
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	printf("Abspielen beendet nach %.0f ms, %u Ereignisse anders behandelt als bei der Aufnahme\n",
+		(latencyNow() - start) * 1000.0 / frequency.QuadPart, mismatches);
+	free(records);
+}
 
-	if (isKeyUp) {
-		logKeyEvent("key up", keyInfo, FG_CYAN);
-
-		if (keyQueueLength) {
-			// int index;
-			bool keyReleasedHandled = checkQueue(keyInfo);
-			if (keyReleasedHandled)
-				return -1;
-				// return CallNextHookEx(NULL, code, wparam, lparam);
+/**
+ * Hook thread: installs the hook again. Key events may have been lost in the
+ * meantime, so modifiers are released and the queue is emptied.
+ **/
+void reinstallHook(enum hookReinstallReason reason) {
+	if (keyhook)
+		UnhookWindowsHookEx(keyhook);
+	keyhook = SetWindowsHookEx(WH_KEYBOARD_LL, keyevent, hookModule, 0);
+	latencyRecordHookReinstall(reason, keyhook != NULL);
+	printf("\nTastatur-Hook neu installiert (%s)%s\n", REINSTALL_REASON_NAMES[reason],
+		keyhook ? "" : " - fehlgeschlagen!");
+
+	resetModifierState();
+	flushOutput();
+	lastHookEventTime = GetTickCount();
+}
+
+VOID CALLBACK hookWatchdog(HWND hwnd, UINT message, UINT_PTR timer, DWORD now) {
+	if (hookRemoved)
+		return;
+	if (!keyhook) {
+		reinstallHook(REINSTALL_RETRY);
+		return;
+	}
+	if (probePending) {
+		probePending = false;
+		if (probeAnswered) {
+			probesLost = 0;
+		} else {
+			reinstallHook(REINSTALL_PROBE_LOST);
+			if (probesLost < WATCHDOG_MAX_BACKOFF)
+				probesLost++;
+			// e.g. the probe was blocked (UIPI): wait longer for the next one
+			watchdogSkip = (1u << probesLost) - 2;
 		}
-		bool callNext = updateStatesAndWriteKey(keyInfo, true);
-		if (!callNext) return -1;
-
-	} else {  // key down
-		unsigned level = getLevel();
-		printf("\nLEVEL %i", level);
-		// if (ctrlLeftPressed) printf(" CTRL_L");
-		// if (ctrlRightPressed) printf(" CTRL_R");
-		// if (altLeftPressed) printf(" ALT_L");
-		// if (winLeftPressed) printf(" WIN_L");
-		// if (winRightPressed) printf(" WIN_R");
-		// if (shiftLeftPressed) printf(" SHIFT_L");
-		// if (shiftRightPressed) printf(" SHIFT_R");
-		// if (modState.shift) printf(" shift");
-		// if (modState.mod3) printf(" mod3");
-		// if (modState.mod4) printf(" mod4");
-		printf("\n");
+		return;
+	}
+	if (watchdogSkip > 0) {
+		watchdogSkip--;
+		return;
+	}
+
+	LASTINPUTINFO lastInput = {sizeof lastInput};
+	if (!GetLastInputInfo(&lastInput) || (LONG)(lastInput.dwTime - lastHookEventTime) <= 0)
+		return;
+
+	INPUT input = {0};
+	input.type = INPUT_KEYBOARD;
+	input.ki.wVk = WATCHDOG_PROBE_VK;
+	input.ki.dwFlags = KEYEVENTF_KEYUP;
+	input.ki.dwExtraInfo = WATCHDOG_PROBE_EXTRA_INFO;
+	// fails e.g. while the secure desktop is shown, nobody can lose input then
+	if (SendInput(1, &input, sizeof(INPUT)) == 1) {
+		probeAnswered = false;
+		probePending = true;
+	}
+}
+
+/**
+ * Hook thread: removes the hook when bypass mode is switched on and installs
+ * it again when it is switched off
+ **/
+void updateBypassHook() {
+	if (bypassMode && !hookRemoved) {
+		if (keyhook)
+			UnhookWindowsHookEx(keyhook);
+		keyhook = NULL;
+		hookRemoved = true;
+		// the key up events of held keys will not pass the hook
+		resetModifierState();
+		releaseInjectedModifiers();
+		flushOutput();
+		capsLockWhenRemoved = GetKeyState(VK_CAPITAL) & 1;
+		if (!RegisterHotKey(NULL, BYPASS_HOTKEY_ID, MOD_SHIFT | MOD_NOREPEAT, VK_PAUSE))
+			RegisterHotKey(NULL, BYPASS_HOTKEY_ID, MOD_SHIFT, VK_PAUSE); // before Windows 7
+	} else if (!bypassMode && hookRemoved) {
+		UnregisterHotKey(NULL, BYPASS_HOTKEY_ID);
+		hookRemoved = false;
+		if ((GetKeyState(VK_CAPITAL) & 1) != capsLockWhenRemoved)
+			capsLockPressedInBypass();
+		keyhook = SetWindowsHookEx(WH_KEYBOARD_LL, keyevent, hookModule, 0);
+		lastHookEventTime = GetTickCount();
+		if (!keyhook)
+			printf("\nTastatur-Hook konnte nicht installiert werden!\n");
+	}
+}
+
+/**
+ * Gets the file name of the program of the window (e.g. game.exe)
+ * returns `false` if it is unknown
+ **/
+bool getProgramName(HWND window, char *name, DWORD size) {
+	typedef BOOL (WINAPI *QueryFullProcessImageNameAFunction)(HANDLE, DWORD, LPSTR, LPDWORD);
+	static QueryFullProcessImageNameAFunction queryFullProcessImageNameA = NULL;
+	if (!window)
+		return false;
+	// Windows Vista and later
+	if (!queryFullProcessImageNameA)
+		queryFullProcessImageNameA = (QueryFullProcessImageNameAFunction)
+			GetProcAddress(GetModuleHandle(TEXT("kernel32.dll")), "QueryFullProcessImageNameA");
+	if (!queryFullProcessImageNameA)
+		return false;
+
+	DWORD processId;
+	GetWindowThreadProcessId(window, &processId);
+	HANDLE process = OpenProcess(0x1000 /* PROCESS_QUERY_LIMITED_INFORMATION */, FALSE, processId);
+	if (!process)
+		return false;
+	char path[MAX_PATH];
+	DWORD length = sizeof path;
+	BOOL found = queryFullProcessImageNameA(process, 0, path, &length);
+	CloseHandle(process);
+	if (!found)
+		return false;
+	const char *fileName = strrchr(path, '\\') ? strrchr(path, '\\') + 1 : path;
+	strncpy(name, fileName, size - 1);
+	name[size - 1] = 0;
+	return true;
+}
 
-		logKeyEvent("key down", keyInfo, FG_CYAN);
+/**
+ * returns `true` if the program name is in the comma separated list (case insensitive)
+ **/
+bool isProgramInList(const char *name, const char *apps) {
+	size_t nameLength = strlen(name);
+	while (*apps) {
+		while (*apps == ',' || *apps == ' ')
+			apps++;
+		size_t appLength = strcspn(apps, ", ");
+		if (appLength == nameLength && strncasecmp(apps, name, nameLength) == 0)
+			return true;
+		apps += appLength;
+	}
+	return false;
+}
 
-		if (keyQueueLength || mappingTapNextRelease[keyInfo.scanCode]) {
-			appendToQueue(keyInfo);
-			return -1;
+/**
+ * Keyboards: with bypassDevices or devices=<names> in a profile, the hook
+ * thread receives Raw Input (RIDEV_INPUTSINK) and learns from it which
+ * keyboard was used last. The hook events are handled with the policy of that
+ * keyboard: remapped (profile of the foreground program), bypassed or with a
+ * profile of its own. The policy is looked up by the device handle in a small
+ * cache. Windows generates raw input only for events the hook lets pass, and
+ * the hook swallows every remapped key (all letters, Shift, Mod3, Mod4). So
+ * a keyboard is only recognized by a key that is passed on unchanged (e.g.
+ * Return, Backspace or a digit); until then all keys, letters of a bypassed
+ * keyboard included, have the policy of the keyboard used before.
+ * Hook thread only.
+ **/
+#define DEVICE_CACHE_SIZE 16 // power of two, direct mapped
+typedef struct DeviceCacheEntry {
+	HANDLE device;     // NULL if empty
+	int policy;        // DEVICE_REMAP, DEVICE_BYPASS or a profile
+} DeviceCacheEntry;
+DeviceCacheEntry deviceCache[DEVICE_CACHE_SIZE];
+HWND rawInputWindow = NULL;
+bool rawInputRegistered = false;
+HANDLE lastDevice = NULL;
+int programProfile = 0;                // profile of the foreground program
+
+/**
+ * returns `true` if the device name contains one of the comma separated names (case insensitive)
+ **/
+bool isDeviceInList(const char *deviceName, const char *names) {
+	while (*names) {
+		while (*names == ',' || *names == ' ')
+			names++;
+		size_t length = strcspn(names, ", ");
+		for (const char *p = deviceName; length && *p; p++) {
+			if (strncasecmp(p, names, length) == 0)
+				return true;
 		}
+		names += length;
+	}
+	return false;
+}
 
-		level3modLeftAndNoOtherKeyPressed = false;
-		level3modRightAndNoOtherKeyPressed = false;
-		level4modLeftAndNoOtherKeyPressed = false;
+int findDevicePolicy(HANDLE device) {
+	char name[512];
+	UINT size = sizeof name;
+	if (GetRawInputDeviceInfoA(device, RIDI_DEVICENAME, name, &size) == (UINT)-1)
+		return DEVICE_REMAP;
+	int policy = DEVICE_REMAP;
+	const Profiles *p = __atomic_load_n(&profiles, __ATOMIC_ACQUIRE);
+	if (isDeviceInList(name, __atomic_load_n(&bypassDevices, __ATOMIC_ACQUIRE)))
+		policy = DEVICE_BYPASS;
+	for (int i = 1; i < p->count && policy == DEVICE_REMAP; i++) {
+		if (isDeviceInList(name, p->devices[i]))
+			policy = i;
+	}
+	printf("\nTastatur %s: %s\n", name,
+		policy == DEVICE_BYPASS ? "keine Umbelegung" : policy > 0 ? p->sections[policy] : "Umbelegung");
+	return policy;
+}
 
-		bool callNext = updateStatesAndWriteKey(keyInfo, false);
-		if (!callNext) return -1;
+void updateSelectedProfile() {
+	selectProfile(devicePolicy > 0 ? devicePolicy : programProfile);
+}
+
+void rawInputReceived(HRAWINPUT rawInput) {
+	RAWINPUTHEADER header;
+	UINT size = sizeof header;
+	if (GetRawInputData(rawInput, RID_HEADER, &header, &size, sizeof header) == (UINT)-1
+			|| header.dwType != RIM_TYPEKEYBOARD || !header.hDevice || header.hDevice == lastDevice)
+		return; // injected events have no device
+	DeviceCacheEntry *entry = &deviceCache[((UINT_PTR)header.hDevice >> 2) & (DEVICE_CACHE_SIZE - 1)];
+	if (entry->device != header.hDevice) {
+		entry->device = header.hDevice;
+		entry->policy = findDevicePolicy(header.hDevice);
 	}
+	lastDevice = header.hDevice;
+	devicePolicy = entry->policy;
+	updateSelectedProfile();
+}
 
-	/* Passes the hook information to the next hook procedure in the current hook chain.
-	 * 1st Parameter hhk - Optional
-	 * 2nd Parameter nCode - The next hook procedure uses this code to determine how to process the hook information.
-	 * 3rd Parameter wParam - The wParam value passed to the current hook procedure.
-	 * 4th Parameter lParam - The lParam value passed to the current hook procedure
-	 */
-	return CallNextHookEx(NULL, code, wparam, lparam);
+LRESULT CALLBACK rawInputWindowProc(HWND window, UINT message, WPARAM wparam, LPARAM lparam) {
+	if (message == WM_INPUT)
+		rawInputReceived((HRAWINPUT)lparam);
+	return DefWindowProc(window, message, wparam, lparam);
+}
+
+/**
+ * Hook thread: receives raw input only if a keyboard has a policy, forgets
+ * the policies of the keyboards (the settings may have changed)
+ **/
+void updateRawInput() {
+	const Profiles *p = __atomic_load_n(&profiles, __ATOMIC_ACQUIRE);
+	bool needed = __atomic_load_n(&bypassDevices, __ATOMIC_ACQUIRE)[0] != 0;
+	for (int i = 1; i < p->count; i++)
+		needed = needed || p->devices[i][0];
+	memset(deviceCache, 0, sizeof deviceCache);
+	lastDevice = NULL;
+	devicePolicy = DEVICE_REMAP;
+	updateSelectedProfile();
+
+	if (needed && !rawInputWindow) {
+		WNDCLASSEX windowClass = {sizeof windowClass};
+		windowClass.lpfnWndProc = rawInputWindowProc;
+		windowClass.hInstance = GetModuleHandle(NULL);
+		windowClass.lpszClassName = TEXT(APPNAME "-rawinput");
+		RegisterClassEx(&windowClass);
+		rawInputWindow = CreateWindowEx(0, windowClass.lpszClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, windowClass.hInstance, NULL);
+	}
+	if (needed != rawInputRegistered && rawInputWindow) {
+		RAWINPUTDEVICE keyboards = {0x01, 0x06, needed ? RIDEV_INPUTSINK : RIDEV_REMOVE, needed ? rawInputWindow : NULL};
+		if (RegisterRawInputDevices(&keyboards, 1, sizeof keyboards))
+			rawInputRegistered = needed;
+		else
+			printf("\nRaw Input nicht verfügbar, Tastaturen werden nicht unterschieden.\n");
+	}
+}
+
+/**
+ * Hook thread: another window has come to the foreground (SetWinEventHook)
+ **/
+VOID CALLBACK foregroundChanged(HWINEVENTHOOK hook, DWORD event, HWND window, LONG object, LONG child, DWORD thread, DWORD time) {
+	char name[MAX_PATH];
+	if (!getProgramName(window, name, sizeof name))
+		name[0] = 0;
+
+	const Profiles *p = __atomic_load_n(&profiles, __ATOMIC_ACQUIRE);
+	int profile = 0;
+	for (int i = 1; i < p->count && name[0] && !profile; i++) {
+		if (isProgramInList(name, p->apps[i]))
+			profile = i;
+	}
+	programProfile = profile;
+	updateSelectedProfile();
+
+	bool listed = name[0] && isProgramInList(name, __atomic_load_n(&bypassApps, __ATOMIC_ACQUIRE));
+	if (listed && !bypassMode) {
+		toggleBypassMode();
+		flushOutput();
+		autoBypass = true;
+	} else if (!listed && bypassMode && autoBypass) {
+		toggleBypassMode();
+		flushOutput();
+	}
+}
+
+/**
+ * Hook thread: raises its priority (hookPriority), so keystrokes do not stall
+ * and Windows does not time out the hook while the CPU is busy. With mmcss,
+ * the Multimedia Class Scheduler Service boosts it like an audio thread.
+ **/
+void setHookThreadPriority() {
+	if (strcmp(hookPriority, "mmcss") == 0) {
+		typedef HANDLE (WINAPI *AvSetMmThreadCharacteristicsWFunction)(LPCWSTR, LPDWORD);
+		HMODULE avrt = LoadLibrary(TEXT("avrt.dll"));
+		AvSetMmThreadCharacteristicsWFunction avSetMmThreadCharacteristicsW = avrt
+			? (AvSetMmThreadCharacteristicsWFunction) GetProcAddress(avrt, "AvSetMmThreadCharacteristicsW") : NULL;
+		DWORD taskIndex = 0;
+		if (avSetMmThreadCharacteristicsW && avSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex))
+			return;
+		printf("\nMMCSS nicht verfügbar, der Hook-Thread läuft stattdessen mit hoher Priorität.\n");
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+	} else if (strcmp(hookPriority, "high") == 0) {
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+	} else if (strcmp(hookPriority, "timecritical") == 0) {
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	} else if (strcmp(hookPriority, "normal") != 0) {
+		printf("\nUnbekannte hookPriority: %s (erlaubt: normal, high, timecritical, mmcss)\n", hookPriority);
+	}
 }
 
 DWORD WINAPI hookThreadMain(void *user) {
@@ -1362,6 +1147,11 @@ DWORD WINAPI hookThreadMain(void *user) {
 			return 1;
 		}
 	}
+	hookModule = base;
+	hookThreadId = GetCurrentThreadId();
+	setHookThreadPriority();
+	if (useLockMemory)
+		lockHookMemory();
 	/* Installs an application-defined hook procedure into a hook chain
 	 * 1st Parameter idHook: WH_KEYBOARD_LL - The type of hook procedure to be installed.
 	 * Installs a hook procedure that monitors low-level keyboard input events.
@@ -1371,174 +1161,399 @@ DWORD WINAPI hookThreadMain(void *user) {
 	 * If the function succeeds, the return value is the handle to the hook procedure.
 	 * If the function fails, the return value is NULL.
 	 */
+	if (strlen(replayTrace) != 0)
+		replayTraceFile(replayTrace);
+
 	keyhook = SetWindowsHookEx(WH_KEYBOARD_LL, keyevent, base, 0);
+	lastHookEventTime = GetTickCount();
+	UINT_PTR watchdogTimer = SetTimer(NULL, 0, WATCHDOG_INTERVAL, hookWatchdog);
+	modTapTimer = createModTapTimer();
+	HWINEVENTHOOK foregroundHook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND,
+		NULL, foregroundChanged, 0, 0, WINEVENT_OUTOFCONTEXT);
+	updateRawInput();
 
 	/* Message loop retrieves messages from the thread's message queue and dispatches them to the appropriate window procedures.
 	 * For more info http://msdn.microsoft.com/en-us/library/ms644928%28v=VS.85%29.aspx#creating_loop
-	 * Retrieves a message from the calling thread's message queue.
+	 * Besides messages (and the hook callbacks), it waits for the tapping term timer.
 	 */
-	while (GetMessage(&msg, 0, 0, 0) > 0) {
-		// Translates virtual-key messages into character messages.
-		// TranslateMessage(&msg);
-		// Dispatches a message to a window procedure.
-		DispatchMessage(&msg);
+	bool quit = false;
+	while (!quit) {
+		DWORD result = MsgWaitForMultipleObjects(modTapTimer ? 1 : 0, &modTapTimer, FALSE, INFINITE, QS_ALLINPUT);
+		if (modTapTimer && result == WAIT_OBJECT_0) {
+			modTapTimerArmed = false;
+			handleModTapTimeout(GetTickCount());
+			flushOutput();
+			updateTimers();
+		}
+		// Retrieves the messages from the calling thread's message queue.
+		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+			if (msg.message == WM_QUIT) {
+				quit = true;
+				break;
+			}
+			if (msg.message == WM_TOGGLE_BYPASS || (msg.message == WM_HOTKEY && msg.wParam == BYPASS_HOTKEY_ID)) {
+				toggleBypassMode();
+				flushOutput();
+				continue;
+			}
+			if (msg.message == WM_UPDATE_BYPASS_HOOK) {
+				updateBypassHook();
+				continue;
+			}
+			if (msg.message == WM_UPDATE_RAW_INPUT) {
+				updateRawInput();
+				// the hook reads only the new profiles and lists from now on
+				SetEvent(settingsTaken);
+				continue;
+			}
+			// Translates virtual-key messages into character messages.
+			// TranslateMessage(&msg);
+			// Dispatches a message to a window procedure.
+			DispatchMessage(&msg);
+		}
 	}
+	KillTimer(NULL, watchdogTimer);
+	if (modTapTimer)
+		CloseHandle(modTapTimer);
+	if (foregroundHook)
+		UnhookWinEvent(foregroundHook);
+	if (hookRemoved)
+		UnregisterHotKey(NULL, BYPASS_HOTKEY_ID);
 
 	/* To free system resources associated with the hook and removes a hook procedure installed in a hook chain
 	 * Parameter hhk: hKeyHook - A handle to the hook to be removed.
 	 */
-	UnhookWindowsHookEx(keyhook);
+	if (keyhook)
+		UnhookWindowsHookEx(keyhook);
 
 	return 0;
 }
 
+/**
+ * Tray menu: show the hook latency summary and save all histograms as CSV
+ **/
+void showLatencyStatistics() {
+	char summary[1024];
+	char message[1536];
+	latencyFormatSummary(summary, sizeof summary);
+	printf("\n%s", summary);
+	if (latencyWriteCsv(latencyCsvFile))
+		snprintf(message, sizeof message, "%s\nHistogramme gespeichert in %s", summary, latencyCsvFile);
+	else
+		snprintf(message, sizeof message, "%s\n%s konnte nicht geschrieben werden.", summary, latencyCsvFile);
+
+	TCHAR messageUTF16[1536];
+	MultiByteToWideChar(CP_UTF8, 0, message, -1, messageUTF16, 1536);
+	MessageBox(NULL, messageUTF16, TEXT(APPNAME " - Latenz"), MB_ICONINFORMATION | MB_OK);
+}
+
+/**
+ * Tray menu: save the keystroke statistics now
+ **/
+void showKeyStatistics() {
+	char message[512];
+	if (saveKeyStatistics())
+		snprintf(message, sizeof message, "Tastenstatistik gespeichert in %s", keyStatsCsvFile);
+	else
+		snprintf(message, sizeof message, "%s konnte nicht geschrieben werden.", keyStatsCsvFile);
+
+	TCHAR messageUTF16[512];
+	MultiByteToWideChar(CP_UTF8, 0, message, -1, messageUTF16, 512);
+	MessageBox(NULL, messageUTF16, TEXT(APPNAME " - Tastenstatistik"), MB_ICONINFORMATION | MB_OK);
+}
+
 void exitApplication() {
 	printf("Clicked Exit button!\n");
+	if (keyStatsEnabled)
+		saveKeyStatistics();
+	stopTraceRecording();
 	trayicon_remove();
 	PostQuitMessage(0);
 }
 
-bool fileExists(LPCSTR szPath) {
-	DWORD dwAttrib = GetFileAttributesA(szPath);
+/**
+ * settings.ini, read once per (re)load (see settingsLoad())
+ **/
+SettingsFile settingsFile;
 
-	return (dwAttrib != INVALID_FILE_ATTRIBUTES
-	    && !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
+/**
+ * Simple settings of settings.ini ([Settings]), the command line and the profile sections
+ **/
+const SettingDescriptor settingTable[] = {
+	{"layout", SETTING_STRING, layout, sizeof layout, "neo"},
+	{"customLayout", SETTING_STRING, customLayout, sizeof customLayout, ""},
+	{"layoutFile", SETTING_STRING, layoutFile, sizeof layoutFile, ""},
+	{"symmetricalLevel3Modifiers", SETTING_BOOL, &quoteAsMod3R, 0, "0"},
+	{"returnKeyAsMod3R", SETTING_BOOL, &returnAsMod3R, 0, "0"},
+	{"tabKeyAsMod4L", SETTING_BOOL, &tabAsMod4L, 0, "0"},
+	{"capsLockEnabled", SETTING_BOOL, &capsLockEnabled, 0, "0"},
+	{"shiftLockEnabled", SETTING_BOOL, &shiftLockEnabled, 0, "0"},
+	{"level4LockEnabled", SETTING_BOOL, &level4LockEnabled, 0, "0"},
+	{"qwertzForShortcuts", SETTING_BOOL, &qwertzForShortcuts, 0, "0"},
+	{"swapLeftCtrlAndLeftAlt", SETTING_BOOL, &swapLeftCtrlAndLeftAlt, 0, "0"},
+	{"swapLeftCtrlLeftAltAndLeftWin", SETTING_BOOL, &swapLeftCtrlLeftAltAndLeftWin, 0, "0"},
+	{"supportLevels5and6", SETTING_BOOL, &supportLevels5and6, 0, "0"},
+	{"capsLockAsEscape", SETTING_BOOL, &capsLockAsEscape, 0, "0"},
+	{"mod3RAsReturn", SETTING_BOOL, &mod3RAsReturn, 0, "0"},
+	{"mod4LAsTab", SETTING_BOOL, &mod4LAsTab, 0, "0"},
+	{"remapInjected", SETTING_BOOL, &remapInjected, 0, "0"},
+	{"debugWindow", SETTING_BOOL, &debugWindow, 0, "0"},
+	{"logFile", SETTING_STRING, logFile, sizeof logFile, ""},
+	{"recordTrace", SETTING_STRING, recordTrace, sizeof recordTrace, ""},
+	{"replayTrace", SETTING_STRING, replayTrace, sizeof replayTrace, ""},
+	{"replayMaxSpeed", SETTING_BOOL, &replayMaxSpeed, 0, "0"},
+	{"injectorThread", SETTING_BOOL, &useInjectorThread, 0, "0"},
+	{"keyStats", SETTING_BOOL, &useKeyStats, 0, "0"},
+	{"keyStatsInterval", SETTING_INT, &keyStatsInterval, 0, "10"},
+	{"hookPriority", SETTING_STRING, hookPriority, sizeof hookPriority, "normal"},
+	{"lockMemory", SETTING_BOOL, &useLockMemory, 0, "0"},
+	{"bypassApps", SETTING_LIST, &bypassApps, sizeof bypassAppLists[0], "", bypassAppLists[0]},
+	{"bypassDevices", SETTING_LIST, &bypassDevices, sizeof bypassDeviceLists[0], "", bypassDeviceLists[0]},
+	{NULL}
+};
+
+/**
+ * Reads the settings of [Settings] from settings.ini, missing ones get their default
+ **/
+void readSettings(const SettingsFile *file) {
+	for (const SettingDescriptor *setting = settingTable; setting->name; setting++)
+		setSetting(setting, settingsGet(file, "Settings", setting->name));
+
+	if (capsLockEnabled)
+		shiftLockEnabled = false;
+
+	if (swapLeftCtrlLeftAltAndLeftWin)
+		swapLeftCtrlAndLeftAlt = false;
 }
 
-bool checkSetting(char *keyword, char *filename) {
-	char returnValue[100];
-	GetPrivateProfileStringA("Settings", keyword, "0", returnValue, 100, filename);
-	return (strcmp(returnValue, "1") == 0);
+void printSettings() {
+	for (const SettingDescriptor *setting = settingTable; setting->name; setting++) {
+		printSetting(setting);
+		printf("\n");
+	}
+	printf("\n");
 }
 
-int main(int argc, char *argv[]) {
-	setbuf(stdout, NULL);
-	/**
-	* find settings.ini (in same folder as neo-llkh.exe)
-	*/
-	// get path of neo-llkh.exe
-	char ini[256];
-	GetModuleFileNameA(NULL, ini, 256);
-	//printf("exe: %s\n", ini);
-	char * pch;
-	// find last \ in path
-	pch = strrchr(ini, '\\');
-	// replace neo-llkh.exe by settings.ini
-	strcpy(pch+1, "settings.ini");
-	//printf("ini: %s\n", ini);
+/**
+ * returns `true` if the entry is in `section`, or in no profile section if `section` is NULL
+ **/
+bool isInSection(const SettingsEntry *entry, const char *section) {
+	return section ? strcmp(entry->section, section) == 0
+		: strncmp(entry->section, PROFILE_SECTION_PREFIX, strlen(PROFILE_SECTION_PREFIX)) != 0;
+}
 
-	/**
-	* If settings.ini exists, read in settings.
-	* Otherwise check for command line parameters.
-	*/
-	if (fileExists(ini)) {
-		char returnValue[100];
-
-		GetPrivateProfileStringA("Settings", "layout", "neo", layout, 100, ini);
-
-		GetPrivateProfileStringA("Settings", "customLayout", "", customLayout, 65, ini);
-
-		quoteAsMod3R = checkSetting("symmetricalLevel3Modifiers", ini);
-		returnAsMod3R = checkSetting("returnKeyAsMod3R", ini);
-		tabAsMod4L = checkSetting("tabKeyAsMod4L", ini);
-		capsLockEnabled = checkSetting("capsLockEnabled", ini);
-		shiftLockEnabled = checkSetting("shiftLockEnabled", ini);
-		level4LockEnabled = checkSetting("level4LockEnabled", ini);
-		qwertzForShortcuts = checkSetting("qwertzForShortcuts", ini);
-		swapLeftCtrlAndLeftAlt = checkSetting("swapLeftCtrlAndLeftAlt", ini);
-		swapLeftCtrlLeftAltAndLeftWin = checkSetting("swapLeftCtrlLeftAltAndLeftWin", ini);
-		supportLevels5and6 = checkSetting("supportLevels5and6", ini);
-		capsLockAsEscape = checkSetting("capsLockAsEscape", ini);
-		mod3RAsReturn = checkSetting("mod3RAsReturn", ini);
-		mod4LAsTab = checkSetting("mod4LAsTab", ini);
-		debugWindow = checkSetting("debugWindow", ini);
-
-		if (capsLockEnabled)
-			shiftLockEnabled = false;
-
-		if (swapLeftCtrlLeftAltAndLeftWin)
-			swapLeftCtrlAndLeftAlt = false;
+/**
+ * Tapping term (ms) and strategy of a ModTap key, both optional: "200", "hold", "200,permissive", ...
+ * Without a strategy, a tapping term means MT_TAPPING_TERM.
+ * returns `false` if an argument is unknown
+ **/
+bool parseModTapArguments(char *arguments, ModTap *entry) {
+	entry->tappingTerm = 0;
+	entry->strategy = MT_TAP_NEXT_RELEASE;
+	bool strategyGiven = false;
+	for (char *argument = arguments ? strtok(arguments, ", ") : NULL; argument; argument = strtok(NULL, ", ")) {
+		if (argument[0] >= '0' && argument[0] <= '9') {
+			entry->tappingTerm = atoi(argument);
+			continue;
+		}
+		strategyGiven = true;
+		if (strcmp(argument, "permissive") == 0) {
+			entry->strategy = MT_PERMISSIVE_HOLD;
+		} else if (strcmp(argument, "hold") == 0) {
+			entry->strategy = MT_HOLD_ON_OTHER_KEY;
+		} else if (strcmp(argument, "term") == 0) {
+			entry->strategy = MT_TAPPING_TERM;
+		} else {
+			printf("Unknown ModTap strategy %s\n", argument);
+			printf("Please use one of these: permissive, hold, term.\n");
+			return false;
+		}
+	}
+	if (!strategyGiven && entry->tappingTerm)
+		entry->strategy = MT_TAPPING_TERM;
+	if (entry->strategy == MT_TAPPING_TERM && !entry->tappingTerm)
+		entry->tappingTerm = MOD_TAP_DEFAULT_TERM;
+	if (entry->tappingTerm > 0xffff)
+		entry->tappingTerm = 0xffff;
+	return true;
+}
 
-		if (debugWindow) {
-			// Open Console Window to see printf output
-			SetStdOutToNewConsole();
+/**
+ * Reads the ModTap keys (<key>=ModTap(<modifier>[,<tapping term>][,<strategy>])) from settings.ini,
+ * of a profile section or (NULL) of all other sections. A key given twice keeps the later entry.
+ **/
+void readModTapSettings(const SettingsFile *file, const char *section) {
+	if (!section)
+		memset(modTap, 0, sizeof modTap);
+	int count = 0;
+
+	for (int e = 0; e < file->count; e++) {
+		const SettingsEntry *entry = &file->entries[e];
+		if (!isInSection(entry, section) || strncmp(entry->value, "ModTap(", 7) != 0)
+			continue;
+		if (section && count == 0)
+			memset(modTap, 0, sizeof modTap);
+		printf("%s=%s\n", entry->key, entry->value);
+		char value[256];
+		strncpy(value, entry->value + 7, sizeof value - 1);
+		value[sizeof value - 1] = 0;
+		char *end = strchr(value, ')');
+		if (end == NULL) continue;
+		*end = 0;
+		char *arguments = strchr(value, ',');
+		if (arguments)
+			*arguments++ = 0;
+
+		ModTap key = {MT_NONE, entry->key[0]};
+		for (int modifier = MT_CTRL; modifier <= MT_WIN; modifier++) {
+			if (strcasecmp(value, MT_MODIFIER_STRING[modifier]) == 0)
+				key.modifier = modifier;
+		}
+		if (key.modifier == MT_NONE) {
+			printf("Unknown modifier %s\n", value);
+			printf("Please use one of these: ctrl, shift, mod3, mod4, alt, win.\n");
+			continue;
 		}
+		if (!parseModTapArguments(arguments, &key))
+			continue;
 
-		printf("\nEinstellungen aus %s:\n", ini);
-		printf(" Layout: %s\n", layout);
-		printf(" customLayout: %s\n", customLayout);
-		printf(" symmetricalLevel3Modifiers: %d\n", quoteAsMod3R);
-		printf(" returnKeyAsMod3R: %d\n", returnAsMod3R);
-		printf(" tabKeyAsMod4L: %d\n", tabAsMod4L);
-		printf(" capsLockEnabled: %d\n", capsLockEnabled);
-		printf(" shiftLockEnabled: %d\n", shiftLockEnabled);
-		printf(" level4LockEnabled: %d\n", level4LockEnabled);
-		printf(" qwertzForShortcuts: %d\n", qwertzForShortcuts);
-		printf(" swapLeftCtrlAndLeftAlt: %d\n", swapLeftCtrlAndLeftAlt);
-		printf(" swapLeftCtrlLeftAltAndLeftWin: %d\n", swapLeftCtrlLeftAltAndLeftWin);
-		printf(" supportLevels5and6: %d\n", supportLevels5and6);
-		printf(" capsLockAsEscape: %d\n", capsLockAsEscape);
-		printf(" mod3RAsReturn: %d\n", mod3RAsReturn);
-		printf(" mod4LAsTab: %d\n", mod4LAsTab);
-		printf(" debugWindow: %d\n\n", debugWindow);
-
-		// char const* const fileName = argv[1]; /* should check that argc > 1 */
-		FILE* file = fopen(ini, "r"); /* should check the result */
-		char line[256];
 		int i = 0;
+		while (i < count && modTap[i].keycode != key.keycode)
+			i++;
+		if (i == MOD_TAP_LEN)
+			continue;
+		modTap[i] = key;
+		if (i == count)
+			count++;
+	}
+}
 
-		while (fgets(line, sizeof(line), file) && i < MOD_TAP_LEN) {
-			if (strstr(line, "=ModTap(") != NULL) {
-				printf("%s", line);
-				char *token = strtok(line, "=");
-				if (token == NULL) continue;
-				int keycode = (int)token[0];
-				token = strtok(NULL, "(");
-				if (token == NULL) continue;
-				token = strtok(NULL, ")");
-				if (token == NULL) continue;
-				if (strcmp(token, "ctrl") == 0) {
-					modTap[i].modifier = MT_CTRL;
-				} else if (strcmp(token, "shift") == 0) {
-					modTap[i].modifier = MT_SHIFT;
-				} else if (strcmp(token, "mod3") == 0) {
-					modTap[i].modifier = MT_MOD3;
-				} else if (strcmp(token, "mod4") == 0) {
-					modTap[i].modifier = MT_MOD4;
-				} else if (strcmp(token, "alt") == 0) {
-					modTap[i].modifier = MT_ALT;
-				} else if (strcmp(token, "win") == 0) {
-					modTap[i].modifier = MT_WIN;
-				} else {
-					printf(line);
-					printf("Unknown modifier %s\n", token);
-					printf("Please use one of these: ctrl, shift, mod3, mod4, alt, win.\n");
-					continue;
-				}
-				modTap[i].keycode = keycode;
-				// printf("i=%i, keycode=%i, modifier=%i\n", i, (unsigned char)modTap[i].keycode, modTap[i].modifier);
-				i++;
-			}
+/**
+ * Keys a combo can send (<keys>=Combo(<key>))
+ **/
+static const struct { const char *name; BYTE vkCode; WORD scanCode; } comboKeyNames[] = {
+	{"esc", VK_ESCAPE, 0x01}, {"return", VK_RETURN, 0x1c}, {"tab", VK_TAB, 0x0f},
+	{"backspace", VK_BACK, 0x0e}, {"del", VK_DELETE, 0x153}, {"ins", VK_INSERT, 0x152},
+	{"home", VK_HOME, 0x147}, {"end", VK_END, 0x14f}, {"pgup", VK_PRIOR, 0x149}, {"pgdn", VK_NEXT, 0x151},
+	{"left", VK_LEFT, 0x14b}, {"right", VK_RIGHT, 0x14d}, {"up", VK_UP, 0x148}, {"down", VK_DOWN, 0x150},
+	{NULL}
+};
+
+/**
+ * Output of a combo: "text", a key of comboKeyNames or a modifier like ModTap
+ * returns `false` if it is unknown
+ **/
+bool parseComboOutput(char *output, Combo *combo) {
+	size_t length = strlen(output);
+	if (length >= 2 && output[0] == '"' && output[length - 1] == '"') {
+		output[length - 1] = 0;
+		combo->type = COMBO_TEXT;
+		int n = MultiByteToWideChar(CP_UTF8, 0, output + 1, -1, combo->text, COMBO_TEXT_LEN);
+		if (n == 0)
+			combo->text[COMBO_TEXT_LEN - 1] = 0; // too long: cut
+		return true;
+	}
+	for (int i = 0; comboKeyNames[i].name; i++) {
+		if (strcmp(output, comboKeyNames[i].name) == 0) {
+			combo->type = COMBO_KEY;
+			combo->value = comboKeyNames[i].vkCode;
+			combo->scanCode = comboKeyNames[i].scanCode;
+			return true;
+		}
+	}
+	for (int modifier = MT_CTRL; modifier <= MT_WIN; modifier++) {
+		if (strcasecmp(output, MT_MODIFIER_STRING[modifier]) == 0) {
+			combo->type = COMBO_MODIFIER;
+			combo->value = modifier;
+			return true;
 		}
-		fclose(file);
+	}
+	return false;
+}
 
-	} else {
-		printf("\nKeine settings.ini gefunden: %s\n\n", ini);
+/**
+ * Reads the combos (<keys>=Combo(<output>[,<combo term>])) from settings.ini,
+ * of a profile section or (NULL) of all other sections
+ **/
+void readComboSettings(const SettingsFile *file, const char *section) {
+	if (!section)
+		memset(combos, 0, sizeof combos);
+	int i = 0;
+
+	for (int e = 0; e < file->count && i < COMBO_LEN; e++) {
+		const SettingsEntry *entry = &file->entries[e];
+		if (!isInSection(entry, section) || strncmp(entry->value, "Combo(", 6) != 0)
+			continue;
+		char output[256];
+		strncpy(output, entry->value + 6, sizeof output - 1);
+		output[sizeof output - 1] = 0;
+		char *end = strrchr(output, ')');
+		if (end == NULL)
+			continue;
+		if (section && i == 0)
+			memset(combos, 0, sizeof combos);
+		*end = 0;
+
+		// keys like ModTap keys: characters of the QWERTZ layout
+		TCHAR keys[COMBO_MAX_KEYS + 2] = {0};
+		str2wcs(keys, (char *)entry->key, COMBO_MAX_KEYS + 1);
+		int length = wcslen(keys);
+		if (length < 2 || length > COMBO_MAX_KEYS) {
+			printf("Combo %s: 2 bis %d Tasten erwartet.\n", entry->key, COMBO_MAX_KEYS);
+			continue;
+		}
+		for (int k = 0; k < length; k++)
+			combos[i].keys[k] = keys[k] < 256 ? (char)keys[k] : '?';
+
+		// the combo term follows the last comma outside of the text
+		combos[i].term = COMBO_DEFAULT_TERM;
+		char *comma = strrchr(output, ',');
+		char *quote = strrchr(output, '"');
+		if (comma && (!quote || comma > quote) && comma[1] >= '0' && comma[1] <= '9') {
+			*comma = 0;
+			combos[i].term = atoi(comma + 1);
+			if (combos[i].term > 0xffff)
+				combos[i].term = 0xffff;
+		}
+		if (!parseComboOutput(output, &combos[i])) {
+			printf("Combo %s: unbekannte Ausgabe %s\n", entry->key, output);
+			printf("Möglich sind \"Text\", esc, return, tab, backspace, del, ins, home, end, pgup, pgdn, left, right, up, down und die Modifier von ModTap.\n");
+			memset(&combos[i], 0, sizeof combos[i]);
+			continue;
+		}
+		i++;
+	}
+}
+
+/**
+ * Applies one setting given as <param>=<value> (command line or profile section)
+ **/
+void applySetting(const char *param, const char *value) {
+	const SettingDescriptor *setting = findSetting(settingTable, param);
+	if (!setting) {
+		printf("\nUnbekannter Parameter:%s", param);
+		return;
+	}
+	bool debugWindowAlreadyStarted = debugWindow;
+	setSetting(setting, value);
+	if (debugWindow && !debugWindowAlreadyStarted) {
+		// Open Console Window to see printf output
+		SetStdOutToNewConsole();
 	}
+	printf("\n");
+	printSetting(setting);
+}
 
+/**
+ * Reads the settings given as command line parameters (they take precedence over settings.ini)
+ **/
+void parseCommandLine(int argc, char *argv[]) {
 	if (argc >= 2) {
 		printf("\nEinstellungen von der Kommandozeile:");
 		const char delimiter[] = "=";
 		char *param, *value;
 		for (int i = 1; i < argc; i++) {
-			if (strcmp(argv[i], "neo") == 0
-					|| strcmp(argv[i], "adnw") == 0
-					|| strcmp(argv[i], "adnwzjf") == 0
-					|| strcmp(argv[i], "bone") == 0
-					|| strcmp(argv[i], "koy") == 0
-					|| strcmp(argv[i], "kou") == 0
-					|| strcmp(argv[i], "vou") == 0
-					|| strcmp(argv[i], "qwertz") == 0) {
+			if (findLayout(argv[i]) != NULL) {
 				strncpy(layout, argv[i], 100);
 				printf("\n Layout: %s", layout);
 				continue;
@@ -1550,7 +1565,11 @@ int main(int argc, char *argv[]) {
 			}
 
 			//printf("\narg%d: %s", i, argv[i]);
-			param = strtok(argv[i], delimiter);
+			// strtok changes the string, but the command line is parsed again on every reload
+			char argument[256];
+			strncpy(argument, argv[i], sizeof argument - 1);
+			argument[sizeof argument - 1] = 0;
+			param = strtok(argument, delimiter);
 			if (param == NULL) {
 				printf("\nUnbekannter Parameter: %s", argv[i]);
 				continue;
@@ -1562,95 +1581,291 @@ int main(int argc, char *argv[]) {
 				continue;
 			}
 
-			if (strcmp(param, "debugWindow") == 0) {
-				bool debugWindowAlreadyStarted = debugWindow;
-				debugWindow = (strcmp(value, "1") == 0);
-				if (debugWindow && !debugWindowAlreadyStarted) {
-					// Open Console Window to see printf output
-					SetStdOutToNewConsole();
-				}
-				printf("\n debugWindow: %d", debugWindow);
-
-			} else if (strcmp(param, "layout") == 0) {
-				strncpy(layout, value, 100);
-				printf("\n Layout: %s", layout);
+			applySetting(param, value);
+		}
+	}
+}
 
-			} else if (strcmp(param, "customLayout") == 0) {
-				strncpy(customLayout, value, 65);
-				printf("\n Custom layout: %s", customLayout);
+/**
+ * Settings of the default profile: settings.ini without the profile sections, then the command line
+ **/
+void readDefaultSettings() {
+	if (settingsFile.text) {
+		readSettings(&settingsFile);
+		readModTapSettings(&settingsFile, NULL);
+		readComboSettings(&settingsFile, NULL);
+	}
+	parseCommandLine(commandLineArgc, commandLineArgv);
+	str2wcs(customLayoutWcs, customLayout, 33);
+}
 
-			} else if (strcmp(param, "symmetricalLevel3Modifiers") == 0) {
-				quoteAsMod3R = (strcmp(value, "1") == 0);
-				printf("\n symmetricalLevel3Modifiers: %d", quoteAsMod3R);
+/**
+ * Reads the profile sections of settings.ini into the buffer not in use
+ **/
+Profiles *readProfiles() {
+	Profiles *p = profiles == &profileLists[0] ? &profileLists[1] : &profileLists[0];
+	memset(p, 0, sizeof *p);
+	p->count = 1;
+	const char *previous = NULL;
+	for (int e = 0; e < settingsFile.count; e++) {
+		const char *name = settingsFile.entries[e].section;
+		if (name == previous || strncmp(name, PROFILE_SECTION_PREFIX, strlen(PROFILE_SECTION_PREFIX)) != 0)
+			continue;
+		previous = name;
+		bool known = false;
+		for (int i = 1; i < p->count; i++)
+			known = known || strcmp(p->sections[i], name) == 0;
+		if (known)
+			continue;
+		if (p->count == PROFILE_COUNT) {
+			printf("\nZu viele Profile, [%s] wird ignoriert.\n", name);
+			continue;
+		}
+		strncpy(p->sections[p->count], name, sizeof p->sections[0] - 1);
+		const char *apps = settingsGet(&settingsFile, name, "apps");
+		const char *devices = settingsGet(&settingsFile, name, "devices");
+		strncpy(p->apps[p->count], apps ? apps : "", sizeof p->apps[0] - 1);
+		strncpy(p->devices[p->count], devices ? devices : "", sizeof p->devices[0] - 1);
+		p->count++;
+	}
+	return p;
+}
 
-			} else if (strcmp(param, "returnKeyAsMod3R") == 0) {
-				returnAsMod3R = (strcmp(value, "1") == 0);
-				printf("\n returnKeyAsMod3R: %d", returnAsMod3R);
+/**
+ * Sets the settings of a profile for reloadConfig(): the default settings,
+ * then those of the profile section
+ **/
+void applyProfileSettings(int profile) {
+	readDefaultSettings();
+	if (profile == 0)
+		return;
+	const char *section = loadingProfiles->sections[profile];
+	printf("\nProfil %s (%s):", section + strlen(PROFILE_SECTION_PREFIX), loadingProfiles->apps[profile]);
+
+	for (int e = 0; e < settingsFile.count; e++) {
+		const SettingsEntry *entry = &settingsFile.entries[e];
+		// apps, devices, modTap, combos and the ModTap keys and combos are handled elsewhere
+		if (strcmp(entry->section, section) == 0
+				&& strcmp(entry->key, "apps") != 0 && strcmp(entry->key, "devices") != 0
+				&& strcmp(entry->key, "modTap") != 0 && strcmp(entry->key, "combos") != 0
+				&& strncmp(entry->value, "ModTap(", 7) != 0 && strncmp(entry->value, "Combo(", 6) != 0)
+			applySetting(entry->key, entry->value);
+	}
+	readModTapSettings(&settingsFile, section);
+	readComboSettings(&settingsFile, section);
+	const char *enabled = settingsGet(&settingsFile, section, "modTap");
+	if (enabled && atoi(enabled) == 0)
+		memset(modTap, 0, sizeof modTap);
+	enabled = settingsGet(&settingsFile, section, "combos");
+	if (enabled && atoi(enabled) == 0)
+		memset(combos, 0, sizeof combos);
+	str2wcs(customLayoutWcs, customLayout, 33);
+}
 
-			} else if (strcmp(param, "tabKeyAsMod4L") == 0) {
-				tabAsMod4L = (strcmp(value, "1") == 0);
-				printf("\n tabKeyAsMod4L: %d", tabAsMod4L);
+/**
+ * Maps the compiled layout file (see layoutFile) for initLayout() or reloadConfig()
+ * returns `false` if a layout file is set but cannot be loaded
+ **/
+bool mapLayoutFile() {
+	layoutImage = NULL;
+	if (strlen(layoutFile) == 0)
+		return true;
+	layoutImage = mapLayoutImage(layoutFile);
+	if (!layoutImage)
+		printf("\nLayout-Datei kann nicht geladen werden (mit layoutc übersetzt?): %s\n", layoutFile);
+	return layoutImage != NULL;
+}
 
-			} else if (strcmp(param, "capsLockEnabled") == 0) {
-				capsLockEnabled = (strcmp(value, "1") == 0);
-				printf("\n capsLockEnabled: %d", capsLockEnabled);
+/**
+ * Reads settings.ini, the command line and the layout file again and builds
+ * a new configuration on the calling thread. The hook keeps running, it
+ * switches to the new configuration between two key events.
+ * debugWindow, logFile, recordTrace, replayTrace, injectorThread, keyStats, hookPriority and lockMemory
+ * only take effect on start.
+ **/
+void reloadSettings() {
+	// the buffers not in use may still be read until the hook has taken the previous reload
+	WaitForSingleObject(settingsTaken, INFINITE);
+	settingsLoad(&settingsFile, ini);
+	readDefaultSettings();
+	Profiles *newProfiles = readProfiles();
+
+	if (!mapLayoutFile()) {
+		printf("Einstellungen nicht übernommen.\n");
+		settingsFree(&settingsFile);
+		SetEvent(settingsTaken);
+		return;
+	}
+	loadingProfiles = newProfiles;
+	reloadConfig(newProfiles->count, applyProfileSettings);
+	__atomic_store_n(&profiles, newProfiles, __ATOMIC_RELEASE);
+	publishSettingLists(settingTable);
+	settingsFree(&settingsFile);
+	PostThreadMessage(hookThreadId, WM_UPDATE_RAW_INPUT, 0, 0);
+	unmapLayoutImage(layoutImage);
+	layoutImage = NULL;
+	printf("\nEinstellungen neu geladen.\n");
+}
 
-			} else if (strcmp(param, "shiftLockEnabled") == 0) {
-				shiftLockEnabled = (strcmp(value, "1") == 0);
-				printf("\n shiftLockEnabled: %d", shiftLockEnabled);
+#define WATCHED_DIRECTORIES 2
+#define RELOAD_DELAY 200 // ms, editors and layoutc write a file in several steps
 
-			} else if (strcmp(param, "level4LockEnabled") == 0) {
-				level4LockEnabled = (strcmp(value, "1") == 0);
-				printf("\n level4LockEnabled: %d", level4LockEnabled);
+typedef struct DirectoryWatch {
+	char path[MAX_PATH];
+	HANDLE directory;
+	OVERLAPPED overlapped;
+	DWORD buffer[1024];            // FILE_NOTIFY_INFORMATION records (DWORD aligned)
+	WCHAR files[WATCHED_DIRECTORIES][MAX_PATH];  // names of the watched files in this directory
+	int fileCount;
+} DirectoryWatch;
 
-			} else if (strcmp(param, "qwertzForShortcuts") == 0) {
-				qwertzForShortcuts = (strcmp(value, "1") == 0);
-				printf("\n qwertzForShortcuts: %d", qwertzForShortcuts);
+/**
+ * Adds the file to the watch of its directory (or starts watching the directory)
+ **/
+void addWatchedFile(DirectoryWatch *watches, int *watchCount, char *filename) {
+	char path[MAX_PATH];
+	char *name;
+	if (!GetFullPathNameA(filename, MAX_PATH, path, &name) || !name)
+		return;
+	WCHAR wideName[MAX_PATH];
+	MultiByteToWideChar(CP_ACP, 0, name, -1, wideName, MAX_PATH);
+	*name = 0; // path is the directory now
+
+	DirectoryWatch *watch = NULL;
+	for (int i = 0; i < *watchCount; i++) {
+		if (_stricmp(watches[i].path, path) == 0)
+			watch = &watches[i];
+	}
+	if (!watch) {
+		watch = &watches[*watchCount];
+		memset(watch, 0, sizeof(DirectoryWatch));
+		strcpy(watch->path, path);
+		watch->directory = CreateFileA(path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+		if (watch->directory == INVALID_HANDLE_VALUE)
+			return;
+		watch->overlapped.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		(*watchCount)++;
+	}
+	wcscpy(watch->files[watch->fileCount++], wideName);
+}
 
-			} else if (strcmp(param, "swapLeftCtrlAndLeftAlt") == 0) {
-				swapLeftCtrlAndLeftAlt = (strcmp(value, "1") == 0);
-				printf("\n swapLeftCtrlAndLeftAlt: %d", swapLeftCtrlAndLeftAlt);
+bool startDirectoryWatch(DirectoryWatch *watch) {
+	return ReadDirectoryChangesW(watch->directory, watch->buffer, sizeof watch->buffer, FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+		NULL, &watch->overlapped, NULL);
+}
 
-			} else if (strcmp(param, "swapLeftCtrlLeftAltAndLeftWin") == 0) {
-				swapLeftCtrlLeftAltAndLeftWin = (strcmp(value, "1") == 0);
-				printf("\n swapLeftCtrlLeftAltAndLeftWin: %d", swapLeftCtrlLeftAltAndLeftWin);
+/**
+ * returns `true` if the notification is about one of the watched files
+ **/
+bool isWatchedFileChanged(DirectoryWatch *watch) {
+	DWORD size;
+	if (!GetOverlappedResult(watch->directory, &watch->overlapped, &size, FALSE))
+		return false;
+	if (size == 0)
+		return true; // too many changes for the buffer
+	FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION *)watch->buffer;
+	while (true) {
+		size_t length = info->FileNameLength / sizeof(WCHAR);
+		for (int i = 0; i < watch->fileCount; i++) {
+			if (wcslen(watch->files[i]) == length && _wcsnicmp(info->FileName, watch->files[i], length) == 0)
+				return true;
+		}
+		if (info->NextEntryOffset == 0)
+			return false;
+		info = (FILE_NOTIFY_INFORMATION *)((char *)info + info->NextEntryOffset);
+	}
+}
 
-			} else if (strcmp(param, "supportLevels5and6") == 0) {
-				supportLevels5and6 = (strcmp(value, "1") == 0);
-				printf("\n supportLevels5and6: %d", supportLevels5and6);
+/**
+ * Watches settings.ini and the layout file and reloads the settings on a change.
+ * The new configuration is built on this thread, so typing is never stalled.
+ **/
+DWORD WINAPI settingsWatcherThreadMain(void *user) {
+	while (true) {
+		DirectoryWatch watches[WATCHED_DIRECTORIES];
+		HANDLE events[WATCHED_DIRECTORIES];
+		int watchCount = 0;
+		addWatchedFile(watches, &watchCount, ini);
+		if (strlen(layoutFile) != 0)
+			addWatchedFile(watches, &watchCount, layoutFile);
+		if (watchCount == 0)
+			return 1;
+		for (int i = 0; i < watchCount; i++) {
+			startDirectoryWatch(&watches[i]);
+			events[i] = watches[i].overlapped.hEvent;
+		}
 
-			} else if (strcmp(param, "capsLockAsEscape") == 0) {
-				capsLockAsEscape = (strcmp(value, "1") == 0);
-				printf("\n capsLockAsEscape: %d", capsLockAsEscape);
+		bool changed = false;
+		while (!changed) {
+			DWORD index = WaitForMultipleObjects(watchCount, events, FALSE, INFINITE) - WAIT_OBJECT_0;
+			if (index >= (DWORD)watchCount)
+				return 1;
+			changed = isWatchedFileChanged(&watches[index]);
+			if (!changed)
+				startDirectoryWatch(&watches[index]);
+		}
 
-			} else if (strcmp(param, "mod3RAsReturn") == 0) {
-				mod3RAsReturn = (strcmp(value, "1") == 0);
-				printf("\n mod3RAsReturn: %d", mod3RAsReturn);
+		for (int i = 0; i < watchCount; i++) {
+			CancelIo(watches[i].directory);
+			CloseHandle(watches[i].directory);
+			CloseHandle(watches[i].overlapped.hEvent);
+		}
+		Sleep(RELOAD_DELAY);
+		// the layout file may be another one now, so the watches are set up again
+		reloadSettings();
+	}
+	return 0;
+}
 
-			} else if (strcmp(param, "mod4LAsTab") == 0) {
-				mod4LAsTab = (strcmp(value, "1") == 0);
-				printf("\n mod4LAsTab: %d", mod4LAsTab);
+int main(int argc, char *argv[]) {
+	setbuf(stdout, NULL);
+	/**
+	* find settings.ini (in same folder as neo-llkh.exe)
+	*/
+	// get path of neo-llkh.exe
+	GetModuleFileNameA(NULL, ini, 256);
+	//printf("exe: %s\n", ini);
+	char * pch;
+	// find last \ in path
+	pch = strrchr(ini, '\\');
+	// replace neo-llkh.exe by settings.ini
+	strcpy(pch+1, "latency.csv");
+	strcpy(latencyCsvFile, ini);
+	strcpy(pch+1, "keystats.csv");
+	strcpy(keyStatsCsvFile, ini);
+	strcpy(pch+1, "settings.ini");
+	//printf("ini: %s\n", ini);
 
-			} else {
-				printf("\nUnbekannter Parameter:%s", param);
-			}
+	/**
+	* If settings.ini exists, read in settings.
+	* Otherwise check for command line parameters.
+	*/
+	if (settingsLoad(&settingsFile, ini)) {
+		readSettings(&settingsFile);
+
+		if (debugWindow) {
+			// Open Console Window to see printf output
+			SetStdOutToNewConsole();
 		}
+
+		printf("\nEinstellungen aus %s:\n", ini);
+		printSettings();
+
+		readModTapSettings(&settingsFile, NULL);
+		readComboSettings(&settingsFile, NULL);
+
+	} else {
+		printf("\nKeine settings.ini gefunden: %s\n\n", ini);
 	}
-	// transform possibly UTF-8 encoded custom layout string to UTF-16
-	str2wcs(customLayoutWcs, customLayout, 33);
 
-	if (quoteAsMod3R)
-		// use ä/quote key instead of #/backslash key as right level 3 modifier
-		scanCodeMod3R = SCANCODE_QUOTE_KEY;
-	else if (returnAsMod3R)
-		// use return key instead of #/backslash as right level 3 modifier
-		// (might be useful for US keyboards because the # key is missing there)
-		scanCodeMod3R = SCANCODE_RETURN_KEY;
+	commandLineArgc = argc;
+	commandLineArgv = argv;
+	parseCommandLine(argc, argv);
 
-	if (tabAsMod4L)
-		// use tab key instead of < key as left level 4 modifier
-		// (might be useful for US keyboards because the < key is missing there)
-		scanCodeMod4L = SCANCODE_TAB_KEY;
+	// transform possibly UTF-8 encoded custom layout string to UTF-16
+	str2wcs(customLayoutWcs, customLayout, 33);
 
 	// console handle: needed for coloring the output
 	hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -1663,8 +1878,62 @@ int main(int argc, char *argv[]) {
 	SetConsoleCP(CP_UTF8);
 	SetConsoleOutputCP(CP_UTF8);
 
+	if (strlen(logFile) != 0) {
+		logFileHandle = fopen(logFile, "w");
+		if (!logFileHandle)
+			printf("\nLog-Datei kann nicht geöffnet werden: %s\n", logFile);
+	}
+	// debug output of the hook thread is written to a buffer and printed by a separate thread
+	logToStdout = debugWindow || GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) != FILE_TYPE_UNKNOWN;
+	logEnabled = logToStdout || logFileHandle;
+	if (logEnabled) {
+		HANDLE loggerThread = CreateThread(0, 0, loggerThreadMain, NULL, 0, NULL);
+		SetThreadPriority(loggerThread, THREAD_PRIORITY_LOWEST);
+	}
+
+	if (strlen(recordTrace) != 0) {
+		if (traceOpen(recordTrace)) {
+			// the hook thread only queues the records, they are written by a separate thread
+			traceWriterThread = CreateThread(0, 0, traceWriterThreadMain, NULL, 0, NULL);
+			SetThreadPriority(traceWriterThread, THREAD_PRIORITY_LOWEST);
+		} else {
+			printf("\nTrace-Datei kann nicht angelegt werden: %s\n", recordTrace);
+		}
+	}
+
+	if (useKeyStats) {
+		InitializeCriticalSection(&keyStatsFileLock);
+		keyStatsEnabled = true;
+		HANDLE keyStatsWriterThread = CreateThread(0, 0, keyStatsWriterThreadMain, NULL, 0, NULL);
+		SetThreadPriority(keyStatsWriterThread, THREAD_PRIORITY_LOWEST);
+	}
+
+	if (useInjectorThread) {
+		injectorWakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+		injectorThread = CreateThread(0, 0, injectorThreadMain, NULL, 0, NULL);
+		SetThreadPriority(injectorThread, THREAD_PRIORITY_HIGHEST);
+	}
+
+	LARGE_INTEGER performanceFrequency;
+	QueryPerformanceFrequency(&performanceFrequency);
+	latencySetFrequency(performanceFrequency.QuadPart);
+
+	mapLayoutFile();
 	initCharacterToScanCodeMap();
 	initLayout();
+	Profiles *startProfiles = readProfiles();
+	if (startProfiles->count > 1) {
+		loadingProfiles = startProfiles;
+		reloadConfig(startProfiles->count, applyProfileSettings);
+		__atomic_store_n(&profiles, startProfiles, __ATOMIC_RELEASE);
+	}
+	publishSettingLists(settingTable);
+	settingsTaken = CreateEvent(NULL, FALSE, TRUE, NULL);
+	settingsFree(&settingsFile);
+	// the tables are copied, so layoutc can overwrite the file while we are running
+	unmapLayoutImage(layoutImage);
+	layoutImage = NULL;
+	updateKeyScanCache(GetKeyboardLayout(0));
 
 	resetKeyQueue();
 
@@ -1675,7 +1944,10 @@ int main(int argc, char *argv[]) {
 	 */
 	HINSTANCE hInstance = GetModuleHandle(NULL);
 	trayicon_init(LoadIcon(hInstance, MAKEINTRESOURCE(IDI_APPICON)), APPNAME);
-	trayicon_add_item(NULL, &toggleBypassMode);
+	trayicon_add_item(NULL, &requestBypassToggle);
+	trayicon_add_item("Latency statistics", &showLatencyStatistics);
+	if (keyStatsEnabled)
+		trayicon_add_item("Keystroke statistics", &showKeyStatistics);
 	trayicon_add_item("Exit", &exitApplication);
 
 	/* CreateThread function Creates a thread to execute within the virtual address space of the calling process.
@@ -1690,6 +1962,9 @@ int main(int argc, char *argv[]) {
 	DWORD tid;
 	HANDLE thread = CreateThread(0, 0, hookThreadMain, argv[0], 0, &tid);
 
+	HANDLE settingsWatcherThread = CreateThread(0, 0, settingsWatcherThreadMain, NULL, 0, NULL);
+	SetThreadPriority(settingsWatcherThread, THREAD_PRIORITY_BELOW_NORMAL);
+
 	MSG msg;
 	while (GetMessage(&msg, 0, 0, 0) > 0) {
 		// this seems to be necessary only for clicking exit in the system tray menu
@@ -0,0 +1,163 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "settings.h"
+
+static char *trim(char *start, char *end) {
+	while (start < end && (*start == ' ' || *start == '\t'))
+		start++;
+	while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		end--;
+	*end = 0;
+	return start;
+}
+
+bool settingsLoad(SettingsFile *file, const char *filename) {
+	memset(file, 0, sizeof *file);
+	FILE *f = fopen(filename, "rb");
+	if (!f) // e.g. while an editor replaces it
+		return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	file->text = size >= 0 ? malloc(size + 1) : NULL;
+	if (!file->text || fread(file->text, 1, size, f) != (size_t)size) {
+		fclose(f);
+		settingsFree(file);
+		return false;
+	}
+	fclose(f);
+	file->text[size] = 0;
+
+	int lines = 1;
+	for (char *p = file->text; (p = strchr(p, '\n')); p++)
+		lines++;
+	file->entries = malloc(lines * sizeof(SettingsEntry));
+	if (!file->entries) {
+		settingsFree(file);
+		return false;
+	}
+
+	const char *section = "";
+	char *line = file->text;
+	if (strncmp(line, "\xEF\xBB\xBF", 3) == 0) // UTF-8 byte order mark
+		line += 3;
+	while (line) {
+		char *end = strchr(line, '\n');
+		char *next = end ? end + 1 : NULL;
+		if (!end)
+			end = line + strlen(line);
+		line = trim(line, end);
+
+		if (line[0] == '[') {
+			char *close = strchr(line, ']');
+			if (close)
+				*close = 0;
+			section = line + 1;
+		} else if (line[0] != ';' && line[0] != '#') {
+			char *equals = strchr(line, '=');
+			if (equals && equals > line) {
+				SettingsEntry *entry = &file->entries[file->count++];
+				entry->section = section;
+				entry->key = trim(line, equals);
+				char *value = trim(equals + 1, equals + 1 + strlen(equals + 1));
+				size_t length = strlen(value);
+				if (length >= 2 && (value[0] == '"' || value[0] == '\'') && value[length - 1] == value[0]) {
+					value[length - 1] = 0;
+					value++;
+				}
+				entry->value = value;
+			}
+		}
+		line = next;
+	}
+	return true;
+}
+
+void settingsFree(SettingsFile *file) {
+	free(file->text);
+	free(file->entries);
+	memset(file, 0, sizeof *file);
+}
+
+const char *settingsGet(const SettingsFile *file, const char *section, const char *key) {
+	for (int i = 0; i < file->count; i++) {
+		if (strcasecmp(file->entries[i].key, key) == 0 && strcasecmp(file->entries[i].section, section) == 0)
+			return file->entries[i].value;
+	}
+	return NULL;
+}
+
+const SettingDescriptor *findSetting(const SettingDescriptor *table, const char *name) {
+	for (; table->name; table++) {
+		if (strcasecmp(table->name, name) == 0)
+			return table;
+	}
+	return NULL;
+}
+
+/**
+ * the buffer of a SETTING_LIST which is not published, only the thread
+ * setting the values writes it
+ **/
+static char *stagedList(const SettingDescriptor *setting) {
+	const char *current = *(char **)setting->target;
+	return current == setting->buffers ? setting->buffers + setting->size : setting->buffers;
+}
+
+void setSetting(const SettingDescriptor *setting, const char *value) {
+	if (!value)
+		value = setting->defaultValue;
+	switch (setting->type) {
+	case SETTING_BOOL:
+		*(bool *)setting->target = strcmp(value, "1") == 0;
+		break;
+	case SETTING_INT:
+		*(int *)setting->target = atoi(value);
+		break;
+	case SETTING_STRING:
+		strncpy(setting->target, value, setting->size - 1);
+		((char *)setting->target)[setting->size - 1] = 0;
+		break;
+	case SETTING_LIST: {
+		char *next = stagedList(setting);
+		strncpy(next, value, setting->size - 1);
+		next[setting->size - 1] = 0;
+		break;
+	}
+	}
+}
+
+void publishSettingLists(const SettingDescriptor *table) {
+	for (; table->name; table++) {
+		if (table->type == SETTING_LIST)
+			__atomic_store_n((char **)table->target, stagedList(table), __ATOMIC_RELEASE);
+	}
+}
+
+void printSetting(const SettingDescriptor *setting) {
+	if (setting->type == SETTING_BOOL)
+		printf(" %s: %d", setting->name, *(bool *)setting->target);
+	else if (setting->type == SETTING_INT)
+		printf(" %s: %d", setting->name, *(int *)setting->target);
+	else if (setting->type == SETTING_STRING)
+		printf(" %s: %s", setting->name, (char *)setting->target);
+	else
+		printf(" %s: %s", setting->name, stagedList(setting));
+}
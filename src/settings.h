@@ -0,0 +1,102 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SETTINGS_H
+#define _SETTINGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * settings.ini is read into a buffer and split into entries in a single
+ * pass. Keys and values are trimmed, a value in quotes loses them (like
+ * GetPrivateProfileString). Lines starting with ';' or '#' are comments.
+ * The entries point into the buffer, which is modified in place.
+ */
+typedef struct SettingsEntry {
+	const char *section;  // without brackets, "" before the first section
+	const char *key;
+	const char *value;
+} SettingsEntry;
+
+typedef struct SettingsFile {
+	char *text;
+	SettingsEntry *entries;  // in the order of the file
+	int count;
+} SettingsFile;
+
+/**
+ * Reads and splits the file.
+ * returns `false` if it cannot be read
+ */
+bool settingsLoad(SettingsFile *file, const char *filename);
+
+void settingsFree(SettingsFile *file);
+
+/**
+ * returns the value of the first entry of `key` in `section` (both case
+ * insensitive) or NULL
+ */
+const char *settingsGet(const SettingsFile *file, const char *section, const char *key);
+
+/**
+ * Simple settings are described by a table, which is shared by settings.ini
+ * and the command line. A SETTING_LIST is double buffered: `target` is a
+ * `char *` pointing to one of two buffers of `size` bytes at `buffers`. A new
+ * value is written to the other one and only becomes visible with
+ * publishSettingLists(), so another thread can read the old value meanwhile.
+ * Readers on another thread load the pointer with __ATOMIC_ACQUIRE; the
+ * writer must not set a list again before they have stopped using the
+ * buffer published before.
+ */
+typedef enum SettingType {
+	SETTING_BOOL,    // bool, true for "1"
+	SETTING_STRING,  // char[size]
+	SETTING_INT,     // int
+	SETTING_LIST     // char *, see above
+} SettingType;
+
+typedef struct SettingDescriptor {
+	const char *name;
+	SettingType type;
+	void *target;
+	size_t size;
+	const char *defaultValue;
+	char *buffers;   // SETTING_LIST only
+} SettingDescriptor;
+
+/**
+ * returns the descriptor of the setting (case insensitive) or NULL;
+ * the table ends with an entry without name
+ */
+const SettingDescriptor *findSetting(const SettingDescriptor *table, const char *name);
+
+/**
+ * Sets the value (NULL: the default value)
+ */
+void setSetting(const SettingDescriptor *setting, const char *value);
+
+/**
+ * Makes the values set since the last call visible to other threads
+ * (release store of the SETTING_LIST pointers)
+ */
+void publishSettingLists(const SettingDescriptor *table);
+
+/**
+ * Prints " <name>: <value>" (of a SETTING_LIST the value not yet published)
+ */
+void printSetting(const SettingDescriptor *setting);
+
+#endif
@@ -0,0 +1,374 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Feeds random sequences of key presses and releases (modifiers, locks,
+ * ModTap keys, combos, autorepeat, timeouts) through the remapping core and
+ * checks after each sequence, when all keys are up again:
+ *
+ *   - no injected modifier is stuck (after releaseInjectedModifiers(), as the
+ *     platform layer does after a pause) and no modifier is held in modState
+ *   - the ModTap queue is empty
+ *   - down and up events are balanced: every key the core sent down or let
+ *     pass down is up again
+ *
+ * The settings are changed at random every few hundred sequences. It does
+ * not need Windows and reports the throughput, too:
+ *
+ *   make stress [SEQUENCES=1000000] [SEED=1] [LAYOUT=bone]
+ *
+ * On a violation, the seed, the settings and the events of the sequence are
+ * printed and the exit code is 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+#include "latency.h"
+#include "hostplatform.h"
+
+#define SEQUENCES_PER_ROUND 500
+#define MAX_SEQUENCE_LENGTH 64
+#define MAX_SEQUENCE_EVENTS (MAX_SEQUENCE_LENGTH * 3 + 64)
+
+uint64_t outputEvents = 0;
+
+/**
+ * Key state as the system sees it: events passed on plus the events sent by the core
+ **/
+bool vkDown[256];
+bool unicodeDown[0x10000];
+int unicodeDownCount = 0;
+
+/**
+ * Left and right modifiers are separate keys for the system
+ **/
+BYTE systemVk(WORD vkCode, WORD scanCode, bool extended) {
+	switch (vkCode) {
+		case VK_SHIFT: return (scanCode & 0xff) == 54 ? VK_RSHIFT : VK_LSHIFT;
+		case VK_CONTROL: return extended ? VK_RCONTROL : VK_LCONTROL;
+		case VK_MENU: return extended ? VK_RMENU : VK_LMENU;
+		default: return (BYTE)vkCode;
+	}
+}
+
+void systemKeyEvent(WORD vkCode, WORD scanCode, DWORD flags) {
+	bool isKeyUp = flags & KEYEVENTF_KEYUP;
+	if (flags & KEYEVENTF_UNICODE) {
+		if (!isKeyUp && !unicodeDown[scanCode])
+			unicodeDownCount++;
+		else if (isKeyUp && unicodeDown[scanCode])
+			unicodeDownCount--;
+		unicodeDown[scanCode] = !isKeyUp;
+		return;
+	}
+	vkDown[systemVk(vkCode, scanCode, flags & KEYEVENTF_EXTENDEDKEY)] = !isKeyUp;
+}
+
+void flushOutput() {
+	for (int i = 0; i < outputLength; i++)
+		systemKeyEvent(outputBuffer[i].vkCode, outputBuffer[i].scanCode, outputBuffer[i].flags);
+	outputEvents += outputLength;
+	outputLength = 0;
+}
+
+/**
+ * Physical keys the sequences are made of
+ **/
+typedef struct PhysicalKey {
+	const char *name;
+	WORD scanCode;
+	BYTE vkCode;
+	bool extended;
+} PhysicalKey;
+
+static const PhysicalKey physicalKeys[] = {
+	// ModTap keys and combos (see configureRound()) first
+	{"a", 30, 'A'}, {"s", 31, 'S'}, {"d", 32, 'D'}, {"f", 33, 'F'},
+	{"j", 36, 'J'}, {"k", 37, 'K'}, {"l", 38, 'L'}, {"x", 45, 'X'}, {"c", 46, 'C'},
+	{"e", 18, 'E'}, {"n", 49, 'N'}, {"t", 20, 'T'}, {"z", 21, 'Z'}, {"u", 22, 'U'},
+	{"1", 2, '1'}, {"space", 57, VK_SPACE}, {"return", SCANCODE_RETURN_KEY, VK_RETURN},
+	{"tab", SCANCODE_TAB_KEY, VK_TAB}, {"ä", SCANCODE_QUOTE_KEY, 0xDE}, {"^", 41, 0xDC},
+	{"´", 13, 0xDD}, {"home", 71, VK_HOME, true}, {"up", 72, VK_UP, true},
+	// modifiers and locks
+	{"lshift", 42, VK_LSHIFT}, {"rshift", 54, VK_RSHIFT},
+	{"capslock", SCANCODE_CAPSLOCK_KEY, VK_CAPITAL}, {"#", SCANCODE_HASH_KEY, 0xBF},
+	{"<", SCANCODE_LOWER_THAN_KEY, VK_OEM_102}, {"altgr", 56, VK_RMENU, true},
+	{"lctrl", 29, VK_LCONTROL}, {"rctrl", 29, VK_RCONTROL, true},
+	{"lalt", 56, VK_LMENU}, {"lwin", 91, VK_LWIN, true},
+};
+#define PHYSICAL_KEY_COUNT (sizeof physicalKeys / sizeof physicalKeys[0])
+
+unsigned randomState;
+
+unsigned nextRandom(unsigned range) {
+	randomState = randomState * 1103515245 + 12345;
+	return (randomState >> 8) % range;
+}
+
+/**
+ * Events of the current sequence, printed on a violation
+ **/
+typedef struct SequenceEvent {
+	unsigned key;     // index into physicalKeys, PHYSICAL_KEY_COUNT for a timeout
+	bool isKeyUp;
+	DWORD time;
+} SequenceEvent;
+
+SequenceEvent sequence[MAX_SEQUENCE_EVENTS];
+int sequenceLength;
+DWORD now = 1000;
+uint64_t events = 0;
+
+void fireTimeouts() {
+	DWORD deadline;
+	if (nextModTapDeadline(&deadline) && (int32_t)(now - deadline) >= 0) {
+		if (sequenceLength < MAX_SEQUENCE_EVENTS)
+			sequence[sequenceLength++] = (SequenceEvent){PHYSICAL_KEY_COUNT, false, now};
+		handleModTapTimeout(now);
+		flushOutput();
+	}
+}
+
+void hookEvent(unsigned key, bool isKeyUp) {
+	const PhysicalKey *k = &physicalKeys[key];
+	if (sequenceLength < MAX_SEQUENCE_EVENTS)
+		sequence[sequenceLength++] = (SequenceEvent){key, isKeyUp, now};
+
+	KBDLLHOOKSTRUCT keyInfo = {0};
+	keyInfo.vkCode = k->vkCode;
+	keyInfo.scanCode = k->scanCode;
+	keyInfo.flags = (isKeyUp ? LLKHF_UP : 0) | (k->extended ? LLKHF_EXTENDED : 0);
+	keyInfo.time = now;
+	bool system = k->vkCode == VK_LCONTROL || k->vkCode == VK_RCONTROL || k->vkCode == VK_LMENU
+		|| k->vkCode == VK_RMENU || k->vkCode == VK_LWIN;
+	WPARAM wparam = isKeyUp ? (system ? WM_SYSKEYUP : WM_KEYUP) : (system ? WM_SYSKEYDOWN : WM_KEYDOWN);
+	bool callNext = handleKeyEvent(keyInfo, wparam);
+	flushOutput();
+	if (callNext)
+		systemKeyEvent(keyInfo.vkCode, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo));
+	events++;
+}
+
+/**
+ * A physical key event; AltGr comes with the left Ctrl event Windows generates for it
+ **/
+void physicalEvent(unsigned key, bool isKeyUp) {
+	now += nextRandom(4) == 0 ? nextRandom(400) : nextRandom(60);
+	fireTimeouts();
+	if (physicalKeys[key].vkCode == VK_RMENU) {
+		PhysicalKey fakeCtrl = {"altgr ctrl", 541, VK_LCONTROL};
+		KBDLLHOOKSTRUCT keyInfo = {0};
+		keyInfo.vkCode = fakeCtrl.vkCode;
+		keyInfo.scanCode = fakeCtrl.scanCode;
+		keyInfo.flags = isKeyUp ? LLKHF_UP : 0;
+		keyInfo.time = now;
+		bool callNext = handleKeyEvent(keyInfo, isKeyUp ? WM_SYSKEYUP : WM_SYSKEYDOWN);
+		flushOutput();
+		if (callNext)
+			systemKeyEvent(keyInfo.vkCode, keyInfo.scanCode, dwFlagsFromKeyInfo(keyInfo));
+		events++;
+	}
+	hookEvent(key, isKeyUp);
+}
+
+/**
+ * Settings of a round
+ **/
+void configureRound() {
+	unsigned bits = nextRandom(1 << 16);
+	capsLockEnabled = bits & 1;
+	shiftLockEnabled = (bits & 2) && !capsLockEnabled;
+	level4LockEnabled = bits & 4;
+	qwertzForShortcuts = bits & 8;
+	swapLeftCtrlAndLeftAlt = bits & 16;
+	swapLeftCtrlLeftAltAndLeftWin = (bits & 32) && !swapLeftCtrlAndLeftAlt;
+	supportLevels5and6 = bits & 64;
+	capsLockAsEscape = bits & 128;
+	mod3RAsReturn = bits & 256;
+	mod4LAsTab = bits & 512;
+	quoteAsMod3R = bits & 1024;
+	returnAsMod3R = bits & 2048;
+	tabAsMod4L = bits & 4096;
+
+	memset(modTap, 0, sizeof modTap);
+	if (bits & 8192) {
+		static const ModTap keys[] = {
+			{MT_MOD3, 'a', 0, MT_TAP_NEXT_RELEASE},
+			{MT_SHIFT, 's', 180, MT_PERMISSIVE_HOLD},
+			{MT_CTRL, 'd', 0, MT_HOLD_ON_OTHER_KEY},
+			{MT_MOD4, 'f', 200, MT_TAPPING_TERM},
+			{MT_ALT, 'j', 150, MT_TAP_NEXT_RELEASE},
+		};
+		memcpy(modTap, keys, sizeof keys);
+	}
+	memset(combos, 0, sizeof combos);
+	if (bits & 16384) {
+		combos[0] = (Combo){"kl", COMBO_KEY, VK_ESCAPE, 0x01, 50};
+		combos[1] = (Combo){"xc", COMBO_MODIFIER, MT_CTRL, 0, 60};
+		combos[2] = (Combo){"jkl", COMBO_TEXT, 0, 0, 80, L"Grüße"};
+	}
+	initLayout();
+	updateKeyScanCache(currentKeyboardLayout());
+}
+
+void printSettings() {
+	printf("capsLockEnabled=%d shiftLockEnabled=%d level4LockEnabled=%d qwertzForShortcuts=%d\n",
+		capsLockEnabled, shiftLockEnabled, level4LockEnabled, qwertzForShortcuts);
+	printf("swapLeftCtrlAndLeftAlt=%d swapLeftCtrlLeftAltAndLeftWin=%d supportLevels5and6=%d\n",
+		swapLeftCtrlAndLeftAlt, swapLeftCtrlLeftAltAndLeftWin, supportLevels5and6);
+	printf("capsLockAsEscape=%d mod3RAsReturn=%d mod4LAsTab=%d symmetricalLevel3Modifiers=%d returnKeyAsMod3R=%d tabKeyAsMod4L=%d\n",
+		capsLockAsEscape, mod3RAsReturn, mod4LAsTab, quoteAsMod3R, returnAsMod3R, tabAsMod4L);
+	printf("modTap=%d combos=%d\n", modTap[0].modifier != MT_NONE, combos[0].keys[0] != 0);
+}
+
+/**
+ * returns a description of the first violated invariant or NULL
+ **/
+const char *checkInvariants(char *buffer, size_t size) {
+	releaseInjectedModifiers();
+	flushOutput();
+	if (injectedModifiers) {
+		snprintf(buffer, size, "injected modifiers stuck: 0x%x", injectedModifiers);
+		return buffer;
+	}
+	if (modState & STATE_MODIFIER_KEYS) {
+		snprintf(buffer, size, "modifier held in modState: 0x%x", modState & STATE_MODIFIER_KEYS);
+		return buffer;
+	}
+	if (keyQueueLength) {
+		snprintf(buffer, size, "ModTap queue not empty: %d entries", keyQueueLength);
+		return buffer;
+	}
+	for (int vk = 0; vk < 256; vk++) {
+		if (vkDown[vk]) {
+			snprintf(buffer, size, "key down without key up: vk 0x%02x", vk);
+			return buffer;
+		}
+	}
+	for (int c = 0; unicodeDownCount && c < 0x10000; c++) {
+		if (unicodeDown[c]) {
+			snprintf(buffer, size, "unicode character down without key up: U+%04X", c);
+			return buffer;
+		}
+	}
+	return NULL;
+}
+
+void printSequence() {
+	for (int i = 0; i < sequenceLength; i++) {
+		if (sequence[i].key == PHYSICAL_KEY_COUNT)
+			printf("  %6u  timeout\n", (unsigned)sequence[i].time);
+		else
+			printf("  %6u  %-10s %s\n", (unsigned)sequence[i].time, physicalKeys[sequence[i].key].name,
+				sequence[i].isKeyUp ? "up" : "down");
+	}
+}
+
+/**
+ * One random sequence: keys are pressed (sometimes repeated) and released in
+ * any order, at the end all keys still held are released
+ **/
+void runSequence() {
+	bool held[PHYSICAL_KEY_COUNT] = {false};
+	unsigned heldCount = 0;
+	sequenceLength = 0;
+	unsigned length = 1 + nextRandom(MAX_SEQUENCE_LENGTH);
+
+	// like the system, only the key pressed last repeats, until another key is pressed
+	unsigned repeating = PHYSICAL_KEY_COUNT;
+
+	for (unsigned step = 0; step < length; step++) {
+		unsigned key = nextRandom(PHYSICAL_KEY_COUNT);
+		// keep the number of held keys small most of the time, like real typing
+		if (key == repeating && nextRandom(4) == 0) {
+			physicalEvent(key, false); // autorepeat
+		} else if (held[key] || heldCount >= 1 + nextRandom(6)) {
+			if (!held[key]) {
+				do key = nextRandom(PHYSICAL_KEY_COUNT); while (!held[key]);
+			}
+			physicalEvent(key, true);
+			held[key] = false;
+			heldCount--;
+			if (key == repeating)
+				repeating = PHYSICAL_KEY_COUNT;
+		} else {
+			physicalEvent(key, false);
+			held[key] = true;
+			heldCount++;
+			repeating = key;
+		}
+	}
+	while (heldCount) {
+		unsigned key;
+		do key = nextRandom(PHYSICAL_KEY_COUNT); while (!held[key]);
+		physicalEvent(key, true);
+		held[key] = false;
+		heldCount--;
+	}
+	// tapping and combo terms pass
+	for (int i = 0; i < 4; i++) {
+		now += 1000;
+		fireTimeouts();
+	}
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long sequences = 1000000;
+	unsigned seed = 1;
+	strcpy(layout, "neo");
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "layout=", 7) == 0)
+			strncpy(layout, argv[i] + 7, sizeof layout - 1);
+		else if (strncmp(argv[i], "sequences=", 10) == 0)
+			sequences = strtoul(argv[i] + 10, NULL, 10);
+		else if (strncmp(argv[i], "seed=", 5) == 0)
+			seed = strtoul(argv[i] + 5, NULL, 10);
+		else {
+			printf("Unknown parameter %s\n", argv[i]);
+			printf("Usage: %s [sequences=<n>] [seed=<n>] [layout=<name>]\n", argv[0]);
+			return 1;
+		}
+	}
+	randomState = seed;
+
+	initCharacterToScanCodeMap();
+	resetKeyQueue();
+	latencySetFrequency(latencyFrequency());
+
+	char violation[128];
+	uint64_t start = latencyNow();
+	for (unsigned long i = 0; i < sequences; i++) {
+		if (i % SEQUENCES_PER_ROUND == 0)
+			configureRound();
+		runSequence();
+		if (checkInvariants(violation, sizeof violation)) {
+			printf("Sequence %lu (seed=%u, layout %s): %s\n\n", i, seed, layout, violation);
+			printSettings();
+			printf("\n");
+			printSequence();
+			return 1;
+		}
+	}
+	uint64_t elapsed = latencyNow() - start;
+
+	double seconds = (double)elapsed / latencyFrequency();
+	printf("Sequences:   %lu (seed=%u), layout: %s, no violations\n", sequences, seed, layout);
+	printf("Events:      %lu (%lu emitted)\n", (unsigned long)events, (unsigned long)outputEvents);
+	printf("Throughput:  %.0f events/s\n", events / seconds);
+	printf("Cost:        %.1f ns/event\n", seconds * 1e9 / events);
+	return 0;
+}
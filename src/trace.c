@@ -0,0 +1,112 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+bool traceEnabled = false;
+
+FILE *traceFile = NULL;
+TraceRecord traceBuffer[TRACE_BUFFER_SIZE];
+unsigned traceHead = 0; // next record to write, only modified by the producer
+unsigned traceTail = 0; // next record to read, only modified by the consumer
+unsigned traceDropped = 0;
+
+bool traceOpen(const char *filename) {
+	traceFile = fopen(filename, "wb");
+	if (!traceFile)
+		return false;
+
+	TraceHeader header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof header.magic);
+	header.version = TRACE_VERSION;
+	header.recordSize = sizeof(TraceRecord);
+	fwrite(&header, sizeof header, 1, traceFile);
+	fflush(traceFile);
+	traceEnabled = true;
+	return true;
+}
+
+void traceAppend(const TraceRecord *record) {
+	unsigned tail = __atomic_load_n(&traceTail, __ATOMIC_ACQUIRE);
+	if (traceHead - tail >= TRACE_BUFFER_SIZE) {
+		__atomic_add_fetch(&traceDropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	traceBuffer[traceHead & (TRACE_BUFFER_SIZE - 1)] = *record;
+	__atomic_store_n(&traceHead, traceHead + 1, __ATOMIC_RELEASE);
+}
+
+unsigned traceFlush() {
+	if (!traceFile)
+		return 0;
+	unsigned head = __atomic_load_n(&traceHead, __ATOMIC_ACQUIRE);
+	unsigned count = head - traceTail;
+	if (count == 0)
+		return 0;
+	// write the pending records in at most two chunks (the buffer wraps around)
+	unsigned first = traceTail & (TRACE_BUFFER_SIZE - 1);
+	unsigned chunk = count < TRACE_BUFFER_SIZE - first ? count : TRACE_BUFFER_SIZE - first;
+	fwrite(&traceBuffer[first], sizeof(TraceRecord), chunk, traceFile);
+	if (chunk < count)
+		fwrite(&traceBuffer[0], sizeof(TraceRecord), count - chunk, traceFile);
+	fflush(traceFile);
+	__atomic_store_n(&traceTail, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+void traceClose() {
+	if (!traceFile)
+		return;
+	traceEnabled = false;
+	traceFlush();
+	fclose(traceFile);
+	traceFile = NULL;
+}
+
+unsigned traceDroppedCount() {
+	return __atomic_load_n(&traceDropped, __ATOMIC_RELAXED);
+}
+
+TraceRecord *traceLoad(const char *filename, size_t *count) {
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
+		printf("Could not open trace file %s\n", filename);
+		return NULL;
+	}
+
+	TraceHeader header;
+	if (fread(&header, sizeof header, 1, file) != 1
+		|| memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) != 0
+		|| header.version != TRACE_VERSION
+		|| header.recordSize != sizeof(TraceRecord)) {
+		printf("%s is not a trace file (version %i)\n", filename, TRACE_VERSION);
+		fclose(file);
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file) - (long)sizeof header;
+	fseek(file, sizeof header, SEEK_SET);
+
+	*count = size / sizeof(TraceRecord);
+	TraceRecord *records = malloc(*count * sizeof(TraceRecord) + 1);
+	if (records)
+		*count = fread(records, sizeof(TraceRecord), *count, file);
+	fclose(file);
+	return records;
+}
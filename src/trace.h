@@ -0,0 +1,91 @@
+/*
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Key event traces: a header followed by fixed-size records in the byte
+ * order of the recording machine (little endian on all Windows systems).
+ * They are written with recordTrace=<file> and replayed with
+ * replayTrace=<file> or by the benchmark (make bench TRACE=<file>).
+ */
+#define TRACE_MAGIC "NEOTRACE"
+#define TRACE_VERSION 1
+
+typedef struct TraceHeader {
+	char magic[8];        // TRACE_MAGIC without terminating zero
+	uint32_t version;     // TRACE_VERSION
+	uint32_t recordSize;  // sizeof(TraceRecord)
+} TraceHeader;
+
+typedef struct TraceRecord {
+	uint32_t time;        // KBDLLHOOKSTRUCT.time (ms)
+	uint16_t scanCode;    // KBDLLHOOKSTRUCT.scanCode (541 for the Ctrl part of AltGr)
+	uint8_t vkCode;       // KBDLLHOOKSTRUCT.vkCode
+	uint8_t flags;        // KBDLLHOOKSTRUCT.flags (LLKHF_*)
+	uint16_t message;     // WM_KEYDOWN, WM_KEYUP, WM_SYSKEYDOWN or WM_SYSKEYUP
+	uint8_t swallowed;    // 1 if the event was not passed to the next hook, TRACE_UNKNOWN if not recorded
+	uint8_t reserved;
+} TraceRecord;
+
+#define TRACE_UNKNOWN 0xff
+
+#define TRACE_BUFFER_SIZE 4096 // must be a power of two
+
+/**
+ * True if a trace is being recorded
+ */
+extern bool traceEnabled;
+
+/**
+ * Creates the trace file and writes the header.
+ * returns `false` if the file could not be created
+ */
+bool traceOpen(const char *filename);
+
+/**
+ * Hook thread only: queue a record for the writer.
+ * If the buffer is full, the record is dropped and counted.
+ */
+void traceAppend(const TraceRecord *record);
+
+/**
+ * Writer thread only: write all queued records to the file.
+ * returns the number of records written
+ */
+unsigned traceFlush();
+
+/**
+ * Flushes the remaining records and closes the file.
+ */
+void traceClose();
+
+/**
+ * Number of records dropped because the buffer was full.
+ */
+unsigned traceDroppedCount();
+
+/**
+ * Reads a whole trace file into a newly allocated array (free() it).
+ * returns NULL (and prints the reason) if the file can't be read or is no trace
+ */
+TraceRecord *traceLoad(const char *filename, size_t *count);
+
+#endif